@@ -0,0 +1,155 @@
+#include "z_tool.h"
+#include "z_kfifo.h"
+
+#include <pthread.h>
+
+// Bytes pushed through the descriptor pair per run
+#define BENCH_BYTES (256u << 20)
+// Size of the kfifo staging buffer
+#define BENCH_FIFO_SIZE (256u << 10)
+// Largest single transfer, matches the temporary buffer of the copy-based path
+#define BENCH_CHUNK (64u << 10)
+// Runs per configuration, the fastest one is reported
+#define BENCH_ROUNDS 3
+
+static uint8_t gs_chunk[BENCH_CHUNK];
+
+// Monotonic time in milliseconds
+static double bench_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Peer thread feeding BENCH_BYTES into the descriptor, then closing it
+static void *bench_writer(void *p_arg) {
+    int fd = (int)(intptr_t)p_arg;
+    uint64_t left = BENCH_BYTES;
+
+    while (left) {
+        ssize_t n = write(fd, gs_chunk, Z_TOOL_MIN(left, (uint64_t)BENCH_CHUNK));
+        if (n <= 0) {
+            break;
+        }
+        left -= n;
+    }
+    close(fd);
+    return NULL;
+}
+
+// Peer thread draining the descriptor until EOF
+static void *bench_reader(void *p_arg) {
+    int fd = (int)(intptr_t)p_arg;
+    static uint8_t s_sink[BENCH_CHUNK];
+
+    while (read(fd, s_sink, sizeof(s_sink)) > 0) {
+    }
+    close(fd);
+    return NULL;
+}
+
+// Ingest: read() into a temporary buffer and z_kfifo_in it, or z_kfifo_from_fd straight into the ring
+static uint64_t bench_ingest(int fd, struct z_kfifo_struct *p_fifo, int direct) {
+    static uint8_t s_tmp[BENCH_CHUNK];
+    uint64_t total = 0;
+
+    while (1) {
+        int n;
+        if (direct) {
+            n = z_kfifo_from_fd(p_fifo, fd, BENCH_CHUNK);
+        } else {
+            n = read(fd, s_tmp, Z_TOOL_MIN(z_kfifo_space(p_fifo), BENCH_CHUNK));
+            if (n > 0) {
+                z_kfifo_in(p_fifo, s_tmp, n);
+            }
+        }
+        if (n <= 0) {
+            break;
+        }
+        total += n;
+
+        // The consumer of the staged bytes is not part of the measurement
+        z_kfifo_out_skip(p_fifo, z_kfifo_data_len(p_fifo));
+    }
+    return total;
+}
+
+// Egress: z_kfifo_out into a temporary buffer and write() it, or z_kfifo_to_fd straight from the ring
+static uint64_t bench_egress(int fd, struct z_kfifo_struct *p_fifo, int direct) {
+    static uint8_t s_tmp[BENCH_CHUNK];
+    uint64_t total = 0;
+
+    while (total < BENCH_BYTES) {
+        // The producer of the staged bytes is not part of the measurement
+        z_kfifo_in_commit(p_fifo, z_kfifo_space(p_fifo));
+
+        int n;
+        if (direct) {
+            n = z_kfifo_to_fd(p_fifo, fd, BENCH_CHUNK);
+        } else {
+            uint32_t len = z_kfifo_out_check(p_fifo, s_tmp, BENCH_CHUNK);
+            n = write(fd, s_tmp, len);
+            if (n > 0) {
+                z_kfifo_out_skip(p_fifo, n);
+            }
+        }
+        if (n <= 0) {
+            break;
+        }
+        total += n;
+    }
+    close(fd);
+    return total;
+}
+
+// Runs one direction over one descriptor pair type, returns the best throughput in MB/s
+static double bench_run(int socket, int egress, int direct) {
+    double best_ms = 1e30;
+
+    for (uint32_t r = 0; r < BENCH_ROUNDS; r++) {
+        struct z_kfifo_struct fifo;
+        pthread_t peer;
+        int fds[2];
+
+        if ((socket ? socketpair(AF_UNIX, SOCK_STREAM, 0, fds) : pipe(fds)) != 0 || z_kfifo_malloc(&fifo, BENCH_FIFO_SIZE) != 0) {
+            printf("Failed to set up the descriptors\n");
+            exit(-1);
+        }
+
+        // fds[0] is the read end of a pipe, either end of a socket pair works both ways
+        double t0 = bench_now_ms();
+        uint64_t total;
+        if (egress) {
+            pthread_create(&peer, NULL, bench_reader, (void *)(intptr_t)fds[0]);
+            total = bench_egress(fds[1], &fifo, direct);
+        } else {
+            pthread_create(&peer, NULL, bench_writer, (void *)(intptr_t)fds[1]);
+            total = bench_ingest(fds[0], &fifo, direct);
+            close(fds[0]);
+        }
+        pthread_join(peer, NULL);
+        double t1 = bench_now_ms();
+
+        z_kfifo_free(&fifo);
+        if (total != BENCH_BYTES) {
+            printf("Short transfer: %lu of %u bytes\n", total, BENCH_BYTES);
+            exit(-1);
+        }
+        best_ms = Z_TOOL_MIN(best_ms, t1 - t0);
+    }
+    return (BENCH_BYTES / 1048576.0) / (best_ms / 1e3);
+}
+
+int main(int argc, char *argv[]) {
+    printf("kfifo <-> fd staging, %u MB per run through a %u KB kfifo, best of %d runs\n", BENCH_BYTES >> 20, BENCH_FIFO_SIZE >> 10, BENCH_ROUNDS);
+    printf("%-12s %-8s %-14s %-14s %-10s\n", "fd", "dir", "copy_MB/s", "iovec_MB/s", "speedup");
+
+    for (int socket = 0; socket < 2; socket++) {
+        for (int egress = 0; egress < 2; egress++) {
+            double copy = bench_run(socket, egress, 0);
+            double direct = bench_run(socket, egress, 1);
+            printf("%-12s %-8s %-14.1f %-14.1f %-10.2f\n", socket ? "socketpair" : "pipe", egress ? "to_fd" : "from_fd", copy, direct, direct / copy);
+        }
+    }
+    return 0;
+}
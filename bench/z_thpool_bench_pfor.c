@@ -0,0 +1,123 @@
+#include "z_tool.h"
+#include "z_thpool.h"
+
+#include <pthread.h>
+
+// Number of records processed per run
+#define BENCH_NUMS (10 * 1000 * 1000)
+// Runs per configuration, the fastest one is reported
+#define BENCH_ROUNDS 5
+
+static double *gs_in;
+static double *gs_out;
+
+// Per-record work, heavy enough that memory bandwidth is not the only limit
+static inline double bench_record(double x) {
+    return sqrt(x) * sin(x) + log1p(x);
+}
+
+// parallel_for body
+static void bench_for_body(uint64_t begin, uint64_t end, void *p_ctx) {
+    for (uint64_t i = begin; i < end; i++) {
+        gs_out[i] = bench_record(gs_in[i]);
+    }
+}
+
+// parallel_reduce body
+static void bench_reduce_body(uint64_t begin, uint64_t end, void *p_acc, void *p_ctx) {
+    double sum = *(double *)p_acc;
+    for (uint64_t i = begin; i < end; i++) {
+        sum += bench_record(gs_in[i]);
+    }
+    *(double *)p_acc = sum;
+}
+
+// parallel_reduce join
+static void bench_reduce_join(void *p_acc, const void *p_other, void *p_ctx) {
+    *(double *)p_acc += *(const double *)p_other;
+}
+
+// Monotonic time in milliseconds
+static double bench_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    double serial_ms = 1e30;
+    double serial_reduce_ms = 1e30;
+    double serial_sum = 0;
+
+    gs_in = (double *)malloc(BENCH_NUMS * sizeof(double));
+    gs_out = (double *)malloc(BENCH_NUMS * sizeof(double));
+    if (!gs_in || !gs_out) {
+        printf("Out of memory\n");
+        return -1;
+    }
+    for (uint64_t i = 0; i < BENCH_NUMS; i++) {
+        gs_in[i] = (double)(i % 1000) + 0.5;
+    }
+
+    // Serial baseline
+    for (uint32_t r = 0; r < BENCH_ROUNDS; r++) {
+        double t0 = bench_now_ms();
+        bench_for_body(0, BENCH_NUMS, NULL);
+        double t1 = bench_now_ms();
+        serial_sum = 0;
+        bench_reduce_body(0, BENCH_NUMS, &serial_sum, NULL);
+        double t2 = bench_now_ms();
+
+        serial_ms = Z_TOOL_MIN(serial_ms, t1 - t0);
+        serial_reduce_ms = Z_TOOL_MIN(serial_reduce_ms, t2 - t1);
+    }
+
+    // Pool sizes from 1 worker up to one per core, or up to argv[1]
+    uint32_t max = argc > 1 ? (uint32_t)atoi(argv[1]) : cpus;
+    printf("parallel_for / parallel_reduce over %d records on %u cores, best of %d runs\n", BENCH_NUMS, cpus, BENCH_ROUNDS);
+    printf("%-8s %-12s %-10s %-12s %-10s\n", "workers", "for_ms", "speedup", "reduce_ms", "speedup");
+    printf("%-8s %-12.2f %-10.2f %-12.2f %-10.2f\n", "serial", serial_ms, 1.0, serial_reduce_ms, 1.0);
+
+    // The calling thread takes part as well, on top of the pool's workers
+    for (uint32_t workers = 1; workers <= max; workers = workers < max && workers * 2 > max ? max : workers * 2) {
+        struct z_thpool_config_struct config = {0};
+        config.max_thread_nums = workers;
+        config.msg_node_max = 256;
+        config.thread_stack_size = 64 * 1024;
+        config.queue_type = E_Z_THPOOL_QUEUE_MPMC;
+
+        z_thpool_handle_t handle;
+        if (z_thpool_create(&config, &handle) != 0) {
+            printf("Failed to create thread pool\n");
+            return -1;
+        }
+
+        double for_ms = 1e30;
+        double reduce_ms = 1e30;
+        for (uint32_t r = 0; r < BENCH_ROUNDS; r++) {
+            double sum = 0;
+            double t0 = bench_now_ms();
+            z_thpool_parallel_for(handle, 0, BENCH_NUMS, 0, bench_for_body, NULL);
+            double t1 = bench_now_ms();
+            z_thpool_parallel_reduce(handle, 0, BENCH_NUMS, 0, bench_reduce_body, bench_reduce_join, &sum, sizeof(sum), NULL);
+            double t2 = bench_now_ms();
+
+            for_ms = Z_TOOL_MIN(for_ms, t1 - t0);
+            reduce_ms = Z_TOOL_MIN(reduce_ms, t2 - t1);
+            if (fabs(sum - serial_sum) > 1e-6 * fabs(serial_sum)) {
+                printf("Reduce mismatch: %f != %f\n", sum, serial_sum);
+                return -1;
+            }
+        }
+        printf("%-8u %-12.2f %-10.2f %-12.2f %-10.2f\n", workers, for_ms, serial_ms / for_ms, reduce_ms, serial_reduce_ms / reduce_ms);
+        z_thpool_destroy(handle);
+        if (workers == max) {
+            break;
+        }
+    }
+
+    free(gs_in);
+    free(gs_out);
+    return 0;
+}
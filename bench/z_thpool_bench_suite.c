@@ -0,0 +1,322 @@
+#include "z_tool.h"
+#include "z_kfifo.h"
+#include "z_thpool.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+// Empty tasks pushed per throughput run, split over the producers
+#define BENCH_TASKS (200 * 1000)
+// Runs per throughput configuration, the fastest one is reported
+#define BENCH_ROUNDS 3
+// Queue slots of the pools under test
+#define BENCH_QUEUE 1024
+// Tasks timed per latency run
+#define BENCH_LAT_NUMS 20000
+// Tasks submitted back-to-back per burst in the latency run
+#define BENCH_LAT_BURST 64
+// Rejected add_work calls timed per full-queue run, split over the producers
+#define BENCH_FULL_CALLS (1000 * 1000)
+// Bytes moved through the kfifo per record size
+#define BENCH_KFIFO_BYTES (256u << 20)
+// Size of the kfifo under test
+#define BENCH_KFIFO_SIZE (1u << 20)
+
+static const char *gs_queue_names[] = {"kfifo", "mpmc"};
+static const uint32_t gs_rec_sizes[] = {16, 64, 256, 1024, 4096, 16384};
+
+static FILE *gs_csv;              // Report, stdout unless -o is given
+static uint32_t gs_arg;           // Non-NULL argument handed to every task
+static uint64_t gs_done;          // Tasks run by the counting callback
+static uint32_t gs_gate;          // Releases the tasks holding the workers in the full-queue run
+static uint32_t gs_held;          // Workers held by the gate
+
+// Arguments of one producer thread
+struct bench_producer_struct {
+    z_thpool_handle_t handle;      // Pool under test
+    pthread_barrier_t *p_barrier;  // Lines the producers up with the timer
+    uint32_t nums;                 // Calls to make
+    uint64_t rejected;             // Calls answered with -EAGAIN
+};
+
+// Monotonic time in seconds
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// One CSV row, latency columns are left empty when p_lat is NULL
+static void bench_row(const char *p_scenario, const char *p_queue, uint32_t producers, uint32_t workers, uint32_t param, uint64_t ops, uint64_t bytes,
+                      double sec, const struct z_thpool_latency_struct *p_lat) {
+    fprintf(gs_csv, "%s,%s,%u,%u,%u,%lu,%.6f,%.0f,%.1f", p_scenario, p_queue, producers, workers, param, ops, sec, ops / sec, bytes / sec / 1048576.0);
+    if (p_lat) {
+        fprintf(gs_csv, ",%lu,%lu,%lu,%lu,%lu\n", p_lat->p50, p_lat->p90, p_lat->p99, p_lat->p999, p_lat->max);
+    } else {
+        fprintf(gs_csv, ",,,,,\n");
+    }
+    fflush(gs_csv);
+}
+
+// Next point of a 1, 2, 4, ... max sweep, max itself is always included, 0 ends the sweep
+static uint32_t bench_next(uint32_t nums, uint32_t max) {
+    if (nums >= max) {
+        return 0;
+    }
+    return nums * 2 > max ? max : nums * 2;
+}
+
+static z_thpool_handle_t bench_pool(uint32_t queue_type, uint32_t workers, uint32_t queue, uint32_t latency_flag) {
+    struct z_thpool_config_struct config = {0};
+    z_thpool_handle_t handle;
+
+    config.max_thread_nums = workers;
+    config.msg_node_max = queue;
+    config.thread_stack_size = 64 * 1024;
+    config.queue_type = queue_type;
+    config.latency_flag = latency_flag;
+    strncpy(config.pool_name, "bench", sizeof(config.pool_name) - 1);
+    if (z_thpool_create(&config, &handle) != 0) {
+        fprintf(stderr, "Failed to create thread pool\n");
+        exit(-1);
+    }
+    return handle;
+}
+
+static void bench_empty(void *p_arg) {
+}
+
+static void bench_count(void *p_arg) {
+    __atomic_add_fetch(&gs_done, 1, __ATOMIC_RELEASE);
+}
+
+// Occupies a worker until the gate opens
+static void bench_hold(void *p_arg) {
+    __atomic_add_fetch(&gs_held, 1, __ATOMIC_RELEASE);
+    while (!__atomic_load_n(&gs_gate, __ATOMIC_ACQUIRE)) {
+        usleep(100);
+    }
+}
+
+// Throughput producer, waits for free slots so that every task is accepted
+static void *bench_submit_proc(void *p_arg) {
+    struct bench_producer_struct *p_prod = (struct bench_producer_struct *)p_arg;
+
+    pthread_barrier_wait(p_prod->p_barrier);
+    for (uint32_t i = 0; i < p_prod->nums; i++) {
+        z_thpool_add_work_wait(p_prod->handle, bench_empty, &gs_arg);
+    }
+    return NULL;
+}
+
+// Full-queue producer, every call is expected to bounce
+static void *bench_reject_proc(void *p_arg) {
+    struct bench_producer_struct *p_prod = (struct bench_producer_struct *)p_arg;
+
+    pthread_barrier_wait(p_prod->p_barrier);
+    for (uint32_t i = 0; i < p_prod->nums; i++) {
+        if (z_thpool_add_work(p_prod->handle, bench_empty, &gs_arg) == -EAGAIN) {
+            p_prod->rejected++;
+        }
+    }
+    return NULL;
+}
+
+// Runs P producer threads over one pool and returns the seconds from their release until proc returns and the pool drains
+static double bench_producers(z_thpool_handle_t handle, uint32_t producers, uint32_t total, void *(*proc)(void *), uint64_t *p_rejected) {
+    struct bench_producer_struct prods[producers];
+    pthread_t tids[producers];
+    pthread_barrier_t barrier;
+
+    pthread_barrier_init(&barrier, NULL, producers + 1);
+    for (uint32_t i = 0; i < producers; i++) {
+        prods[i].handle = handle;
+        prods[i].p_barrier = &barrier;
+        prods[i].nums = total / producers + (i < total % producers);
+        prods[i].rejected = 0;
+        pthread_create(&tids[i], NULL, proc, &prods[i]);
+    }
+
+    pthread_barrier_wait(&barrier);
+    double t0 = bench_now();
+    for (uint32_t i = 0; i < producers; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    if (!p_rejected) {
+        z_thpool_wait_idle(handle, Z_THPOOL_WAIT_FOREVER);
+    }
+    double t1 = bench_now();
+    pthread_barrier_destroy(&barrier);
+
+    if (p_rejected) {
+        *p_rejected = 0;
+        for (uint32_t i = 0; i < producers; i++) {
+            *p_rejected += prods[i].rejected;
+        }
+    }
+    return t1 - t0;
+}
+
+// Empty-task throughput over the producers x workers grid
+static void bench_throughput(uint32_t queue_type, uint32_t max_producers, uint32_t max_workers) {
+    for (uint32_t workers = 1; workers; workers = bench_next(workers, max_workers)) {
+        z_thpool_handle_t handle = bench_pool(queue_type, workers, BENCH_QUEUE, 0);
+        for (uint32_t producers = 1; producers; producers = bench_next(producers, max_producers)) {
+            double best = 1e30;
+            for (uint32_t r = 0; r < BENCH_ROUNDS; r++) {
+                best = Z_TOOL_MIN(best, bench_producers(handle, producers, BENCH_TASKS, bench_submit_proc, NULL));
+            }
+            bench_row("throughput", gs_queue_names[queue_type], producers, workers, 0, BENCH_TASKS, 0, best, NULL);
+        }
+        z_thpool_destroy(handle);
+    }
+}
+
+// Submit-to-start latency from the pool's own histograms, one task at a time into an idle pool, then in bursts
+static void bench_latency(uint32_t queue_type, uint32_t max_workers) {
+    for (uint32_t workers = 1; workers; workers = bench_next(workers, max_workers)) {
+        for (uint32_t burst = 1; burst; burst = burst == 1 ? BENCH_LAT_BURST : 0) {
+            struct z_thpool_latency_struct wait;
+            z_thpool_handle_t handle = bench_pool(queue_type, workers, BENCH_QUEUE, 1);
+
+            __atomic_store_n(&gs_done, 0, __ATOMIC_RELAXED);
+            double t0 = bench_now();
+            for (uint32_t i = 0; i < BENCH_LAT_NUMS; i += burst) {
+                for (uint32_t j = 0; j < burst; j++) {
+                    z_thpool_add_work_wait(handle, bench_count, &gs_arg);
+                }
+
+                // Let the workers go idle again before the next round
+                while (__atomic_load_n(&gs_done, __ATOMIC_ACQUIRE) < i + burst) {
+                    sched_yield();
+                }
+            }
+            double t1 = bench_now();
+
+            z_thpool_wait_idle(handle, Z_THPOOL_WAIT_FOREVER);
+            z_thpool_latency_get(handle, &wait, NULL);
+            bench_row(burst == 1 ? "latency_idle" : "latency_burst", gs_queue_names[queue_type], 1, workers, burst, wait.count, 0, t1 - t0, &wait);
+            z_thpool_destroy(handle);
+        }
+    }
+}
+
+// Cost of z_thpool_add_work bouncing off a full queue, the workers are held so nothing drains
+static void bench_full(uint32_t queue_type, uint32_t max_producers, uint32_t workers) {
+    for (uint32_t producers = 1; producers; producers = bench_next(producers, max_producers)) {
+        z_thpool_handle_t handle = bench_pool(queue_type, workers, 64, 0);
+        uint64_t rejected;
+
+        __atomic_store_n(&gs_gate, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&gs_held, 0, __ATOMIC_RELAXED);
+        for (uint32_t i = 0; i < workers; i++) {
+            z_thpool_add_work_wait(handle, bench_hold, &gs_arg);
+        }
+        while (__atomic_load_n(&gs_held, __ATOMIC_ACQUIRE) < workers) {
+            usleep(100);
+        }
+        while (z_thpool_add_work(handle, bench_hold, &gs_arg) == 0) {
+        }
+
+        double sec = bench_producers(handle, producers, BENCH_FULL_CALLS, bench_reject_proc, &rejected);
+        bench_row("full_queue", gs_queue_names[queue_type], producers, workers, 64, rejected, 0, sec, NULL);
+
+        __atomic_store_n(&gs_gate, 1, __ATOMIC_RELEASE);
+        z_thpool_wait_idle(handle, Z_THPOOL_WAIT_FOREVER);
+        z_thpool_destroy(handle);
+    }
+}
+
+// Arguments of the kfifo reader thread
+struct bench_kfifo_struct {
+    struct z_kfifo_struct fifo; // Ring under test
+    uint32_t rec_size;          // Bytes per z_kfifo_in / z_kfifo_out call
+};
+
+// kfifo consumer, drains BENCH_KFIFO_BYTES in rec_size pieces
+static void *bench_kfifo_reader(void *p_arg) {
+    struct bench_kfifo_struct *p_bench = (struct bench_kfifo_struct *)p_arg;
+    uint8_t *p_rec = (uint8_t *)malloc(p_bench->rec_size);
+    uint64_t total = 0;
+
+    while (total < BENCH_KFIFO_BYTES) {
+        uint32_t n = z_kfifo_out(&p_bench->fifo, p_rec, p_bench->rec_size);
+        if (!n) {
+            sched_yield();
+        }
+        total += n;
+    }
+    free(p_rec);
+    return NULL;
+}
+
+// Raw z_kfifo_in / z_kfifo_out bandwidth, one producer and one consumer thread
+static void bench_kfifo(void) {
+    for (uint32_t i = 0; i < sizeof(gs_rec_sizes) / sizeof(gs_rec_sizes[0]); i++) {
+        struct bench_kfifo_struct bench;
+        pthread_t tid;
+        uint64_t total = 0;
+
+        bench.rec_size = gs_rec_sizes[i];
+        if (z_kfifo_malloc(&bench.fifo, BENCH_KFIFO_SIZE) != 0) {
+            fprintf(stderr, "Failed to allocate the kfifo\n");
+            exit(-1);
+        }
+        uint8_t *p_rec = (uint8_t *)calloc(1, bench.rec_size);
+
+        double t0 = bench_now();
+        pthread_create(&tid, NULL, bench_kfifo_reader, &bench);
+        while (total < BENCH_KFIFO_BYTES) {
+            // Only whole records go in, like a producer of framed messages
+            if (z_kfifo_space(&bench.fifo) < bench.rec_size) {
+                sched_yield();
+                continue;
+            }
+            total += z_kfifo_in(&bench.fifo, p_rec, bench.rec_size);
+        }
+        pthread_join(tid, NULL);
+        double t1 = bench_now();
+
+        bench_row("kfifo_spsc", "kfifo", 1, 1, bench.rec_size, BENCH_KFIFO_BYTES / bench.rec_size, BENCH_KFIFO_BYTES, t1 - t0, NULL);
+        free(p_rec);
+        z_kfifo_free(&bench.fifo);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t max_producers = cpus;
+    uint32_t max_workers = cpus;
+    int opt;
+
+    // Sweep producers and workers from 1 up to one per core unless -p / -w say otherwise
+    gs_csv = stdout;
+    while ((opt = getopt(argc, argv, "p:w:o:")) != -1) {
+        if (opt == 'p') {
+            max_producers = (uint32_t)atoi(optarg);
+        } else if (opt == 'w') {
+            max_workers = (uint32_t)atoi(optarg);
+        } else if (opt == 'o' && (gs_csv = fopen(optarg, "w")) == NULL) {
+            fprintf(stderr, "Failed to open %s\n", optarg);
+            return -1;
+        } else if (opt == '?') {
+            fprintf(stderr, "Usage: %s [-p max_producers] [-w max_workers] [-o report.csv]\n", argv[0]);
+            return -1;
+        }
+    }
+    max_producers = Z_TOOL_MAX(max_producers, 1);
+    max_workers = Z_TOOL_MAX(max_workers, 1);
+
+    fprintf(gs_csv, "scenario,queue,producers,workers,param,ops,seconds,ops_per_sec,mb_per_sec,p50_ns,p90_ns,p99_ns,p999_ns,max_ns\n");
+    for (uint32_t queue_type = E_Z_THPOOL_QUEUE_KFIFO; queue_type <= E_Z_THPOOL_QUEUE_MPMC; queue_type++) {
+        bench_throughput(queue_type, max_producers, max_workers);
+        bench_latency(queue_type, max_workers);
+        bench_full(queue_type, max_producers, max_workers);
+    }
+    bench_kfifo();
+
+    if (gs_csv != stdout) {
+        fclose(gs_csv);
+    }
+    return 0;
+}
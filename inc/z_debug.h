@@ -5,6 +5,8 @@
 extern "C" {
 #endif /* __cplusplus */
 
+#include "z_log.h"
+
 #define E_LEVEL_COLOR_ESC_START "\033["
 #define E_LEVEL_COLOR_ESC_END "\033[0m"
 #define E_LEVEL_COLOR_FATAL "1;31;40m"   // Bold Red text on a black background
@@ -26,43 +28,22 @@ enum z_level_enum {
     E_Z_DEBUG_LEVEL_DEBUG,
     E_Z_DEBUG_LEVEL_MAX
 };
-#define _Z_DEBUG(_level, format, args...)                                                                                                                                        \
-    while (1) {                                                                                                                                                                  \
-        switch (_level) {                                                                                                                                                        \
-            case E_Z_DEBUG_LEVEL_FATAL:                                                                                                                                          \
-                printf("[fatal ][%s:%d, %s] " E_LEVEL_COLOR_ESC_START E_LEVEL_COLOR_FATAL format E_LEVEL_COLOR_ESC_END E_LINE_MODE, __FILE__, __LINE__, __FUNCTION__, ##args);   \
-                fflush(stdout);                                                                                                                                                  \
-                break;                                                                                                                                                           \
-            case E_Z_DEBUG_LEVEL_ERROR:                                                                                                                                          \
-                printf("[error ][%s:%d, %s] " E_LEVEL_COLOR_ESC_START E_LEVEL_COLOR_ERROR format E_LEVEL_COLOR_ESC_END E_LINE_MODE, __FILE__, __LINE__, __FUNCTION__, ##args);   \
-                fflush(stdout);                                                                                                                                                  \
-                break;                                                                                                                                                           \
-            case E_Z_DEBUG_LEVEL_WARN:                                                                                                                                           \
-                printf("[wart  ][%s:%d, %s] " E_LEVEL_COLOR_ESC_START E_LEVEL_COLOR_WARN format E_LEVEL_COLOR_ESC_END E_LINE_MODE, __FILE__, __LINE__, __FUNCTION__, ##args);    \
-                fflush(stdout);                                                                                                                                                  \
-                break;                                                                                                                                                           \
-            case E_Z_DEBUG_LEVEL_NOTICE:                                                                                                                                         \
-                printf("[notice][%s:%d, %s] " E_LEVEL_COLOR_ESC_START E_LEVEL_COLOR_NOTICE format E_LEVEL_COLOR_ESC_END E_LINE_MODE, __FILE__, __LINE__, __FUNCTION__, ##args);  \
-                fflush(stdout);                                                                                                                                                  \
-                break;                                                                                                                                                           \
-            case E_Z_DEBUG_LEVEL_INFO:                                                                                                                                           \
-                printf("[info  ][%s:%d, %s] " E_LEVEL_COLOR_ESC_START E_LEVEL_COLOR_INFO format E_LEVEL_COLOR_ESC_END E_LINE_MODE, __FILE__, __LINE__, __FUNCTION__, ##args);    \
-                fflush(stdout);                                                                                                                                                  \
-                break;                                                                                                                                                           \
-            case E_Z_DEBUG_LEVEL_DEBUG:                                                                                                                                          \
-                printf("[debug ][%s:%d, %s] " E_LEVEL_COLOR_ESC_START E_LEVEL_COLORRE_DEBUG format E_LEVEL_COLOR_ESC_END E_LINE_MODE, __FILE__, __LINE__, __FUNCTION__, ##args); \
-                fflush(stdout);                                                                                                                                                  \
-                break;                                                                                                                                                           \
-            case E_Z_DEBUG_LEVEL_RAW:                                                                                                                                            \
-            case E_Z_DEBUG_LEVEL_PRINTF:                                                                                                                                         \
-                printf(format, ##args);                                                                                                                                          \
-                fflush(stdout);                                                                                                                                                  \
-                break;                                                                                                                                                           \
-            default:                                                                                                                                                             \
-                break;                                                                                                                                                           \
-        }                                                                                                                                                                        \
-        break;                                                                                                                                                                   \
-    }
+// Levels above Z_DEBUG_LEVEL are compiled out, build with -DZ_DEBUG_LEVEL=E_Z_DEBUG_LEVEL_DEBUG to keep the Z_DEBUG lines
+#ifndef Z_DEBUG_LEVEL
+#define Z_DEBUG_LEVEL E_Z_DEBUG_LEVEL_INFO
+#endif
+
+// Z_RAW and Z_PRINTF print straight away, the other levels go through z_log_write (see z_log.h)
+#define _Z_DEBUG(_level, format, args...)                                            \
+    do {                                                                             \
+        if ((_level) > Z_DEBUG_LEVEL) {                                              \
+        } else if ((_level) <= E_Z_DEBUG_LEVEL_RAW) {                                \
+            printf(format, ##args);                                                  \
+            fflush(stdout);                                                          \
+        } else {                                                                     \
+            z_log_write((_level), __FILE__, __LINE__, __FUNCTION__, format, ##args); \
+        }                                                                            \
+    } while (0)
 
 #define Z_DEBUG(format, args...) _Z_DEBUG(E_Z_DEBUG_LEVEL_DEBUG, format, ##args)
 #define Z_ERROR(format, args...) _Z_DEBUG(E_Z_DEBUG_LEVEL_ERROR, format, ##args)
@@ -0,0 +1,48 @@
+#ifndef _Z_HIST_H_
+#define _Z_HIST_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/* Linear sub-buckets per power of two, 2^6 keeps the relative error of a reading below 1/32 */
+#define Z_HIST_SUB_BITS 6
+/* Values at or above 2^Z_HIST_MAX_BITS are counted in the last bucket (2^42 ns is about 73 minutes) */
+#define Z_HIST_MAX_BITS 42
+/* Number of buckets: exact values below 2^SUB_BITS, then half as many per further power of two */
+#define Z_HIST_BUCKETS ((1u << Z_HIST_SUB_BITS) + (Z_HIST_MAX_BITS - Z_HIST_SUB_BITS) * (1u << (Z_HIST_SUB_BITS - 1)))
+
+/*
+ * Structure defining a log-linear (HDR style) histogram of 64-bit values.
+ * Each power of two is split into equal sub-buckets, so the bucket width
+ * grows with the value and the relative precision stays constant. A single
+ * thread records into a histogram without locked instructions, any thread
+ * may read or merge it at the same time.
+ */
+struct z_hist_struct {
+    uint64_t counts[Z_HIST_BUCKETS]; /* Samples per bucket */
+    uint64_t total;                  /* Number of samples */
+    uint64_t sum;                    /* Sum of the samples, for the mean */
+    uint64_t max;                    /* Largest sample */
+};
+
+/* Clear every bucket of the histogram */
+void z_hist_reset(struct z_hist_struct *p_hist);
+
+/* Record one value, only one thread may record into a given histogram */
+void z_hist_record(struct z_hist_struct *p_hist, uint64_t value);
+
+/* Add the samples of p_from into p_to, p_from may be recorded into concurrently */
+void z_hist_merge(struct z_hist_struct *p_to, const struct z_hist_struct *p_from);
+
+/* Value below which pct percent of the samples fall (highest value of the matching bucket), 0 when empty */
+uint64_t z_hist_percentile(const struct z_hist_struct *p_hist, double pct);
+
+/* Test functionality of the histogram; could be used for diagnostics or unit testing */
+uint32_t z_hist_test(void);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _Z_HIST_H_ */
@@ -11,6 +11,19 @@ struct z_kfifo_struct {
     uint32_t size;     /* Total size of the allocated buffer */
     uint32_t in;       /* Offset where data is added (in % size) */
     uint32_t out;      /* Offset where data is extracted (out % size) */
+    uint32_t mirror;   /* Non-zero when the buffer is mapped twice back to back, see z_kfifo_malloc_mirror */
+};
+
+/* Bytes in front of each record holding its length, see z_kfifo_in_rec */
+#define Z_KFIFO_REC_HEAD sizeof(uint32_t)
+
+/*
+ * Contiguous piece of the FIFO buffer handed out for zero-copy access.
+ * A reservation or a peek wraps at most once, so two spans cover it.
+ */
+struct z_kfifo_span_struct {
+    uint8_t *p_data; /* Start of the piece inside the FIFO buffer */
+    uint32_t len;    /* Number of bytes in the piece, 0 when unused */
 };
 
 /* Initialize the FIFO with an existing buffer and its size */
@@ -19,6 +32,14 @@ void z_kfifo_init(struct z_kfifo_struct *p_fifo, void *p_buffer, uint32_t size);
 /* Allocate a buffer for the FIFO dynamically */
 int z_kfifo_malloc(struct z_kfifo_struct *p_fifo, uint32_t size);
 
+/*
+ * Allocate the buffer as the same memfd pages mapped twice back to back, so
+ * any span of up to size bytes is contiguous: copies never split at the wrap
+ * point and peeks always return a single span. Falls back to z_kfifo_malloc
+ * when the rounded size is not a multiple of the page size or mapping fails.
+ */
+int z_kfifo_malloc_mirror(struct z_kfifo_struct *p_fifo, uint32_t size);
+
 /* Free the dynamically allocated buffer in the FIFO */
 void z_kfifo_free(struct z_kfifo_struct *p_fifo);
 
@@ -37,6 +58,52 @@ uint32_t z_kfifo_data_len(struct z_kfifo_struct *p_fifo);
 /* Check and potentially extract data without removing it from the FIFO */
 uint32_t z_kfifo_out_check(struct z_kfifo_struct *p_fifo, void *p_to, uint32_t len);
 
+/* Reserve up to len bytes of free space as two spans, returns the bytes reserved; publish them with z_kfifo_in_commit */
+uint32_t z_kfifo_in_prepare(struct z_kfifo_struct *p_fifo, struct z_kfifo_span_struct span[2], uint32_t len);
+
+/* Publish len bytes written into the spans of the last z_kfifo_in_prepare */
+void z_kfifo_in_commit(struct z_kfifo_struct *p_fifo, uint32_t len);
+
+/* Expose up to len stored bytes as two spans without copying, returns the bytes exposed; release them with z_kfifo_out_skip */
+uint32_t z_kfifo_out_peek(struct z_kfifo_struct *p_fifo, struct z_kfifo_span_struct span[2], uint32_t len);
+
+/* Drop up to len bytes from the head of the FIFO, returns the bytes dropped */
+uint32_t z_kfifo_out_skip(struct z_kfifo_struct *p_fifo, uint32_t len);
+
+/* Read up to max bytes from fd straight into the free space with one readv, returns the bytes read, 0 on EOF or when full, -errno on error */
+int z_kfifo_from_fd(struct z_kfifo_struct *p_fifo, int fd, uint32_t max);
+
+/* Write up to max stored bytes to fd straight from the buffer with one writev, returns the bytes written and consumed, -errno on error */
+int z_kfifo_to_fd(struct z_kfifo_struct *p_fifo, int fd, uint32_t max);
+
+/*
+ * Record mode: every record is stored behind a Z_KFIFO_REC_HEAD length
+ * prefix and is always added or removed as a whole, like kfifo_in_rec in
+ * the Linux kernel. Do not mix record and byte calls on the same FIFO.
+ */
+
+/* Add one record of len bytes, returns len, or 0 when it does not fit */
+uint32_t z_kfifo_in_rec(struct z_kfifo_struct *p_fifo, const void *p_from, uint32_t len);
+
+/* Remove the next record, copying at most len bytes of it; returns the bytes copied, the rest of a longer record is dropped.
+ * A header claiming more bytes than are stored is left in place and 0 is returned, like the other record reads */
+uint32_t z_kfifo_out_rec(struct z_kfifo_struct *p_fifo, void *p_to, uint32_t len);
+
+/* Length of the next record, 0 when the FIFO is empty or holds no complete record */
+uint32_t z_kfifo_peek_rec_len(struct z_kfifo_struct *p_fifo);
+
+/* Reserve room for one record of len bytes as two spans, returns len, or 0 when it does not fit */
+uint32_t z_kfifo_in_prepare_rec(struct z_kfifo_struct *p_fifo, struct z_kfifo_span_struct span[2], uint32_t len);
+
+/* Publish a record of len bytes (at most the prepared length) written into the spans of z_kfifo_in_prepare_rec */
+void z_kfifo_in_commit_rec(struct z_kfifo_struct *p_fifo, uint32_t len);
+
+/* Expose the next record as two spans without copying, returns its length, 0 when empty; release it with z_kfifo_out_skip_rec */
+uint32_t z_kfifo_out_peek_rec(struct z_kfifo_struct *p_fifo, struct z_kfifo_span_struct span[2]);
+
+/* Drop the next record, returns its length */
+uint32_t z_kfifo_out_skip_rec(struct z_kfifo_struct *p_fifo);
+
 /* Test functionality of the FIFO; could be used for diagnostics or unit testing */
 uint32_t z_kfifo_test(void);
 
@@ -0,0 +1,44 @@
+#ifndef _Z_LOG_H_
+#define _Z_LOG_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+// Default size of the ring each logging thread writes into
+#define Z_LOG_RING_SIZE (64 * 1024)
+// Longest formatted log line, longer messages are truncated
+#define Z_LOG_LINE_MAX 512
+// Longest time a queued line waits before the writer thread flushes it
+#define Z_LOG_FLUSH_MS 10
+
+// Function to start the asynchronous backend, Z_FATAL..Z_DEBUG lines are then queued and written by a background thread
+// @param fd: File descriptor the writer thread writes to, the caller keeps ownership of it
+// @param ring_size: Bytes of the ring each logging thread gets, 0 for Z_LOG_RING_SIZE, rounded up to a power of two
+// @return: Returns 0 on success, -EBUSY if already started, or a negative error code on failure
+int32_t z_log_start(int32_t fd, uint32_t ring_size);
+
+// Function to stop the asynchronous backend, queued lines are written out first and later ones go straight to stdout again
+// @return: Returns 0 on success, or -EINVAL if the backend is not running
+int32_t z_log_stop(void);
+
+// Function to get the number of lines dropped because the ring of the logging thread was full
+// @return: Returns the drop counter, it is never reset
+uint64_t z_log_drops(void);
+
+// Function behind the Z_FATAL..Z_DEBUG macros of z_debug.h, formats one line and queues it or prints it
+// @param level: Level of the line, a value of enum z_level_enum
+// @param p_file: Source file of the call
+// @param line: Source line of the call
+// @param p_func: Function of the call
+// @param p_format: printf format of the message
+void z_log_write(int32_t level, const char *p_file, int32_t line, const char *p_func, const char *p_format, ...) __attribute__((format(printf, 5, 6)));
+
+// Function to test the logging backend; could be used for diagnostics or unit testing
+int32_t z_log_test(void);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _Z_LOG_H_ */
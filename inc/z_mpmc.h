@@ -0,0 +1,54 @@
+#ifndef _Z_MPMC_H_
+#define _Z_MPMC_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/* Cache line size used to keep the producer and consumer indices apart */
+#define Z_MPMC_CACHE_LINE 64
+
+/*
+ * Structure defining a bounded lock-free multi-producer/multi-consumer ring.
+ * Every slot carries a sequence number telling whether it is ready to be
+ * written (seq == pos) or read (seq == pos + 1), so producers and consumers
+ * only contend on their own index with a single compare-and-swap.
+ */
+struct z_mpmc_struct {
+    uint8_t *p_buffer;   /* Pointer to the slot array */
+    uint32_t size;       /* Number of slots (power of two) */
+    uint32_t elem_size;  /* Payload bytes carried by each slot */
+    uint32_t slot_size;  /* Stride between two slots, sequence number included */
+    uint8_t pad0[Z_MPMC_CACHE_LINE];
+    uint32_t in; /* Next position to enqueue, only touched by producers */
+    uint8_t pad1[Z_MPMC_CACHE_LINE];
+    uint32_t out; /* Next position to dequeue, only touched by consumers */
+    uint8_t pad2[Z_MPMC_CACHE_LINE];
+};
+
+/* Allocate a ring holding at least nums elements of elem_size bytes each */
+int z_mpmc_malloc(struct z_mpmc_struct *p_ring, uint32_t nums, uint32_t elem_size);
+
+/* Free the slot array of the ring */
+void z_mpmc_free(struct z_mpmc_struct *p_ring);
+
+/* Add up to nums elements from p_from, returns the number of elements added */
+uint32_t z_mpmc_in(struct z_mpmc_struct *p_ring, const void *p_from, uint32_t nums);
+
+/* Extract up to nums elements into p_to, returns the number of elements extracted */
+uint32_t z_mpmc_out(struct z_mpmc_struct *p_ring, void *p_to, uint32_t nums);
+
+/* Approximate number of elements currently stored (exact when the ring is quiescent) */
+uint32_t z_mpmc_data_len(struct z_mpmc_struct *p_ring);
+
+/* Approximate number of free slots (exact when the ring is quiescent) */
+uint32_t z_mpmc_space(struct z_mpmc_struct *p_ring);
+
+/* Test functionality of the ring; could be used for diagnostics or unit testing */
+uint32_t z_mpmc_test(void);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _Z_MPMC_H_ */
@@ -0,0 +1,57 @@
+#ifndef _Z_THGRAPH_H_
+#define _Z_THGRAPH_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+// Handle type for a task graph instance
+typedef struct z_thgraph_struct* z_thgraph_handle_t;
+
+// Function to create an empty task graph
+// @param p_graph: Pointer to store the created graph handle
+// @return: Returns 0 on success, or a negative error code on failure
+int32_t z_thgraph_create(z_thgraph_handle_t *p_graph);
+
+// Function to destroy a task graph, a launched graph must have been waited for
+// @param graph: Handle to the graph
+// @return: Returns 0 on success, -EBUSY if the graph is still running
+int32_t z_thgraph_destroy(z_thgraph_handle_t graph);
+
+// Function to add a node to the graph
+// @param graph: Handle to the graph
+// @param cb: The callback function run when every dependency of the node has finished
+// @param arg: The argument to pass to the callback
+// @param p_id: Pointer to store the node id used by z_thgraph_edge_add
+// @return: Returns 0 on success, -EBUSY if the graph is running, or a negative error code on failure
+int32_t z_thgraph_node_add(z_thgraph_handle_t graph, void (*cb)(void *), void *arg, uint32_t *p_id);
+
+// Function to make node `to` depend on node `from`
+// @param graph: Handle to the graph
+// @param from: Node that has to finish first
+// @param to: Node that waits for `from`
+// @return: Returns 0 on success, -EBUSY if the graph is running, or a negative error code on failure
+int32_t z_thgraph_edge_add(z_thgraph_handle_t graph, uint32_t from, uint32_t to);
+
+// Function to run the whole graph on a thread pool, nodes without dependencies are queued first.
+// A node made ready by a finishing predecessor runs on that same worker; further ready nodes are
+// queued on the pool, or run by the same worker as well when the queue is full or stopped.
+// @param graph: Handle to the graph
+// @param pool: Handle to the thread pool running the nodes
+// @return: Returns 0 on success, -EBUSY if already running, -ELOOP if the edges form a cycle
+int32_t z_thgraph_launch(z_thgraph_handle_t graph, z_thpool_handle_t pool);
+
+// Function to wait until every node of a launched graph has run, the graph can then be launched again
+// @param graph: Handle to the graph
+// @param timeout_ns: Maximum time to wait in nanoseconds, Z_THPOOL_WAIT_FOREVER to wait without limit
+// @return: Returns 0 on success, -ETIMEDOUT on timeout, -EINVAL if the graph was not launched
+int32_t z_thgraph_wait(z_thgraph_handle_t graph, uint64_t timeout_ns);
+
+// Function to test the task graph; could be used for diagnostics or unit testing
+int32_t z_thgraph_test(void);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _Z_THGRAPH_H_ */
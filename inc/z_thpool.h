@@ -8,12 +8,124 @@ extern "C" {
 // Handle type for thread pool instance
 typedef struct z_thpool_mng_struct* z_thpool_handle_t;
 
+// Handle type for a task submitted with z_thpool_submit
+typedef struct z_thpool_task_struct* z_thpool_task_t;
+
+// Timeout value meaning "wait without limit"
+#define Z_THPOOL_WAIT_FOREVER UINT64_MAX
+
+// Wait group counting the outstanding tasks of one caller
+struct z_thpool_wg_struct {
+    uint32_t count;        // Number of outstanding tasks
+    pthread_mutex_t mutex; // Mutex protecting the final decrement
+    pthread_cond_t cond;   // Condition signalled when count drops to zero
+};
+
+// Queue backends available for the pool
+enum z_thpool_queue_enum {
+    E_Z_THPOOL_QUEUE_KFIFO = 0, // Mutex guarded kfifo (default)
+    E_Z_THPOOL_QUEUE_MPMC,      // Lock-free bounded multi-producer/multi-consumer ring
+};
+
+// Largest argument z_thpool_add_work_copy can carry inside a queue slot
+#define Z_THPOOL_INLINE_MAX 256
+
+// Maximum number of priority lanes
+#define Z_THPOOL_PRIO_MAX 8
+// Maximum weight of a lane under weighted round-robin
+#define Z_THPOOL_PRIO_WEIGHT_MAX 64
+
+// Dequeue policies across priority lanes
+enum z_thpool_prio_enum {
+    E_Z_THPOOL_PRIO_STRICT = 0, // Always serve the highest priority non-empty lane (default)
+    E_Z_THPOOL_PRIO_WRR,        // Weighted round-robin over the lanes, using prio_weight
+};
+
+// Shutdown modes of z_thpool_destroy_ex
+enum z_thpool_destroy_enum {
+    E_Z_THPOOL_DESTROY_DRAIN = 0, // Refuse new work and run every queued task before the workers stop
+    E_Z_THPOOL_DESTROY_DISCARD,   // Refuse new work, stop after the running callbacks and hand queued tasks to the discard callback
+};
+
+// Worker placement policies
+enum z_thpool_cpu_enum {
+    E_Z_THPOOL_CPU_NONE = 0, // Workers float over every CPU (default)
+    E_Z_THPOOL_CPU_LIST,     // Workers may run on any CPU of cpu_list
+    E_Z_THPOOL_CPU_CORE,     // Each worker is pinned to one physical core of cpu_list, round-robin
+};
+
+// Worker stack options, combined in stack_flags
+enum z_thpool_stack_enum {
+    E_Z_THPOOL_STACK_ARENA = 1 << 0,    // Carve every worker stack out of one mapping reserved at creation, each below a guard page
+    E_Z_THPOOL_STACK_PREFAULT = 1 << 1, // Touch every arena page at creation so workers start without page faults
+    E_Z_THPOOL_STACK_HUGE = 1 << 2,     // Round stacks to 2MB and ask for transparent huge pages, guards become 2MB holes
+};
+
 // Data structure for configuring the thread pool
 struct z_thpool_config_struct {
     uint32_t max_thread_nums;   // Maximum number of threads in the pool
     uint32_t msg_node_max;      // Maximum number of message nodes in the pool
     uint32_t thread_stack_size; // Stack size for each thread
     char pool_name[32];        // Name of the thread pool
+    uint32_t queue_type;        // Queue backend, see enum z_thpool_queue_enum
+    uint32_t worker_batch_max;  // Maximum messages a worker takes per dequeue, 0 means 1
+    uint32_t min_thread_nums;   // Threads kept alive when idle, only used when idle_timeout_ms is set
+    uint32_t idle_timeout_ms;   // Keep-alive of idle threads above min_thread_nums, 0 starts all threads up front
+    uint32_t prio_nums;         // Number of priority lanes (at most Z_THPOOL_PRIO_MAX), 0 means 1, lane 0 is the highest
+    uint32_t prio_policy;       // Dequeue policy across lanes, see enum z_thpool_prio_enum
+    uint32_t prio_weight[Z_THPOOL_PRIO_MAX]; // Weighted round-robin weight per lane, 0 picks prio_nums - lane
+    uint32_t cpu_policy;        // Worker placement, see enum z_thpool_cpu_enum
+    char cpu_list[64];          // CPUs for placement such as "0-3,8", empty means the CPUs the process may use
+    uint32_t idle_spin_us;      // Time an idle worker busy-polls the queue before yielding, 0 skips spinning
+    uint32_t idle_yield_nums;   // sched_yield rounds after spinning before the worker parks on a futex
+    uint32_t numa_flag;         // Non-zero: one queue of msg_node_max per NUMA node, workers grouped per node, submissions go to the local node
+    uint32_t msg_inline_max;    // Argument bytes each queue slot can carry for z_thpool_add_work_copy (at most Z_THPOOL_INLINE_MAX), 0 disables it
+    uint32_t latency_flag;      // Non-zero: timestamp every message and record queue wait and run time histograms per worker
+    uint32_t trace_nums;        // Events kept per worker and per producer shard for z_thpool_trace_dump, rounded up to a power of two, 0 disables tracing
+    uint32_t stack_flags;       // Bitmask of enum z_thpool_stack_enum, 0 lets pthread map each stack on its own, PREFAULT and HUGE need ARENA
+};
+
+// Percentiles of one latency histogram, in nanoseconds
+struct z_thpool_latency_struct {
+    uint64_t count; // Number of samples
+    uint64_t mean;  // Average sample
+    uint64_t sum;   // Sum of the samples
+    uint64_t p50;   // Median
+    uint64_t p90;   // 90th percentile
+    uint64_t p99;   // 99th percentile
+    uint64_t p999;  // 99.9th percentile
+    uint64_t max;   // Largest sample
+};
+
+// Snapshot of the pool counters, every counter only grows except the thread and queue gauges
+struct z_thpool_stats_struct {
+    char pool_name[32];                         // Name of the thread pool
+    uint32_t queue_type;                        // Queue backend, see enum z_thpool_queue_enum
+    uint32_t max_thread_nums;                   // Maximum number of threads
+    uint32_t run_thread_nums;                   // Threads alive
+    uint32_t busy_thread_nums;                  // Threads running callbacks
+    uint32_t spawn_nums;                        // Threads started over the pool lifetime
+    uint32_t retire_nums;                       // Threads retired after the keep-alive expired
+    uint32_t queue_depth;                       // Messages waiting in all lanes
+    uint32_t queue_capacity;                    // Messages all lanes can hold
+    uint32_t prio_nums;                         // Priority lanes, number of entries used in the lane arrays
+    uint32_t lane_depth[Z_THPOOL_PRIO_MAX];     // Messages waiting per priority, summed over the NUMA nodes
+    uint64_t lane_deq_nums[Z_THPOOL_PRIO_MAX];  // Messages dequeued per priority
+    uint64_t submitted;                         // Tasks accepted into the queue
+    uint64_t executed;                          // Callbacks that have returned, never above submitted
+    uint64_t rejected_full;                     // Tasks refused because the queue stayed full
+    uint64_t pub_bytes;                         // Bytes queued
+    uint64_t sub_bytes;                         // Bytes dequeued
+    uint64_t busy_ns;                           // Worker time spent running callbacks
+    uint64_t idle_ns;                           // Worker time spent waiting for work between two batches
+    uint64_t park_nums;                         // Times a worker went to sleep on the futex
+    uint64_t wake_nums;                         // Futex wakes issued by producers
+    uint64_t wake_skip_nums;                    // Wakes skipped because no worker slept
+    uint64_t spin_hit_nums;                     // Times spinning found work before yielding
+    uint64_t yield_hit_nums;                    // Times yielding found work before parking
+    uint32_t latency_flag;                      // Whether wait and run are filled
+    struct z_thpool_latency_struct wait;        // Time from enqueue until the callback starts
+    struct z_thpool_latency_struct run;         // Time the callback runs
 };
 
 // Function to create a new thread pool instance
@@ -22,18 +134,172 @@ struct z_thpool_config_struct {
 // @return: Returns 0 on success, or a negative error code on failure
 int32_t z_thpool_create(struct z_thpool_config_struct *p_config, z_thpool_handle_t *p_handle);
 
-// Function to destroy a thread pool instance
+// Function to destroy a thread pool instance, queued tasks are discarded and running callbacks are waited for
 // @param handle: Handle to the thread pool to destroy
 // @return: Returns 0 on success, or a negative error code on failure
 int32_t z_thpool_destroy(z_thpool_handle_t handle);
 
-// Function to add a work task to the thread pool
+// Function to destroy a thread pool instance, the workers are joined so it returns as soon as the last one exits
+// @param handle: Handle to the thread pool to destroy
+// @param mode: Shutdown mode, see enum z_thpool_destroy_enum
+// @param timeout_ns: Longest time to drain the queue in nanoseconds, Z_THPOOL_WAIT_FOREVER to wait without limit, unused by DISCARD
+// @param discard: Called once per queued task that did not run, so its argument can be freed, may be NULL.
+//                 Inline payloads of z_thpool_add_work_copy are passed in place and stay valid during the call only.
+//                 Wait groups of discarded tasks are notified, queued parallel_for helpers are dropped without running.
+//                 Queued z_thpool_submit tasks complete as cancelled instead: waiters and z_thpool_task_then callbacks see a NULL result.
+//                 Every task handle must be released with z_thpool_task_release, destroy waits until the last one is.
+// @param p_ctx: Context handed to discard
+// @return: Returns 0 on success, -ETIMEDOUT if the drain timed out and the rest was discarded, or a negative error code on failure
+int32_t z_thpool_destroy_ex(z_thpool_handle_t handle, uint32_t mode, uint64_t timeout_ns, void (*discard)(void (*cb)(void *), void *p_arg, void *p_ctx), void *p_ctx);
+
+// Function to add a work task to the thread pool without blocking, tasks go to the lowest priority lane
 // @param handle: Handle to the thread pool
 // @param cb: The callback function that defines the task
 // @param arg: The argument to pass to the task
-// @return: Returns 0 on success, or a negative error code on failure
+// @return: Returns 0 on success, -EAGAIN if the queue is full, -ESHUTDOWN if the pool is stopped
 int32_t z_thpool_add_work(z_thpool_handle_t handle, void (*cb)(void *), void *arg);
 
+// Function to add a work task to a priority lane without blocking
+// @param handle: Handle to the thread pool
+// @param prio: Priority lane, 0 is the highest and prio_nums - 1 the lowest
+// @param cb: The callback function that defines the task
+// @param arg: The argument to pass to the task
+// @return: Returns 0 on success, -EAGAIN if the lane is full, -ESHUTDOWN if the pool is stopped
+int32_t z_thpool_add_work_prio(z_thpool_handle_t handle, uint32_t prio, void (*cb)(void *), void *arg);
+
+// Function to add a work task to the thread pool, waiting while the queue is full
+// @param handle: Handle to the thread pool
+// @param cb: The callback function that defines the task
+// @param arg: The argument to pass to the task
+// @return: Returns 0 on success, -ESHUTDOWN if the pool is stopped
+int32_t z_thpool_add_work_wait(z_thpool_handle_t handle, void (*cb)(void *), void *arg);
+
+// Function to add a work task to the thread pool, waiting at most timeout_ns while the queue is full
+// @param handle: Handle to the thread pool
+// @param cb: The callback function that defines the task
+// @param arg: The argument to pass to the task
+// @param timeout_ns: Maximum time to wait for a free slot, in nanoseconds
+// @return: Returns 0 on success, -ETIMEDOUT on timeout, -ESHUTDOWN if the pool is stopped
+int32_t z_thpool_add_work_timed(z_thpool_handle_t handle, void (*cb)(void *), void *arg, uint64_t timeout_ns);
+
+// Function to add several work tasks to the thread pool at once
+// @param handle: Handle to the thread pool
+// @param cb: Array of callback functions
+// @param arg: Array of arguments, arg[i] is passed to cb[i]
+// @param nums: Number of entries in both arrays
+// @return: Returns the number of tasks accepted, fewer than nums only when the lanes of every node are full, or a negative error code on failure
+int32_t z_thpool_add_work_batch(z_thpool_handle_t handle, void (*cb[])(void *), void *arg[], uint32_t nums);
+
+// Function to add a work task whose completion is reported to a wait group
+// @param handle: Handle to the thread pool
+// @param p_wg: Wait group, incremented now and decremented once the task has run
+// @param cb: The callback function that defines the task
+// @param arg: The argument to pass to the task
+// @return: Returns 0 on success, -EAGAIN if the queue is full, -ESHUTDOWN if the pool is stopped
+int32_t z_thpool_add_work_wg(z_thpool_handle_t handle, struct z_thpool_wg_struct *p_wg, void (*cb)(void *), void *arg);
+
+// Function to add a work task whose argument is copied into the queue, so small tasks need no allocation
+// @param handle: Handle to the thread pool
+// @param cb: The callback function, it receives a pointer to the copy held in the worker's dequeue buffer
+// @param data: The argument bytes to copy
+// @param len: Number of bytes, at most msg_inline_max of the pool configuration
+// @return: Returns 0 on success, -EMSGSIZE if len exceeds msg_inline_max, -EAGAIN if the queue is full, -ESHUTDOWN if the pool is stopped
+int32_t z_thpool_add_work_copy(z_thpool_handle_t handle, void (*cb)(void *), const void *data, uint32_t len);
+
+// Function to wait until the queue is drained and no task is running
+// @param handle: Handle to the thread pool
+// @param timeout_ns: Maximum time to wait in nanoseconds, or Z_THPOOL_WAIT_FOREVER
+// @return: Returns 0 once idle, -ETIMEDOUT on timeout, -ESHUTDOWN if the pool is being destroyed
+int32_t z_thpool_wait_idle(z_thpool_handle_t handle, uint64_t timeout_ns);
+
+// Wait group functions, a wait group lets a caller wait for its own subset of tasks
+// @return: Returns 0 on success, or a negative error code on failure (-ETIMEDOUT for z_thpool_wg_wait)
+int32_t z_thpool_wg_init(struct z_thpool_wg_struct *p_wg);
+int32_t z_thpool_wg_destroy(struct z_thpool_wg_struct *p_wg);
+int32_t z_thpool_wg_add(struct z_thpool_wg_struct *p_wg, uint32_t nums);
+int32_t z_thpool_wg_done(struct z_thpool_wg_struct *p_wg);
+int32_t z_thpool_wg_wait(struct z_thpool_wg_struct *p_wg, uint64_t timeout_ns);
+
+// Function to submit a task whose return value is collected through a task handle
+// @param handle: Handle to the thread pool
+// @param cb: The task function, its return value is stored in the handle
+// @param arg: The argument to pass to the task, may be NULL
+// @param p_task: Pointer to store the task handle, release it with z_thpool_task_release
+// @return: Returns 0 on success, -ENOMEM if no handle is free, -EAGAIN if the queue is full, -ESHUTDOWN if stopped
+int32_t z_thpool_submit(z_thpool_handle_t handle, void *(*cb)(void *), void *arg, z_thpool_task_t *p_task);
+
+// Task handle functions
+// z_thpool_task_poll: returns 0 and the result once the task is done, -EAGAIN while pending, -ECANCELED if destroy discarded it
+// z_thpool_task_wait: waits for completion, returns 0 and the result, -ETIMEDOUT, or -ECANCELED if destroy discarded it
+// z_thpool_task_then: attaches a completion callback, run at once if the task is already done, -EBUSY if one is attached
+// z_thpool_task_release: gives the handle back to the pool, allowed before completion, required before destroy can return
+int32_t z_thpool_task_poll(z_thpool_task_t task, void **p_ret);
+int32_t z_thpool_task_wait(z_thpool_task_t task, uint64_t timeout_ns, void **p_ret);
+int32_t z_thpool_task_then(z_thpool_task_t task, void (*then)(void *p_ret, void *p_ctx), void *p_ctx);
+int32_t z_thpool_task_release(z_thpool_task_t task);
+
+// Function to run body over [begin, end) split into chunks across the pool's workers, the calling thread takes part
+// @param handle: Handle to the thread pool
+// @param begin: First index of the range
+// @param end: End of the range, exclusive
+// @param grain: Smallest chunk passed to body, 0 picks one from the range and the pool size
+// @param body: Function called with disjoint sub-ranges covering [begin, end)
+// @param ctx: Context passed to body
+// @return: Returns 0 once every index has been processed, or a negative error code on failure
+int32_t z_thpool_parallel_for(z_thpool_handle_t handle, uint64_t begin, uint64_t end, uint64_t grain,
+                              void (*body)(uint64_t begin, uint64_t end, void *ctx), void *ctx);
+
+// Function to reduce [begin, end) in parallel, every participant folds its chunks into a private accumulator
+// @param handle: Handle to the thread pool
+// @param begin: First index of the range
+// @param end: End of the range, exclusive
+// @param grain: Smallest chunk passed to body, 0 picks one from the range and the pool size
+// @param body: Function folding the sub-range [begin, end) into acc
+// @param join: Function folding other into acc, called by the caller once all chunks are done
+// @param result: In: identity value of the reduction, out: the result
+// @param result_size: Size of the value behind result
+// @param ctx: Context passed to body and join
+// @return: Returns 0 on success, or a negative error code on failure
+int32_t z_thpool_parallel_reduce(z_thpool_handle_t handle, uint64_t begin, uint64_t end, uint64_t grain,
+                                 void (*body)(uint64_t begin, uint64_t end, void *acc, void *ctx),
+                                 void (*join)(void *acc, const void *other, void *ctx), void *result, uint32_t result_size, void *ctx);
+
+// Function to read the latency percentiles merged over all workers, the pool must be created with latency_flag set
+// @param handle: Handle to the thread pool
+// @param p_wait: Time from enqueue until the callback starts, may be NULL
+// @param p_run: Time the callback runs, may be NULL
+// @return: Returns 0 on success, -ENOTSUP if latency_flag is off, or a negative error code on failure
+int32_t z_thpool_latency_get(z_thpool_handle_t handle, struct z_thpool_latency_struct *p_wait, struct z_thpool_latency_struct *p_run);
+
+// Function to take a snapshot of the pool counters without the pool mutex, workers and producers are never blocked
+// @param handle: Handle to the thread pool
+// @param p_stats: Pointer to the snapshot to fill
+// @return: Returns 0 on success, or a negative error code on failure
+int32_t z_thpool_get_stats(z_thpool_handle_t handle, struct z_thpool_stats_struct *p_stats);
+
+// Function to format a snapshot as one JSON object
+// @param p_stats: Snapshot taken with z_thpool_get_stats
+// @param p_buf: Output buffer, always NUL terminated
+// @param size: Size of the output buffer
+// @return: Returns the length of the text, -ENOSPC if it does not fit, or a negative error code on failure
+int32_t z_thpool_stats_to_json(const struct z_thpool_stats_struct *p_stats, char *p_buf, uint32_t size);
+
+// Function to format snapshots in the Prometheus text exposition format, each metric family lists every pool labelled by name
+// @param p_stats: Array of snapshots taken with z_thpool_get_stats, one per pool
+// @param nums: Number of snapshots
+// @param p_buf: Output buffer, always NUL terminated
+// @param size: Size of the output buffer
+// @return: Returns the length of the text, -ENOSPC if it does not fit, or a negative error code on failure
+int32_t z_thpool_stats_to_prom(const struct z_thpool_stats_struct *p_stats, uint32_t nums, char *p_buf, uint32_t size);
+
+// Function to write the trace rings as Chrome trace-event JSON, loadable in chrome://tracing or Perfetto
+// Each worker and producer shard is shown as a thread: enqueues, dequeues, callback slices with flows from their enqueue, and parked time.
+// Rings keep the latest trace_nums events, events recorded while the dump runs may be missing or stale.
+// @param handle: Handle to the thread pool, created with trace_nums set
+// @param fd: File descriptor to write to, the caller keeps ownership of it
+// @return: Returns 0 on success, -ENOTSUP if tracing is off, or a negative error code on failure
+int32_t z_thpool_trace_dump(z_thpool_handle_t handle, int32_t fd);
+
 // Function to get thread pool status
 // @param handle: Handle to the thread pool
 // @return: Returns 0 on success, or a negative error code on failure
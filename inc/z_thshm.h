@@ -0,0 +1,79 @@
+#ifndef _Z_THSHM_H_
+#define _Z_THSHM_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+// Handle type for one end of a shared-memory submission channel
+typedef struct z_thshm_struct* z_thshm_handle_t;
+
+// Number of entries in the dispatch table of a channel
+#define Z_THSHM_DISPATCH_MAX 64
+
+// Function to create a channel in a new memfd segment, the creating process serves it into a pool
+// @param slot_nums: Number of messages the ring holds, rounded up to a power of two
+// @param data_max: Largest payload a message can carry, the serving pool needs msg_inline_max >= data_max
+// @param p_chan: Pointer to store the created channel handle
+// @return: Returns 0 on success, or a negative error code on failure
+int32_t z_thshm_create(uint32_t slot_nums, uint32_t data_max, z_thshm_handle_t *p_chan);
+
+// Function to get the memfd of a channel, hand it to helper processes by fork or SCM_RIGHTS
+// @param chan: Handle to the channel
+// @return: Returns the file descriptor, or -EINVAL
+int32_t z_thshm_fd(z_thshm_handle_t chan);
+
+// Function to attach to a channel from a helper process
+// @param fd: File descriptor of the channel segment, the caller keeps ownership of it
+// @param p_chan: Pointer to store the attached channel handle
+// @return: Returns 0 on success, -EINVAL if fd is not a channel segment, or a negative error code on failure
+int32_t z_thshm_attach(int32_t fd, z_thshm_handle_t *p_chan);
+
+// Function to bind a message id to a callback, ids replace function pointers across processes
+// @param chan: Handle to the channel created by this process
+// @param id: Message id, below Z_THSHM_DISPATCH_MAX
+// @param cb: The callback run on the pool, it receives a pointer to a copy of the payload
+// @return: Returns 0 on success, or -EINVAL
+int32_t z_thshm_register(z_thshm_handle_t chan, uint32_t id, void (*cb)(void *));
+
+// Function to start the consumer thread turning channel messages into pool work
+// @param chan: Handle to the channel created by this process
+// @param pool: Handle to the thread pool running the callbacks
+// @return: Returns 0 on success, -EBUSY if already serving, or a negative error code on failure
+int32_t z_thshm_serve(z_thshm_handle_t chan, z_thpool_handle_t pool);
+
+// Function to send one message without blocking, no system call is made while the consumer is awake
+// @param chan: Handle to the channel
+// @param id: Message id registered by the serving process
+// @param data: Payload bytes
+// @param len: Payload length, 1 to data_max
+// @return: Returns 0 on success, -EAGAIN if the ring is full, -EMSGSIZE if len exceeds data_max, -ESHUTDOWN if the channel is closed
+int32_t z_thshm_send(z_thshm_handle_t chan, uint32_t id, const void *data, uint32_t len);
+
+// Function to send one message, blocking at most timeout_ns while the ring is full
+// @param chan: Handle to the channel
+// @param id: Message id registered by the serving process
+// @param data: Payload bytes
+// @param len: Payload length, 1 to data_max
+// @param timeout_ns: Maximum time to wait in nanoseconds, Z_THPOOL_WAIT_FOREVER to wait without limit
+// @return: Returns 0 on success, -ETIMEDOUT on timeout, or the errors of z_thshm_send
+int32_t z_thshm_send_wait(z_thshm_handle_t chan, uint32_t id, const void *data, uint32_t len, uint64_t timeout_ns);
+
+// Function to close a channel, the creator stops its consumer thread after draining accepted messages
+// @param chan: Handle to the channel
+// @return: Returns 0 on success, or a negative error code on failure
+int32_t z_thshm_destroy(z_thshm_handle_t chan);
+
+// Function to print the channel statistics
+// @param chan: Handle to the channel
+// @return: Returns 0 on success, or a negative error code on failure
+int32_t z_thshm_show(z_thshm_handle_t chan);
+
+// Function to test the channel; could be used for diagnostics or unit testing
+int32_t z_thshm_test(void);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* _Z_THSHM_H_ */
@@ -9,6 +9,7 @@ static const char *gs_help =
     "\r\n"
     "Enter a command (type 'exit' to quit):\r\n\r\n"
     "create pool1 5 100 64  #Create pool named 'pool1' with 5 threads, 100 cache queues, 64k stack size\r\n"
+    "create pool1 5 100 64 1 #Same as above, using the lock-free queue backend\r\n"
     "destroy pool1          #Destroy pool named 'pool1'\r\n"
     "add pool1 10           #Add 10 tasks to pool named 'pool1'\r\n"
     "show pool1             #Show state of pool named 'pool1'\r\n"
@@ -54,7 +55,7 @@ int main(int argc, char *argv[]) {
     char input[256];
     char command[32];
     char pool_name[32];
-    int a, b, c;
+    int a, b, c, d;
 
     printf("Enter a command (type 'exit' to quit):\n");
 
@@ -79,7 +80,8 @@ int main(int argc, char *argv[]) {
         }
 
         // Parse commands with pool name
-        if (sscanf(input, "%s %s %d %d %d", command, pool_name, &a, &b, &c) >= 2) {
+        d = 0;
+        if (sscanf(input, "%s %s %d %d %d %d", command, pool_name, &a, &b, &c, &d) >= 2) {
             if (strcmp(command, "create") == 0) {
                 struct pool_entry *entry = find_empty_slot();
                 if (!entry) {
@@ -87,10 +89,11 @@ int main(int argc, char *argv[]) {
                     continue;
                 }
 
-                struct z_thpool_config_struct config;
+                struct z_thpool_config_struct config = {0};
                 config.max_thread_nums = a;
                 config.msg_node_max = b;
                 config.thread_stack_size = c * 1024;
+                config.queue_type = d;
                 strncpy(config.pool_name, pool_name, sizeof(config.pool_name) - 1);
                 config.pool_name[sizeof(config.pool_name) - 1] = '\0';
 
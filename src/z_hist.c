@@ -0,0 +1,152 @@
+#include "z_tool.h"
+#include "z_debug.h"
+#include "z_hist.h"
+
+#include <inttypes.h>
+
+// Exact buckets below this value, then Z_HIST_HALF sub-buckets per power of two.
+#define Z_HIST_SUB (1u << Z_HIST_SUB_BITS)
+#define Z_HIST_HALF (Z_HIST_SUB >> 1)
+
+// Adds to a counter owned by a single writer, a plain load and store keep the locked instruction off the hot path.
+#define Z_HIST_ADD(p, n) __atomic_store_n((p), __atomic_load_n((p), __ATOMIC_RELAXED) + (n), __ATOMIC_RELAXED)
+
+// Returns the bucket counting the given value.
+static inline uint32_t __z_hist_index(uint64_t value) {
+    if (value < Z_HIST_SUB) return (uint32_t)value;
+
+    uint32_t msb = 63 - __builtin_clzll(value);
+    if (msb >= Z_HIST_MAX_BITS) return Z_HIST_BUCKETS - 1;
+
+    // Keep the top SUB_BITS - 1 bits below the leading one, they select the sub-bucket.
+    uint32_t shift = msb - (Z_HIST_SUB_BITS - 1);
+    return Z_HIST_SUB + (shift - 1) * Z_HIST_HALF + (uint32_t)(value >> shift) - Z_HIST_HALF;
+}
+
+// Returns the highest value counted by the given bucket.
+static inline uint64_t __z_hist_high(uint32_t index) {
+    if (index < Z_HIST_SUB) return index;
+
+    uint32_t shift = (index - Z_HIST_SUB) / Z_HIST_HALF + 1;
+    uint64_t sub = (index - Z_HIST_SUB) % Z_HIST_HALF + Z_HIST_HALF;
+    return ((sub + 1) << shift) - 1;
+}
+
+// Clears every bucket of the histogram.
+void z_hist_reset(struct z_hist_struct *p_hist) {
+    if (!p_hist) return;
+    memset(p_hist, 0, sizeof(*p_hist));
+}
+
+// Records one value, only the owning thread writes so relaxed stores are enough for concurrent readers.
+void z_hist_record(struct z_hist_struct *p_hist, uint64_t value) {
+    Z_HIST_ADD(&p_hist->counts[__z_hist_index(value)], 1);
+    Z_HIST_ADD(&p_hist->total, 1);
+    Z_HIST_ADD(&p_hist->sum, value);
+    if (value > __atomic_load_n(&p_hist->max, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&p_hist->max, value, __ATOMIC_RELAXED);
+    }
+}
+
+// Adds the samples of p_from into p_to, p_to must not be shared.
+void z_hist_merge(struct z_hist_struct *p_to, const struct z_hist_struct *p_from) {
+    if (!p_to || !p_from) return;
+
+    for (uint32_t i = 0; i < Z_HIST_BUCKETS; i++) {
+        p_to->counts[i] += __atomic_load_n(&p_from->counts[i], __ATOMIC_RELAXED);
+    }
+    p_to->total += __atomic_load_n(&p_from->total, __ATOMIC_RELAXED);
+    p_to->sum += __atomic_load_n(&p_from->sum, __ATOMIC_RELAXED);
+    p_to->max = Z_TOOL_MAX(p_to->max, __atomic_load_n(&p_from->max, __ATOMIC_RELAXED));
+}
+
+// Returns the value below which pct percent of the samples fall.
+uint64_t z_hist_percentile(const struct z_hist_struct *p_hist, double pct) {
+    if (!p_hist) return 0;
+    uint64_t total = 0;
+    uint64_t seen = 0;
+
+    // Count from the buckets rather than trusting total, they may be read while a writer is recording.
+    for (uint32_t i = 0; i < Z_HIST_BUCKETS; i++) {
+        total += __atomic_load_n(&p_hist->counts[i], __ATOMIC_RELAXED);
+    }
+    if (total == 0) return 0;
+
+    pct = Z_TOOL_MIN(Z_TOOL_MAX(pct, 0.0), 100.0);
+    uint64_t rank = (uint64_t)(pct / 100.0 * total + 0.999999);
+    rank = Z_TOOL_MAX(rank, 1);
+
+    uint64_t max = __atomic_load_n(&p_hist->max, __ATOMIC_RELAXED);
+    for (uint32_t i = 0; i < Z_HIST_BUCKETS; i++) {
+        seen += __atomic_load_n(&p_hist->counts[i], __ATOMIC_RELAXED);
+        if (seen >= rank) {
+            // The top bucket is open ended, max bounds every reading.
+            return i == Z_HIST_BUCKETS - 1 ? max : Z_TOOL_MIN(__z_hist_high(i), max);
+        }
+    }
+    return max;
+}
+
+// Tests various functionalities of the histogram.
+uint32_t z_hist_test(void) {
+    struct z_hist_struct *p_hist = (struct z_hist_struct *)calloc(1, sizeof(struct z_hist_struct));
+    if (!p_hist) {
+        Z_RAW("Memory allocation failed\n");
+        return -1;
+    }
+
+    // Every bucket must map back onto itself and buckets must tile the value range without gaps.
+    for (uint32_t i = 0; i + 1 < Z_HIST_BUCKETS; i++) {
+        uint64_t high = __z_hist_high(i);
+        if (__z_hist_index(high) != i || __z_hist_index(high + 1) != i + 1) {
+            Z_RAW("Bucket %u does not tile the range\n", i);
+            free(p_hist);
+            return -1;
+        }
+    }
+
+    // Values 1..100000 give known percentiles, readings may only be off by the bucket width.
+    for (uint64_t v = 1; v <= 100000; v++) {
+        z_hist_record(p_hist, v);
+    }
+    const double pcts[] = {50.0, 90.0, 99.0, 99.9, 100.0};
+    for (uint32_t i = 0; i < sizeof(pcts) / sizeof(pcts[0]); i++) {
+        uint64_t expect = (uint64_t)(pcts[i] * 1000);
+        uint64_t got = z_hist_percentile(p_hist, pcts[i]);
+        if (got < expect || got > expect + expect / Z_HIST_HALF) {
+            Z_RAW("p%.1f read %" PRIu64 ", expected %" PRIu64 "\n", pcts[i], got, expect);
+            free(p_hist);
+            return -1;
+        }
+    }
+
+    // Merging doubles the counts without moving the percentiles, huge values land in the last bucket.
+    struct z_hist_struct *p_sum = (struct z_hist_struct *)calloc(1, sizeof(struct z_hist_struct));
+    if (!p_sum) {
+        free(p_hist);
+        return -1;
+    }
+    z_hist_merge(p_sum, p_hist);
+    z_hist_merge(p_sum, p_hist);
+    z_hist_record(p_hist, UINT64_MAX);
+    if (p_sum->total != 200000 || z_hist_percentile(p_sum, 50.0) != z_hist_percentile(p_hist, 50.0) ||
+        p_hist->counts[Z_HIST_BUCKETS - 1] != 1 || z_hist_percentile(p_hist, 100.0) != UINT64_MAX) {
+        Z_RAW("Merge test failed\n");
+        free(p_sum);
+        free(p_hist);
+        return -1;
+    }
+
+    z_hist_reset(p_hist);
+    if (p_hist->total != 0 || z_hist_percentile(p_hist, 99.0) != 0) {
+        Z_RAW("Reset test failed\n");
+        free(p_sum);
+        free(p_hist);
+        return -1;
+    }
+
+    free(p_sum);
+    free(p_hist);
+    Z_RAW("All tests passed successfully\n");
+    return 0;
+}
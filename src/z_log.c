@@ -0,0 +1,490 @@
+#include "z_tool.h"
+#include "z_kfifo.h"
+#include "z_debug.h"
+#include "z_log.h"
+
+#include <inttypes.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#define Z_LOG_IOV_MAX 64 // iovecs handed to one writev, two per ring at most
+
+// Ring of one logging thread, the thread writes whole lines and the writer thread drains them
+struct z_log_ring_struct {
+    struct z_kfifo_struct fifo;        // Formatted lines, in is only written by the owner and out by the drainer
+    uint32_t dead;                     // Owner exited, the ring is freed once drained
+    struct z_log_ring_struct *p_next;  // Next ring of the list
+};
+
+// Structure holding the state of the logging backend
+struct z_log_struct {
+    pthread_mutex_t mutex;             // Guards the ring list and makes the holder the only drainer
+    struct z_log_ring_struct *p_rings; // Rings of every thread that logged while the backend ran
+    pthread_key_t key;                 // Frees the ring of an exiting thread
+    pthread_t tid;                     // Writer thread
+    int32_t fd;                        // Destination of the writer thread
+    uint32_t ring_size;                // Size of new rings
+    uint32_t start_flag;               // Whether the writer thread exists
+    uint32_t run_flag;                 // Lines are queued while set, printed straight away otherwise
+    uint32_t stop_flag;                // Asks the writer thread to drain and exit
+    uint32_t sleeping;                 // Writer parked on wake_seq, the producer clearing it issues the wake
+    uint32_t wake_seq;                 // Futex word the writer sleeps on
+    uint64_t drop_nums;                // Lines refused by a full ring
+};
+
+static struct z_log_struct gs_log = {.mutex = PTHREAD_MUTEX_INITIALIZER, .fd = -1};
+static pthread_once_t gs_log_once = PTHREAD_ONCE_INIT;
+static __thread struct z_log_ring_struct *gs_log_ring; // Ring of the calling thread, NULL until it logs
+
+// Prefix of each level, the source location and the color of the message follow
+static const char *gs_log_heads[E_Z_DEBUG_LEVEL_MAX] = {
+    [E_Z_DEBUG_LEVEL_FATAL] = "[fatal ][%s:%d, %s] " E_LEVEL_COLOR_ESC_START E_LEVEL_COLOR_FATAL,
+    [E_Z_DEBUG_LEVEL_ERROR] = "[error ][%s:%d, %s] " E_LEVEL_COLOR_ESC_START E_LEVEL_COLOR_ERROR,
+    [E_Z_DEBUG_LEVEL_WARN] = "[wart  ][%s:%d, %s] " E_LEVEL_COLOR_ESC_START E_LEVEL_COLOR_WARN,
+    [E_Z_DEBUG_LEVEL_NOTICE] = "[notice][%s:%d, %s] " E_LEVEL_COLOR_ESC_START E_LEVEL_COLOR_NOTICE,
+    [E_Z_DEBUG_LEVEL_INFO] = "[info  ][%s:%d, %s] " E_LEVEL_COLOR_ESC_START E_LEVEL_COLOR_INFO,
+    [E_Z_DEBUG_LEVEL_DEBUG] = "[debug ][%s:%d, %s] " E_LEVEL_COLOR_ESC_START E_LEVEL_COLORRE_DEBUG,
+};
+
+/**
+@brief Format one log line, the color reset and line end survive truncation
+@param p_line Buffer of Z_LOG_LINE_MAX bytes
+@param level Level of the line
+@param p_file Source file of the call
+@param line Source line of the call
+@param p_func Function of the call
+@param p_format printf format of the message
+@param ap Arguments of the format
+@return Length of the line, without a terminating NUL
+*/
+static uint32_t z_log_format(char *p_line, int32_t level, const char *p_file, int32_t line, const char *p_func, const char *p_format, va_list ap) {
+    const char tail[] = E_LEVEL_COLOR_ESC_END E_LINE_MODE;
+    uint32_t room = Z_LOG_LINE_MAX - sizeof(tail); // Keeps the tail and its NUL
+    int32_t len;
+
+    len = snprintf(p_line, room, gs_log_heads[level], p_file, line, p_func);
+    uint32_t head = Z_TOOL_MIN((uint32_t)Z_TOOL_MAX(len, 0), room - 1);
+    len = vsnprintf(p_line + head, room - head, p_format, ap);
+    uint32_t total = Z_TOOL_MIN(head + (uint32_t)Z_TOOL_MAX(len, 0), room - 1);
+
+    memcpy(p_line + total, tail, sizeof(tail));
+    return total + sizeof(tail) - 1;
+}
+
+/**
+@brief Write a buffer completely, retrying short writes
+@param fd Destination
+@param p_iov Buffers to write, adjusted while writing
+@param nums Number of buffers
+@return No return value, a failing descriptor loses the rest
+*/
+static void z_log_writev(int32_t fd, struct iovec *p_iov, uint32_t nums) {
+    while (nums) {
+        ssize_t ret = writev(fd, p_iov, nums);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            return;
+        }
+
+        // Skip what was written, a short write resumes inside the current buffer
+        while (nums && (size_t)ret >= p_iov->iov_len) {
+            ret -= p_iov->iov_len;
+            p_iov++;
+            nums--;
+        }
+        if (nums) {
+            p_iov->iov_base = (uint8_t *)p_iov->iov_base + ret;
+            p_iov->iov_len -= ret;
+        }
+    }
+}
+
+/**
+@brief Write out every queued line and free the rings of exited threads, the caller holds the mutex
+@return No return value
+*/
+static void z_log_drain(void) {
+    struct z_log_ring_struct *p_batch[Z_LOG_IOV_MAX / 2];
+    uint32_t lens[Z_LOG_IOV_MAX / 2];
+    struct iovec iov[Z_LOG_IOV_MAX];
+    struct z_log_ring_struct *p_ring = gs_log.p_rings;
+
+    // Gather the used part of up to Z_LOG_IOV_MAX / 2 rings per writev, then hand the space back
+    while (p_ring) {
+        uint32_t rings = 0;
+        uint32_t iovs = 0;
+        for (; p_ring && rings < Z_LOG_IOV_MAX / 2; p_ring = p_ring->p_next) {
+            struct z_kfifo_span_struct span[2];
+            uint32_t len = __atomic_load_n(&p_ring->fifo.in, __ATOMIC_ACQUIRE) - p_ring->fifo.out;
+            if (len == 0) {
+                continue;
+            }
+            z_kfifo_out_peek(&p_ring->fifo, span, len);
+            for (int i = 0; i < 2 && span[i].len; i++) {
+                iov[iovs].iov_base = span[i].p_data;
+                iov[iovs++].iov_len = span[i].len;
+            }
+            p_batch[rings] = p_ring;
+            lens[rings++] = len;
+        }
+        if (iovs == 0) {
+            break;
+        }
+
+        z_log_writev(gs_log.fd, iov, iovs);
+        for (uint32_t i = 0; i < rings; i++) {
+            __atomic_store_n(&p_batch[i]->fifo.out, p_batch[i]->fifo.out + lens[i], __ATOMIC_RELEASE);
+        }
+    }
+
+    // Lines logged right before the owner exited have been written above
+    for (struct z_log_ring_struct **pp = &gs_log.p_rings; *pp;) {
+        struct z_log_ring_struct *p = *pp;
+        if (__atomic_load_n(&p->dead, __ATOMIC_ACQUIRE) && __atomic_load_n(&p->fifo.in, __ATOMIC_ACQUIRE) == p->fifo.out) {
+            *pp = p->p_next;
+            z_kfifo_free(&p->fifo);
+            free(p);
+        } else {
+            pp = &p->p_next;
+        }
+    }
+}
+
+/**
+@brief Thread-exit destructor of a ring, the writer frees it once drained
+@param p_arg Ring of the exiting thread
+@return No return value
+*/
+static void z_log_ring_exit(void *p_arg) {
+    struct z_log_ring_struct *p_ring = (struct z_log_ring_struct *)p_arg;
+
+    pthread_mutex_lock(&gs_log.mutex);
+    __atomic_store_n(&p_ring->dead, 1, __ATOMIC_RELEASE);
+    if (!gs_log.start_flag) {
+        // No writer to free it, lines left over from a racing z_log_stop are discarded
+        for (struct z_log_ring_struct **pp = &gs_log.p_rings; *pp; pp = &(*pp)->p_next) {
+            if (*pp == p_ring) {
+                *pp = p_ring->p_next;
+                z_kfifo_free(&p_ring->fifo);
+                free(p_ring);
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&gs_log.mutex);
+}
+
+static void z_log_once(void) {
+    pthread_key_create(&gs_log.key, z_log_ring_exit);
+}
+
+/**
+@brief Get the ring of the calling thread, creating it on the first line
+@return Ring, or NULL if it could not be allocated
+*/
+static struct z_log_ring_struct *z_log_ring(void) {
+    if (gs_log_ring) {
+        return gs_log_ring;
+    }
+
+    struct z_log_ring_struct *p_ring = (struct z_log_ring_struct *)calloc(1, sizeof(struct z_log_ring_struct));
+    if (!p_ring) {
+        return NULL;
+    }
+    if (z_kfifo_malloc(&p_ring->fifo, __atomic_load_n(&gs_log.ring_size, __ATOMIC_RELAXED)) != 0) {
+        free(p_ring);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&gs_log.mutex);
+    p_ring->p_next = gs_log.p_rings;
+    gs_log.p_rings = p_ring;
+    pthread_mutex_unlock(&gs_log.mutex);
+
+    pthread_setspecific(gs_log.key, p_ring);
+    gs_log_ring = p_ring;
+    return p_ring;
+}
+
+/**
+@brief Append one whole line to a ring, the owning thread is its only writer
+@param p_ring Ring of the calling thread
+@param p_line Formatted line
+@param len Length of the line
+@return Bytes queued in the ring afterwards, 0 if the line did not fit
+*/
+static uint32_t z_log_push(struct z_log_ring_struct *p_ring, const char *p_line, uint32_t len) {
+    struct z_kfifo_struct *p_fifo = &p_ring->fifo;
+    struct z_kfifo_span_struct span[2];
+    uint32_t out = __atomic_load_n(&p_fifo->out, __ATOMIC_ACQUIRE);
+
+    // A line is queued whole or not at all, the writer never sees half of one
+    if (p_fifo->size - (p_fifo->in - out) < len) {
+        return 0;
+    }
+    z_kfifo_in_prepare(p_fifo, span, len);
+    memcpy(span[0].p_data, p_line, span[0].len);
+    memcpy(span[1].p_data, p_line + span[0].len, span[1].len);
+    __atomic_store_n(&p_fifo->in, p_fifo->in + len, __ATOMIC_RELEASE);
+    return p_fifo->in - out;
+}
+
+/**
+@brief Background thread writing the queued lines, it batches every ring into a few writev calls
+@param p_arg Unused
+@return NULL
+*/
+static void *z_log_proc(void *p_arg) {
+    const struct timespec period = {0, Z_LOG_FLUSH_MS * 1000000L};
+
+    while (1) {
+        uint32_t stop = __atomic_load_n(&gs_log.stop_flag, __ATOMIC_ACQUIRE);
+        pthread_mutex_lock(&gs_log.mutex);
+        z_log_drain();
+        pthread_mutex_unlock(&gs_log.mutex);
+        if (stop) {
+            break;
+        }
+
+        // Sleep until the next flush, or until a producer finds its ring half full
+        uint32_t seq = __atomic_load_n(&gs_log.wake_seq, __ATOMIC_ACQUIRE);
+        __atomic_store_n(&gs_log.sleeping, 1, __ATOMIC_SEQ_CST);
+        if (!__atomic_load_n(&gs_log.stop_flag, __ATOMIC_SEQ_CST)) {
+            syscall(SYS_futex, &gs_log.wake_seq, FUTEX_WAIT_PRIVATE, seq, &period, NULL, 0);
+        }
+        __atomic_store_n(&gs_log.sleeping, 0, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+/**
+@brief Wake the writer thread if it sleeps
+@return No return value
+*/
+static void z_log_wake(void) {
+    if (__atomic_load_n(&gs_log.sleeping, __ATOMIC_RELAXED) && __atomic_exchange_n(&gs_log.sleeping, 0, __ATOMIC_SEQ_CST)) {
+        __atomic_add_fetch(&gs_log.wake_seq, 1, __ATOMIC_RELEASE);
+        syscall(SYS_futex, &gs_log.wake_seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
+
+/**
+@brief Start the asynchronous backend
+@param fd File descriptor the writer thread writes to
+@param ring_size Bytes of the ring of each logging thread, 0 for Z_LOG_RING_SIZE
+@return Status, success is 0
+*/
+int32_t z_log_start(int32_t fd, uint32_t ring_size) {
+    if (fd < 0 || ring_size > (1u << 30)) {
+        return -EINVAL;
+    }
+    ring_size = ring_size ? ring_size : Z_LOG_RING_SIZE;
+
+    // A line must always fit an empty ring
+    ring_size = Z_TOOL_MAX(ring_size, Z_LOG_LINE_MAX);
+    if (ring_size & (ring_size - 1)) {
+        ring_size = Z_TOOL_roundup_pow_of_two(ring_size);
+    }
+    pthread_once(&gs_log_once, z_log_once);
+
+    pthread_mutex_lock(&gs_log.mutex);
+    if (gs_log.start_flag) {
+        pthread_mutex_unlock(&gs_log.mutex);
+        return -EBUSY;
+    }
+    gs_log.fd = fd;
+    gs_log.ring_size = ring_size;
+    gs_log.stop_flag = 0;
+    int32_t ret = pthread_create(&gs_log.tid, NULL, z_log_proc, NULL);
+    if (ret != 0) {
+        pthread_mutex_unlock(&gs_log.mutex);
+        return -ret;
+    }
+    gs_log.start_flag = 1;
+    __atomic_store_n(&gs_log.run_flag, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&gs_log.mutex);
+    return 0;
+}
+
+/**
+@brief Stop the asynchronous backend after writing out the queued lines
+@return Status, success is 0
+*/
+int32_t z_log_stop(void) {
+    pthread_mutex_lock(&gs_log.mutex);
+    if (!gs_log.start_flag) {
+        pthread_mutex_unlock(&gs_log.mutex);
+        return -EINVAL;
+    }
+    __atomic_store_n(&gs_log.run_flag, 0, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&gs_log.stop_flag, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&gs_log.mutex);
+
+    // The writer drains once more after seeing the stop flag
+    __atomic_add_fetch(&gs_log.wake_seq, 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &gs_log.wake_seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    pthread_join(gs_log.tid, NULL);
+
+    // Catch lines committed by threads that saw run_flag just before it was cleared, a line this drain misses is
+    // taken back and printed by its writer, see z_log_write
+    pthread_mutex_lock(&gs_log.mutex);
+    z_log_drain();
+    gs_log.start_flag = 0;
+    pthread_mutex_unlock(&gs_log.mutex);
+    return 0;
+}
+
+/**
+@brief Get the number of lines dropped because a ring was full
+@return Drop counter
+*/
+uint64_t z_log_drops(void) {
+    return __atomic_load_n(&gs_log.drop_nums, __ATOMIC_RELAXED);
+}
+
+/**
+@brief Format one line and queue it in the ring of the calling thread, or print it when the backend is stopped
+@param level Level of the line
+@param p_file Source file of the call
+@param line Source line of the call
+@param p_func Function of the call
+@param p_format printf format of the message
+@return No return value
+*/
+void z_log_write(int32_t level, const char *p_file, int32_t line, const char *p_func, const char *p_format, ...) {
+    if (level < E_Z_DEBUG_LEVEL_FATAL || level >= E_Z_DEBUG_LEVEL_MAX) {
+        return;
+    }
+    char buf[Z_LOG_LINE_MAX];
+    va_list ap;
+
+    va_start(ap, p_format);
+    uint32_t len = z_log_format(buf, level, p_file, line, p_func, p_format, ap);
+    va_end(ap);
+
+    if (!__atomic_load_n(&gs_log.run_flag, __ATOMIC_ACQUIRE)) {
+        fwrite(buf, 1, len, stdout);
+        fflush(stdout);
+        return;
+    }
+
+    // A fatal line usually precedes an abort, it must not wait in the ring
+    if (level == E_Z_DEBUG_LEVEL_FATAL) {
+        struct iovec iov = {buf, len};
+        z_log_writev(gs_log.fd, &iov, 1);
+        return;
+    }
+
+    struct z_log_ring_struct *p_ring = z_log_ring();
+    uint32_t used = p_ring ? z_log_push(p_ring, buf, len) : 0;
+    if (used == 0) {
+        __atomic_add_fetch(&gs_log.drop_nums, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    // Pairs with z_log_stop clearing run_flag: either its last drain sees this line, or this thread sees the flag cleared
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&gs_log.run_flag, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&gs_log.mutex);
+        if (!gs_log.start_flag && p_ring->fifo.in != p_ring->fifo.out) {
+            // The last drain is over and only this line can be left, take it back and print it like a stopped backend
+            __atomic_store_n(&p_ring->fifo.in, p_ring->fifo.in - len, __ATOMIC_RELEASE);
+            pthread_mutex_unlock(&gs_log.mutex);
+            fwrite(buf, 1, len, stdout);
+            fflush(stdout);
+            return;
+        }
+        pthread_mutex_unlock(&gs_log.mutex);
+        return;
+    }
+
+    // The writer flushes every Z_LOG_FLUSH_MS on its own, a filling ring brings it forward
+    if (used > p_ring->fifo.size / 2) {
+        z_log_wake();
+    }
+}
+
+// Number of lines each test thread logs
+#define Z_LOG_TEST_LINES 2000
+
+static void *z_log_test_proc(void *p_arg) {
+    for (uint32_t i = 0; i < Z_LOG_TEST_LINES; i++) {
+        z_log_write(E_Z_DEBUG_LEVEL_INFO, __FILE__, __LINE__, __FUNCTION__, "t%lu n%u", (unsigned long)(uintptr_t)p_arg, i);
+    }
+    return NULL;
+}
+
+/**
+@brief Test the logging backend: lines from several threads arrive whole and in order per thread, drops are counted
+@return Status, success is 0
+*/
+int32_t z_log_test(void) {
+    const uint32_t threads = 4;
+    pthread_t tids[threads];
+    uint32_t next[threads + 1];
+    int32_t ret = -1;
+
+    FILE *p_file = tmpfile();
+    if (!p_file) {
+        Z_RAW("Failed to create the log file\n");
+        return -1;
+    }
+    if (z_log_start(fileno(p_file), 4096) != 0) {
+        Z_RAW("Failed to start the logging backend\n");
+        fclose(p_file);
+        return -1;
+    }
+    uint64_t drops = z_log_drops();
+
+    for (uintptr_t i = 0; i < threads; i++) {
+        pthread_create(&tids[i], NULL, z_log_test_proc, (void *)i);
+    }
+    for (uint32_t i = 0; i < threads; i++) {
+        pthread_join(tids[i], NULL);
+    }
+
+    // Hold the writer off so that a burst overflows the ring of this thread, created first as that takes the mutex
+    z_log_ring();
+    pthread_mutex_lock(&gs_log.mutex);
+    z_log_test_proc((void *)(uintptr_t)threads);
+    pthread_mutex_unlock(&gs_log.mutex);
+    z_log_stop();
+    drops = z_log_drops() - drops;
+
+    // Every line carries its thread and sequence number, a thread's lines must arrive in order with gaps only for drops
+    char line[Z_LOG_LINE_MAX];
+    uint64_t lines = 0;
+    memset(next, 0, sizeof(next));
+    rewind(p_file);
+    while (fgets(line, sizeof(line), p_file)) {
+        char *p = strstr(line, "] " E_LEVEL_COLOR_ESC_START E_LEVEL_COLOR_INFO "t");
+        unsigned long t;
+        uint32_t n;
+        if (!p || sscanf(p + strlen("] " E_LEVEL_COLOR_ESC_START E_LEVEL_COLOR_INFO), "t%lu n%u", &t, &n) != 2 || t > threads ||
+            !strstr(line, E_LEVEL_COLOR_ESC_END E_LINE_MODE)) {
+            Z_RAW("Malformed log line: %s\n", line);
+            goto exit;
+        }
+        if (n < next[t]) {
+            Z_RAW("Thread %lu logged line %u out of order\n", t, n);
+            goto exit;
+        }
+        next[t] = n + 1;
+        lines++;
+    }
+
+    if (lines + drops != (uint64_t)(threads + 1) * Z_LOG_TEST_LINES || drops == 0) {
+        Z_RAW("Read %" PRIu64 " lines with %" PRIu64 " drops, expected %u lines in total\n", lines, drops, (threads + 1) * Z_LOG_TEST_LINES);
+        goto exit;
+    }
+    Z_RAW("All tests passed successfully\n");
+    ret = 0;
+exit:
+    fclose(p_file);
+    return ret;
+}
@@ -0,0 +1,195 @@
+#include "z_tool.h"
+#include "z_debug.h"
+#include "z_mpmc.h"
+
+// Bytes reserved in front of each slot payload for its sequence number, keeps the payload word aligned.
+#define Z_MPMC_SLOT_HEAD sizeof(uint64_t)
+
+// Returns the address of the slot holding the given position.
+static inline uint8_t *__z_mpmc_slot(struct z_mpmc_struct *p_ring, uint32_t pos) {
+    return p_ring->p_buffer + (size_t)(pos & (p_ring->size - 1)) * p_ring->slot_size;
+}
+
+// Allocates the slot array and stamps every slot as writable for the first lap.
+int z_mpmc_malloc(struct z_mpmc_struct *p_ring, uint32_t nums, uint32_t elem_size) {
+    if (!p_ring || !nums || !elem_size) return -1; // Return error on invalid arguments.
+
+    // Round up the slot count to the nearest power of two if it's not already.
+    if (nums & (nums - 1)) {
+        nums = Z_TOOL_roundup_pow_of_two(nums);
+    }
+
+    // A single slot cannot tell "published" from "free for the next lap", both read pos + 1.
+    if (nums < 2) {
+        nums = 2;
+    }
+
+    memset(p_ring, 0, sizeof(*p_ring));
+    p_ring->slot_size = Z_MPMC_SLOT_HEAD + Z_TOOL_ALIGN_SYS(elem_size);
+    p_ring->p_buffer = (uint8_t *)malloc((size_t)nums * p_ring->slot_size);
+    if (!p_ring->p_buffer) {
+        p_ring->slot_size = 0;
+        return -1; // Return error if memory allocation fails.
+    }
+
+    p_ring->size = nums;
+    p_ring->elem_size = elem_size;
+    for (uint32_t i = 0; i < nums; i++) {
+        *(uint32_t *)__z_mpmc_slot(p_ring, i) = i; // Slot i is free for position i.
+    }
+    return 0;
+}
+
+// Frees the slot array and resets the ring.
+void z_mpmc_free(struct z_mpmc_struct *p_ring) {
+    if (!p_ring) return;
+    free(p_ring->p_buffer);
+    memset(p_ring, 0, sizeof(*p_ring));
+}
+
+// Enqueues a single element, returns 0 on success or -1 if the ring is full.
+static int __z_mpmc_push(struct z_mpmc_struct *p_ring, const void *p_from) {
+    uint32_t pos = __atomic_load_n(&p_ring->in, __ATOMIC_RELAXED);
+
+    while (1) {
+        uint8_t *p_slot = __z_mpmc_slot(p_ring, pos);
+        uint32_t seq = __atomic_load_n((uint32_t *)p_slot, __ATOMIC_ACQUIRE);
+        int32_t dif = (int32_t)(seq - pos);
+
+        if (dif == 0) {
+            // Slot is free for this lap, try to claim the position.
+            if (__atomic_compare_exchange_n(&p_ring->in, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                memcpy(p_slot + Z_MPMC_SLOT_HEAD, p_from, p_ring->elem_size);
+                __atomic_store_n((uint32_t *)p_slot, pos + 1, __ATOMIC_RELEASE); // Publish to consumers.
+                return 0;
+            }
+        } else if (dif < 0) {
+            return -1; // Slot still holds data from the previous lap, ring is full.
+        } else {
+            pos = __atomic_load_n(&p_ring->in, __ATOMIC_RELAXED); // Another producer won, reload.
+        }
+    }
+}
+
+// Dequeues a single element, returns 0 on success or -1 if the ring is empty.
+static int __z_mpmc_pop(struct z_mpmc_struct *p_ring, void *p_to) {
+    uint32_t pos = __atomic_load_n(&p_ring->out, __ATOMIC_RELAXED);
+
+    while (1) {
+        uint8_t *p_slot = __z_mpmc_slot(p_ring, pos);
+        uint32_t seq = __atomic_load_n((uint32_t *)p_slot, __ATOMIC_ACQUIRE);
+        int32_t dif = (int32_t)(seq - (pos + 1));
+
+        if (dif == 0) {
+            // Slot has been published for this lap, try to claim the position.
+            if (__atomic_compare_exchange_n(&p_ring->out, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                memcpy(p_to, p_slot + Z_MPMC_SLOT_HEAD, p_ring->elem_size);
+                __atomic_store_n((uint32_t *)p_slot, pos + p_ring->size, __ATOMIC_RELEASE); // Hand back to producers.
+                return 0;
+            }
+        } else if (dif < 0) {
+            return -1; // Slot not yet published, ring is empty.
+        } else {
+            pos = __atomic_load_n(&p_ring->out, __ATOMIC_RELAXED); // Another consumer won, reload.
+        }
+    }
+}
+
+// Writes up to nums elements into the ring.
+uint32_t z_mpmc_in(struct z_mpmc_struct *p_ring, const void *p_from, uint32_t nums) {
+    if (!p_ring || !p_ring->p_buffer || !p_from) return 0;
+    uint32_t i;
+
+    for (i = 0; i < nums; i++) {
+        if (__z_mpmc_push(p_ring, (const uint8_t *)p_from + (size_t)i * p_ring->elem_size) != 0) {
+            break;
+        }
+    }
+    return i; // Return the number of elements written.
+}
+
+// Reads up to nums elements from the ring.
+uint32_t z_mpmc_out(struct z_mpmc_struct *p_ring, void *p_to, uint32_t nums) {
+    if (!p_ring || !p_ring->p_buffer || !p_to) return 0;
+    uint32_t i;
+
+    for (i = 0; i < nums; i++) {
+        if (__z_mpmc_pop(p_ring, (uint8_t *)p_to + (size_t)i * p_ring->elem_size) != 0) {
+            break;
+        }
+    }
+    return i; // Return the number of elements read.
+}
+
+// Returns the number of elements currently stored in the ring.
+uint32_t z_mpmc_data_len(struct z_mpmc_struct *p_ring) {
+    if (!p_ring) return 0;
+    uint32_t out = __atomic_load_n(&p_ring->out, __ATOMIC_ACQUIRE);
+    uint32_t in = __atomic_load_n(&p_ring->in, __ATOMIC_ACQUIRE);
+    int32_t len = (int32_t)(in - out);
+
+    // Indices are sampled separately, clamp transient readings into range.
+    if (len < 0) return 0;
+    return Z_TOOL_MIN((uint32_t)len, p_ring->size);
+}
+
+// Returns the number of free slots in the ring.
+uint32_t z_mpmc_space(struct z_mpmc_struct *p_ring) {
+    if (!p_ring) return 0;
+    return p_ring->size - z_mpmc_data_len(p_ring);
+}
+
+// Tests various functionalities of the ring.
+uint32_t z_mpmc_test(void) {
+    const uint32_t nums = 16;
+    uint64_t value;
+    struct z_mpmc_struct ring;
+
+    if (z_mpmc_malloc(&ring, nums, sizeof(uint64_t)) != 0) {
+        Z_RAW("Memory allocation failed\n");
+        return -1;
+    }
+
+    // Run several laps so that sequence numbers wrap through every slot.
+    for (uint64_t lap = 0; lap < 4; lap++) {
+        for (uint64_t i = 0; i < nums; i++) {
+            value = lap * nums + i;
+            if (z_mpmc_in(&ring, &value, 1) != 1) {
+                Z_RAW("Data write failed at lap %lu index %lu\n", lap, i);
+                z_mpmc_free(&ring);
+                return -1;
+            }
+        }
+
+        // Test writing to a full ring.
+        if (z_mpmc_in(&ring, &value, 1) != 0 || z_mpmc_space(&ring) != 0) {
+            Z_RAW("Buffer full test failed\n");
+            z_mpmc_free(&ring);
+            return -1;
+        }
+
+        for (uint64_t i = 0; i < nums; i++) {
+            if (z_mpmc_out(&ring, &value, 1) != 1 || value != lap * nums + i) {
+                Z_RAW("Data mismatch at lap %lu index %lu\n", lap, i);
+                z_mpmc_free(&ring);
+                return -1;
+            }
+        }
+
+        // Test reading from an empty ring.
+        if (z_mpmc_out(&ring, &value, 1) != 0 || z_mpmc_data_len(&ring) != 0) {
+            Z_RAW("Buffer empty test failed\n");
+            z_mpmc_free(&ring);
+            return -1;
+        }
+    }
+
+    z_mpmc_free(&ring);
+    if (ring.p_buffer != NULL || ring.size != 0) {
+        Z_RAW("Memory free failed\n");
+        return -1;
+    }
+
+    Z_RAW("All tests passed successfully\n");
+    return 0;
+}
@@ -0,0 +1,379 @@
+#include "z_tool.h"
+#include "z_debug.h"
+#include "z_thpool.h"
+#include "z_thgraph.h"
+
+#include <pthread.h>
+
+// Structure holding one node of the graph
+struct z_thgraph_node_struct {
+    void (*cb)(void *);                  // Node function
+    void *p_arg;                         // Argument to the node function
+    uint32_t *p_succ;                    // Ids of the nodes depending on this one
+    uint32_t succ_nums;                  // Number of valid entries in p_succ
+    uint32_t succ_max;                   // Capacity of p_succ
+    uint32_t dep_nums;                   // Number of nodes this one depends on
+    uint32_t pending;                    // Dependencies not yet finished in the current launch
+    struct z_thgraph_node_struct *p_next; // Link of the worker local ready list
+    struct z_thgraph_struct *p_graph;    // Owning graph
+};
+
+// Structure holding a task graph
+struct z_thgraph_struct {
+    struct z_thgraph_node_struct *p_nodes; // Node array, indexed by node id
+    uint32_t node_nums;                    // Number of nodes
+    uint32_t node_max;                     // Capacity of p_nodes
+    uint32_t run_flag;                     // Set between launch and a successful wait
+    z_thpool_handle_t pool;                // Pool running the current launch
+    struct z_thpool_wg_struct t_wg;        // Counts the nodes still to run
+};
+
+static void z_thgraph_node_run(void *p_arg);
+
+/**
+@brief Create an empty task graph
+@param p_graph Pointer to store the created graph handle
+@return Status, success is 0
+*/
+int32_t z_thgraph_create(z_thgraph_handle_t *p_graph) {
+    if (!p_graph) {
+        return -EINVAL;
+    }
+
+    struct z_thgraph_struct *p = (struct z_thgraph_struct *)calloc(1, sizeof(struct z_thgraph_struct));
+    if (!p) {
+        return -ENOMEM;
+    }
+
+    if (z_thpool_wg_init(&p->t_wg) != 0) {
+        free(p);
+        return -1;
+    }
+
+    *p_graph = p;
+    return 0;
+}
+
+/**
+@brief Destroy a task graph and free all of its nodes
+@param graph Handle to the graph
+@return Status, success is 0, -EBUSY while the graph is running
+*/
+int32_t z_thgraph_destroy(z_thgraph_handle_t graph) {
+    if (!graph) {
+        return -EINVAL;
+    }
+    if (graph->run_flag) {
+        return -EBUSY;
+    }
+
+    for (uint32_t i = 0; i < graph->node_nums; i++) {
+        free(graph->p_nodes[i].p_succ);
+    }
+    free(graph->p_nodes);
+    z_thpool_wg_destroy(&graph->t_wg);
+    free(graph);
+    return 0;
+}
+
+/**
+@brief Add a node to the graph
+@param graph Handle to the graph
+@param cb Node function
+@param p_arg Argument to the node function
+@param p_id Pointer to store the id of the new node
+@return Status, success is 0
+*/
+int32_t z_thgraph_node_add(z_thgraph_handle_t graph, void (*cb)(void *), void *p_arg, uint32_t *p_id) {
+    if (!graph || !cb || !p_id) {
+        return -EINVAL;
+    }
+    if (graph->run_flag) {
+        return -EBUSY;
+    }
+
+    // Grow the node array geometrically, node pointers are only handed out while the graph runs
+    if (graph->node_nums == graph->node_max) {
+        uint32_t max = graph->node_max ? graph->node_max * 2 : 16;
+        struct z_thgraph_node_struct *p_nodes = (struct z_thgraph_node_struct *)realloc(graph->p_nodes, max * sizeof(struct z_thgraph_node_struct));
+        if (!p_nodes) {
+            return -ENOMEM;
+        }
+        graph->p_nodes = p_nodes;
+        graph->node_max = max;
+    }
+
+    struct z_thgraph_node_struct *p_node = &graph->p_nodes[graph->node_nums];
+    memset(p_node, 0, sizeof(struct z_thgraph_node_struct));
+    p_node->cb = cb;
+    p_node->p_arg = p_arg;
+    *p_id = graph->node_nums++;
+    return 0;
+}
+
+/**
+@brief Make node `to` depend on node `from`
+@param graph Handle to the graph
+@param from Node that has to finish first
+@param to Node that waits for `from`
+@return Status, success is 0
+*/
+int32_t z_thgraph_edge_add(z_thgraph_handle_t graph, uint32_t from, uint32_t to) {
+    if (!graph || from >= graph->node_nums || to >= graph->node_nums || from == to) {
+        return -EINVAL;
+    }
+    if (graph->run_flag) {
+        return -EBUSY;
+    }
+
+    struct z_thgraph_node_struct *p_from = &graph->p_nodes[from];
+    if (p_from->succ_nums == p_from->succ_max) {
+        uint32_t max = p_from->succ_max ? p_from->succ_max * 2 : 4;
+        uint32_t *p_succ = (uint32_t *)realloc(p_from->p_succ, max * sizeof(uint32_t));
+        if (!p_succ) {
+            return -ENOMEM;
+        }
+        p_from->p_succ = p_succ;
+        p_from->succ_max = max;
+    }
+
+    p_from->p_succ[p_from->succ_nums++] = to;
+    graph->p_nodes[to].dep_nums++;
+    return 0;
+}
+
+/**
+@brief Check that the edges of the graph form no cycle (Kahn's algorithm over the static dependency counts)
+@param graph Handle to the graph
+@return Status, success is 0, -ELOOP when a cycle exists
+*/
+static int32_t z_thgraph_check(z_thgraph_handle_t graph) {
+    uint32_t *p_stack = (uint32_t *)malloc(graph->node_nums * sizeof(uint32_t));
+    uint32_t top = 0;
+    uint32_t seen = 0;
+
+    if (!p_stack) {
+        return -ENOMEM;
+    }
+
+    for (uint32_t i = 0; i < graph->node_nums; i++) {
+        graph->p_nodes[i].pending = graph->p_nodes[i].dep_nums;
+        if (graph->p_nodes[i].pending == 0) {
+            p_stack[top++] = i;
+        }
+    }
+
+    while (top) {
+        struct z_thgraph_node_struct *p_node = &graph->p_nodes[p_stack[--top]];
+        seen++;
+        for (uint32_t i = 0; i < p_node->succ_nums; i++) {
+            if (--graph->p_nodes[p_node->p_succ[i]].pending == 0) {
+                p_stack[top++] = p_node->p_succ[i];
+            }
+        }
+    }
+
+    free(p_stack);
+    return seen == graph->node_nums ? 0 : -ELOOP;
+}
+
+/**
+@brief Run a node, then keep running successors it made ready on the same worker
+@param p_arg Node to run
+@return No return value
+*/
+static void z_thgraph_node_run(void *p_arg) {
+    struct z_thgraph_node_struct *p_node = (struct z_thgraph_node_struct *)p_arg;
+    struct z_thgraph_struct *p_graph = p_node->p_graph;
+    struct z_thgraph_node_struct *p_local = NULL; // Ready nodes kept on this worker
+
+    while (p_node) {
+        p_node->cb(p_node->p_arg);
+
+        // Release the successors, the first one that becomes ready continues on this worker
+        struct z_thgraph_node_struct *p_keep = NULL;
+        for (uint32_t i = 0; i < p_node->succ_nums; i++) {
+            struct z_thgraph_node_struct *p_succ = &p_graph->p_nodes[p_node->p_succ[i]];
+            if (__atomic_sub_fetch(&p_succ->pending, 1, __ATOMIC_ACQ_REL) != 0) {
+                continue;
+            }
+
+            if (!p_keep) {
+                p_keep = p_succ;
+            } else if (z_thpool_add_work(p_graph->pool, z_thgraph_node_run, p_succ) != 0) {
+                // Queue full or pool stopping, never block a worker here
+                p_succ->p_next = p_local;
+                p_local = p_succ;
+            }
+        }
+
+        // Counted last, the waiter may reuse the graph as soon as the final node is done
+        z_thpool_wg_done(&p_graph->t_wg);
+
+        if (p_keep) {
+            p_node = p_keep;
+        } else {
+            p_node = p_local;
+            if (p_local) {
+                p_local = p_local->p_next;
+            }
+        }
+    }
+}
+
+/**
+@brief Run the whole graph on a thread pool
+@param graph Handle to the graph
+@param pool Handle to the thread pool running the nodes
+@return Status, success is 0, -EBUSY when already running, -ELOOP when the edges form a cycle
+*/
+int32_t z_thgraph_launch(z_thgraph_handle_t graph, z_thpool_handle_t pool) {
+    if (!graph || !pool) {
+        return -EINVAL;
+    }
+    if (graph->run_flag) {
+        return -EBUSY;
+    }
+
+    int32_t ret = z_thgraph_check(graph);
+    if (ret != 0) {
+        return ret;
+    }
+
+    graph->run_flag = 1;
+    graph->pool = pool;
+    for (uint32_t i = 0; i < graph->node_nums; i++) {
+        graph->p_nodes[i].pending = graph->p_nodes[i].dep_nums;
+        graph->p_nodes[i].p_graph = graph;
+    }
+    z_thpool_wg_add(&graph->t_wg, graph->node_nums);
+
+    // Roots are counted before the first one is queued, a fast worker may already release others
+    for (uint32_t i = 0; i < graph->node_nums; i++) {
+        struct z_thgraph_node_struct *p_node = &graph->p_nodes[i];
+        if (p_node->dep_nums != 0) {
+            continue;
+        }
+
+        // A stopped pool cannot take the root, run it here so that the launch still completes
+        if (z_thpool_add_work_wait(pool, z_thgraph_node_run, p_node) != 0) {
+            z_thgraph_node_run(p_node);
+        }
+    }
+    return 0;
+}
+
+/**
+@brief Wait until every node of a launched graph has run
+@param graph Handle to the graph
+@param timeout_ns Maximum time to wait in nanoseconds, Z_THPOOL_WAIT_FOREVER to wait without limit
+@return Status, success is 0, -ETIMEDOUT on timeout
+*/
+int32_t z_thgraph_wait(z_thgraph_handle_t graph, uint64_t timeout_ns) {
+    if (!graph || !graph->run_flag) {
+        return -EINVAL;
+    }
+
+    int32_t ret = z_thpool_wg_wait(&graph->t_wg, timeout_ns);
+    if (ret == 0) {
+        graph->run_flag = 0;
+    }
+    return ret;
+}
+
+// Shared state of the graph test
+struct z_thgraph_test_struct {
+    uint32_t errors;    // Nodes that ran before their dependencies
+    uint32_t expect[4]; // Number of nodes in each stage
+    uint32_t done[4];   // Nodes of each stage finished
+};
+
+// Argument of one test node
+struct z_thgraph_test_arg_struct {
+    struct z_thgraph_test_struct *p_test;
+    uint32_t stage;
+};
+
+// Test node, checks that every node of the previous stage has finished
+static void z_thgraph_test_cb(void *p_arg) {
+    struct z_thgraph_test_arg_struct *p = (struct z_thgraph_test_arg_struct *)p_arg;
+    struct z_thgraph_test_struct *p_test = p->p_test;
+
+    if (p->stage > 0 && __atomic_load_n(&p_test->done[p->stage - 1], __ATOMIC_ACQUIRE) != p_test->expect[p->stage - 1]) {
+        __atomic_add_fetch(&p_test->errors, 1, __ATOMIC_RELAXED);
+    }
+    usleep(1000);
+    __atomic_add_fetch(&p_test->done[p->stage], 1, __ATOMIC_RELEASE);
+}
+
+/**
+@brief Test the task graph with a fan-in / fan-out / fan-in job launched twice
+@return Status, success is 0
+*/
+int32_t z_thgraph_test(void) {
+    struct z_thpool_config_struct t_config = {
+        .max_thread_nums = 4,
+        .msg_node_max = 4,
+        .thread_stack_size = 64 * 1024
+    };
+    struct z_thgraph_test_struct t_test = {.expect = {8, 1, 6, 1}};
+    struct z_thgraph_test_arg_struct args[16];
+    uint32_t ids[16];
+    uint32_t nums = 0;
+    z_thpool_handle_t pool;
+    z_thgraph_handle_t graph;
+    int32_t ret = -1;
+
+    if (z_thpool_create(&t_config, &pool) != 0) {
+        Z_RAW("Failed to create thread pool\n");
+        return -1;
+    }
+    if (z_thgraph_create(&graph) != 0) {
+        Z_RAW("Failed to create graph\n");
+        z_thpool_destroy(pool);
+        return -1;
+    }
+
+    // A1..A8 -> B -> C1..C6 -> D, the C nodes overflow the small queue and partly run inline
+    for (uint32_t stage = 0; stage < 4; stage++) {
+        for (uint32_t i = 0; i < t_test.expect[stage]; i++) {
+            args[nums].p_test = &t_test;
+            args[nums].stage = stage;
+            z_thgraph_node_add(graph, z_thgraph_test_cb, &args[nums], &ids[nums]);
+            nums++;
+        }
+    }
+    for (uint32_t i = 0; i < nums; i++) {
+        for (uint32_t j = 0; j < nums; j++) {
+            if (args[j].stage == args[i].stage + 1) {
+                z_thgraph_edge_add(graph, ids[i], ids[j]);
+            }
+        }
+    }
+
+    for (uint32_t round = 0; round < 2; round++) {
+        memset(t_test.done, 0, sizeof(t_test.done));
+        if (z_thgraph_launch(graph, pool) != 0 || z_thgraph_wait(graph, Z_THPOOL_WAIT_FOREVER) != 0) {
+            Z_RAW("Graph launch failed in round %u\n", round);
+            goto exit;
+        }
+        if (t_test.errors != 0 || t_test.done[3] != 1) {
+            Z_RAW("Dependency order violated in round %u\n", round);
+            goto exit;
+        }
+    }
+
+    // A back edge must be refused at launch
+    z_thgraph_edge_add(graph, ids[nums - 1], ids[0]);
+    if (z_thgraph_launch(graph, pool) != -ELOOP) {
+        Z_RAW("Cycle not detected\n");
+        goto exit;
+    }
+
+    Z_RAW("All tests passed successfully\n");
+    ret = 0;
+exit:
+    z_thgraph_destroy(graph);
+    z_thpool_destroy(pool);
+    return ret;
+}
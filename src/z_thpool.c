@@ -1,32 +1,245 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // CPU affinity and sched_getcpu
+#endif
+
 #include "z_tool.h"
 #include "z_kfifo.h"
+#include "z_mpmc.h"
+#include "z_hist.h"
 #include "z_debug.h"
 #include "z_thpool.h"
 #include "z_table_print.h"
 
 #include <pthread.h>
+#include <sched.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
 
 #define Z_THPOOL_VERION "0.0.2.0"
+#define Z_THPOOL_BATCH_NUMS 64 // Messages staged on the stack per queue write in batch submission
+
+// Task handle state bits
+#define Z_THPOOL_TASK_DONE 0x1    // Callback has returned and p_ret is valid
+#define Z_THPOOL_TASK_WAITERS 0x2 // At least one thread sleeps on the state word
+#define Z_THPOOL_TASK_THEN 0x4    // A completion callback is claimed, only its claimer writes then and p_ctx
+#define Z_THPOOL_TASK_READY 0x10  // then and p_ctx are published, whoever sets DONE or READY last runs the callback
+#define Z_THPOOL_TASK_CANCEL 0x8  // Discarded by z_thpool_destroy_ex, the task function never ran and p_ret is NULL
+
+#define Z_THPOOL_PFOR_CLOSED 0x80000000 // parallel_for caller has finished its share, late helpers leave at once
+#define Z_THPOOL_PFOR_CHUNKS 32         // Chunks per participant when no grain is given
+
+#define Z_THPOOL_NODE_MAX 16                   // NUMA nodes tracked, nodes beyond this share the queues of the others
+#ifndef Z_THPOOL_NODE_PATH
+#define Z_THPOOL_NODE_PATH "/sys/devices/system/node" // NUMA topology, overridable for testing
+#endif
+#define Z_THPOOL_CPU_PATH "/sys/devices/system/cpu"
+
+#define Z_THPOOL_SPIN_CHECKS 64 // Queue polls between two clock reads while spinning
+
+#define Z_THPOOL_CACHE_LINE 64   // Padding between counters written by different threads
+#define Z_THPOOL_STAT_SHARDS 16  // Submission counter shards, producer threads are spread over them
+#define Z_THPOOL_HUGE_SIZE (2UL * 1024 * 1024) // Transparent huge page size the stack arena is laid out for
+
+#ifndef Z_THPOOL_TRACE
+#define Z_THPOOL_TRACE 1 // Build with -DZ_THPOOL_TRACE=0 to compile the trace points out
+#endif
+#define Z_THPOOL_TRACE_TID_PUB 1000 // Trace thread id of producer shard 0, workers use their slot index
+
+// th_park layout, a producer only wakes parked workers that no earlier producer woke yet
+#define Z_THPOOL_PARK_ONE 1ULL
+#define Z_THPOOL_PARK_WOKEN (1ULL << 32)
+#define Z_THPOOL_PARK_NUMS(v) ((uint32_t)(v))
+#define Z_THPOOL_PARK_WOKEN_NUMS(v) ((uint32_t)((v) >> 32))
+
+// Hint to the CPU that this is a busy-wait loop
+#if defined(__x86_64__) || defined(__i386__)
+#define Z_THPOOL_CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__aarch64__) || defined(__arm__)
+#define Z_THPOOL_CPU_RELAX() __asm__ __volatile__("yield" ::: "memory")
+#else
+#define Z_THPOOL_CPU_RELAX() __asm__ __volatile__("" ::: "memory")
+#endif
 
 // Structure to hold thread pool message details
 struct z_thpool_msg_struct {
-    void (*cb)(void *); // Callback function
-    void *p_arg;        // Argument to the callback function
+    void (*cb)(void *);              // Callback function
+    void *p_arg;                     // Argument to the callback function
+    struct z_thpool_wg_struct *p_wg; // Wait group notified once the callback returns, may be NULL
+    uint64_t enq_ns;                 // CLOCK_MONOTONIC enqueue time when latency_flag is set, else the trace clock when tracing, also the trace flow id
+};
+
+// Queue slot staged by single message writers, the payload of z_thpool_add_work_copy follows the header
+struct z_thpool_slot_struct {
+    struct z_thpool_msg_struct msg;     // Message header, p_arg is NULL when the payload is inline
+    uint8_t data[Z_THPOOL_INLINE_MAX];  // Inline payload, only the first msg_inline_max bytes are queued
+};
+
+// Structure backing a z_thpool_task_t handle, taken from the pool's preallocated free list
+struct z_thpool_task_struct {
+    void *(*cb)(void *);                 // Task function
+    void *p_arg;                         // Argument to the task function
+    void *p_ret;                         // Value returned by the task function
+    uint32_t state;                      // Z_THPOOL_TASK_* bits, also used as futex word
+    uint32_t refs;                       // References held by the submitter and the queued message
+    void (*then)(void *p_ret, void *p_ctx); // Completion callback, run by the worker or by z_thpool_task_then
+    void *p_ctx;                         // Context for the completion callback
+    uint32_t next;                       // Free list link, index + 1 of the next free task
+    struct z_thpool_mng_struct *p_mng;   // Owning thread pool
+};
+
+// Structure for one priority lane of the message queue
+struct z_thpool_lane_struct {
+    struct z_kfifo_struct t_info; // Mutex guarded message queue (kfifo mode)
+    struct z_mpmc_struct t_ring;  // Lock-free message queue (MPMC mode)
+    uint32_t weight;              // Tickets per round under weighted round-robin
+    uint64_t deq_nums;            // Messages dequeued from this lane
+};
+
+// Shared state of one parallel_for / parallel_reduce call, freed with its last reference
+struct z_thpool_pfor_struct {
+    uint64_t next;     // First index not yet handed out
+    uint64_t end;      // End of the range, exclusive
+    uint64_t grain;    // Smallest chunk handed out
+    uint32_t parts;    // Participants, the caller included
+    uint32_t active;   // Helpers running chunks, plus Z_THPOOL_PFOR_CLOSED once the caller is done
+    uint32_t refs;     // References held by the caller and the queued helpers
+    uint32_t slot_nums; // Accumulator slots taken
+    void (*body)(uint64_t begin, uint64_t end, void *p_ctx); // parallel_for body
+    void (*reduce)(uint64_t begin, uint64_t end, void *p_acc, void *p_ctx); // parallel_reduce body
+    void *p_ctx;       // Context for the body
+    const void *p_init; // Identity value copied into every accumulator
+    uint32_t acc_size; // Size of one accumulator
+    uint32_t acc_step; // Stride between accumulators, a cache line multiple
+    uint8_t p_accs[];  // One accumulator per participant
+};
+
+// Submission counters of one shard, a producer thread always updates the same shard
+struct z_thpool_pub_stat_struct {
+    uint64_t pub_nums;                      // Tasks accepted into the queue
+    uint64_t pub_bytes;                     // Bytes queued, message headers and inline payloads
+    uint64_t full_nums;                     // Tasks refused because the queue stayed full
+    uint8_t pad[Z_THPOOL_CACHE_LINE];       // Keeps the next shard off this cache line
+};
+
+// Counters of one worker slot, only written by the thread owning the slot and summed on read
+struct z_thpool_work_stat_struct {
+    uint64_t exec_nums;                     // Callbacks run
+    uint64_t sub_bytes;                     // Bytes dequeued
+    uint64_t busy_ns;                       // Time spent running callbacks
+    uint64_t idle_ns;                       // Time spent waiting for work between two batches
+    uint64_t idle_start;                    // End of the previous batch, or the spawn time
+    uint32_t busy;                          // Whether the slot is running callbacks right now
+};
+
+// Trace event kinds
+enum z_thpool_trace_enum {
+    E_Z_THPOOL_TRACE_ENQUEUE = 0, // Producer queued nums messages
+    E_Z_THPOOL_TRACE_DEQUEUE,     // Worker took nums messages
+    E_Z_THPOOL_TRACE_START,       // Callback starts
+    E_Z_THPOOL_TRACE_END,         // Callback returned
+    E_Z_THPOOL_TRACE_PARK,        // Worker sleeps on wake_seq
+    E_Z_THPOOL_TRACE_UNPARK,      // Worker woke up
+};
+
+// One trace event
+struct z_thpool_trace_event_struct {
+    uint64_t ts;        // Trace clock reading
+    uint64_t id;        // enq_ns of the (first) message, links an enqueue to its callback
+    void (*cb)(void *); // Callback of the (first) message, NULL for park events
+    uint32_t type;      // See enum z_thpool_trace_enum
+    uint32_t nums;      // Messages covered by an enqueue or dequeue, their ids follow each other
+};
+
+// Ring of the latest trace events of one worker slot or producer shard, the oldest event is overwritten
+struct z_thpool_trace_ring_struct {
+    uint64_t head;                                // Events recorded so far
+    uint32_t mask;                                // trace_nums - 1
+    uint32_t shared;                              // Several producer threads record here, slots are claimed atomically
+    struct z_thpool_trace_event_struct *p_events; // trace_nums events
+    uint8_t pad[Z_THPOOL_CACHE_LINE];             // Keeps the next ring off this cache line
+};
+
+// Structure holding the private state of one worker thread
+struct z_thpool_worker_struct {
+    struct z_thpool_mng_struct *p_mng;  // Owning thread pool
+    struct z_thpool_msg_struct *p_msgs; // Local buffer for messages taken in one dequeue
+    uint32_t used;                      // Whether a thread currently owns this slot
+    uint32_t joinable;                  // Whether tid still has to be joined, a retired thread is joined when its slot is reused
+    void *p_stack;                      // Lowest address of this slot's stack in the arena, NULL when pthread maps the stack
+    pthread_t tid;                      // Last thread started on this slot
+    uint32_t node;                      // Queue group served first, the NUMA node of the worker
+    uint32_t pin_flag;                  // Whether cpus is applied to the thread
+    cpu_set_t cpus;                     // CPUs the thread may run on
+    struct z_hist_struct *p_hist;       // Queue wait and run time histograms of this slot, NULL when latency_flag is off
+    struct z_thpool_trace_ring_struct *p_trace; // Trace ring of this slot, NULL when tracing is off
+    uint8_t pad0[Z_THPOOL_CACHE_LINE];
+    struct z_thpool_work_stat_struct stat; // Counters of this slot
+    uint8_t pad1[Z_THPOOL_CACHE_LINE];
 };
 
 // Structure for managing the thread pool
 struct z_thpool_mng_struct {
     int32_t start_flag;                     // Flag indicating if the thread pool is started
-    struct z_kfifo_struct t_info;           // Information management for message queue
+    struct z_thpool_lane_struct *p_lanes;   // Message queue lanes, node * lane_nums + prio, prio 0 is the highest
+    uint32_t lane_nums;                     // Number of priority lanes per node
+    uint32_t node_nums;                     // Number of queue groups, one per NUMA node in use
+    uint8_t cpu_node[CPU_SETSIZE];          // Queue group of each CPU, used to route submissions
+    uint32_t cpu_policy;                    // Worker placement, see enum z_thpool_cpu_enum
+    uint32_t prio_policy;                   // Dequeue policy across lanes, see enum z_thpool_prio_enum
+    uint8_t *p_wrr_table;                   // Weighted round-robin schedule, one lane index per ticket
+    uint32_t wrr_total;                     // Number of tickets in p_wrr_table
+    uint32_t wrr_ticket;                    // Next ticket to serve
+    uint32_t queue_type;                    // Queue backend, see enum z_thpool_queue_enum
+    uint64_t th_park;                       // Workers parked on wake_seq in the low half, wakes already sent to them in the high half
+    uint32_t th_spin_nums;                  // Number of idle threads spinning or yielding before they park
+    uint32_t wake_seq;                      // Event count idle workers sleep on, bumped when work arrives for a sleeper
+    uint64_t spin_ns;                       // Time an idle worker busy-polls the queue before yielding
+    uint32_t yield_nums;                    // sched_yield rounds after spinning, before parking
+    uint64_t wake_nums;                     // Futex wake calls issued by producers
+    uint64_t wake_skip_nums;                // Wake calls skipped because no worker was parked
+    uint64_t park_nums;                     // Times a worker went to sleep on wake_seq
+    uint64_t spin_hit_nums;                 // Times spinning found work before yielding
+    uint64_t yield_hit_nums;                // Times yielding found work before parking
     int32_t th_run_flag;                    // Flag controlling thread pool run state
     uint32_t th_run_nums;                   // Number of currently running threads
-    uint32_t th_busy_nums;                  // Number of busy threads
     uint32_t max_nums;                      // Maximum number of threads allowed
+    uint32_t min_nums;                      // Threads kept alive when idle (elastic mode)
+    uint32_t idle_timeout_ms;               // Keep-alive of idle threads above min_nums, 0 disables elastic mode
+    uint32_t th_spawn_nums;                 // Number of threads started over the pool lifetime
+    uint32_t th_retire_nums;                // Number of threads retired after the keep-alive expired
     uint32_t msg_node_max;                  // Maximum number of message nodes
+    uint32_t batch_max;                     // Maximum number of messages taken per dequeue
+    struct z_thpool_worker_struct *p_workers; // Per-worker state, max_nums entries
+    uint8_t *p_batch;                         // Dequeue buffers backing p_workers[i].p_msgs
+    uint32_t msg_size;                        // Bytes per queued message, header plus inline payload room
+    uint32_t latency_flag;                    // Whether messages are timestamped for the latency histograms
+    struct z_hist_struct *p_hists;            // Two histograms per worker slot, wait then run
+    struct z_hist_struct *p_hist_sum;         // Wait and run histograms merged by z_thpool_latency_get, the pair after the worker slots
+    pthread_mutex_t hist_mutex;               // Serializes readers of p_hist_sum
+    struct z_thpool_trace_ring_struct *p_traces; // One trace ring per worker slot, then one per producer shard, NULL when tracing is off
+    struct z_thpool_trace_event_struct *p_trace_events; // Events backing p_traces
+    uint64_t trace_tick0;                     // Trace clock at creation, converted to trace_ns0 on dump
+    uint64_t trace_ns0;                       // CLOCK_MONOTONIC at creation, time zero of the trace
+    uint8_t *p_stack_map;                     // Stack arena mapping, NULL when pthread maps each stack
+    size_t stack_map_size;                    // Bytes of p_stack_map, alignment slack included
+    size_t stack_size;                        // Usable bytes of one arena stack
     pthread_mutex_t mutex;                  // Mutex for synchronization
-    pthread_cond_t cond;                    // Condition variable for thread synchronization
-    uint32_t pub_bytes;                     // Data published (for statistics)
-    uint32_t sub_bytes;                     // Data consumed (for statistics)
+    pthread_cond_t cond_space;              // Condition variable signalled when queue slots are freed
+    uint32_t pub_wait_nums;                 // Number of producers blocked on cond_space
+    pthread_cond_t cond_idle;               // Condition variable signalled when the pool drains
+    uint32_t idle_wait_nums;                // Number of callers blocked in z_thpool_wait_idle
+    pthread_cond_t cond_exit;               // Condition variable signalled when a blocked caller leaves during shutdown
+    uint64_t task_pub_nums;                 // Number of tasks accepted into the queue
+    uint64_t task_done_nums;                // Number of tasks whose callback has returned
+    struct z_thpool_task_struct *p_tasks;   // Preallocated task handles
+    uint32_t task_nums;                     // Number of preallocated task handles
+    uint64_t task_free;                     // Free list head, ABA tag << 32 | (index + 1), 0 when empty
+    uint32_t task_hold_nums;                // Task handles not yet released by their submitter, destroy waits for them
+    uint8_t pad0[Z_THPOOL_CACHE_LINE];
+    struct z_thpool_pub_stat_struct pub_stats[Z_THPOOL_STAT_SHARDS]; // Submission counters, summed on read
     struct z_thpool_config_struct t_config; // Configuration for thread pool
     char pool_name[32];                     // Name of the thread pool
 };
@@ -34,12 +247,102 @@ struct z_thpool_mng_struct {
 // Global variables for thread pool management and synchronization
 static struct z_thpool_mng_struct gs_thpool_mng = {0};
 static pthread_mutex_t gs_thpool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t gs_thpool_shard_nums = 0;     // Producer threads seen so far, hands out the stat shards
+static __thread uint32_t gs_thpool_shard = 0; // Stat shard of the calling thread plus one, 0 until its first submission
 static int32_t z_thpool_cmd(void);
 
 // Static function declarations
-static int32_t z_thpool_create_thread(pthread_t *p_pth, void *(*func)(void *), void *p_arg, uint32_t stack_size);
-static void z_thpool_msg_read(void *param);
+static int32_t z_thpool_create_thread(pthread_t *p_pth, void *(*func)(void *), void *p_arg, uint32_t stack_size, void *p_stack, const cpu_set_t *p_cpus);
+static int32_t z_thpool_stack_init(struct z_thpool_mng_struct *p_mng, struct z_thpool_config_struct *p_config);
+static void z_thpool_stack_free(struct z_thpool_mng_struct *p_mng);
+static int32_t z_thpool_ring_read(struct z_thpool_worker_struct *p_worker, struct z_thpool_msg_struct *p_msg, uint32_t nums);
+static uint32_t z_thpool_batch_nums(struct z_thpool_mng_struct *mng, uint32_t queued);
+static void z_thpool_ring_wake(struct z_thpool_mng_struct *p_mng, pthread_cond_t *p_cond, uint32_t *p_waits, uint32_t nums);
+static void z_thpool_cond_wake(pthread_cond_t *p_cond, uint32_t waits, uint32_t nums);
+static int32_t z_thpool_msg_write(struct z_thpool_mng_struct *p_mng, uint32_t prio, struct z_thpool_msg_struct *p_msg, const void *p_data, uint32_t len, int32_t block,
+                                  const struct timespec *p_deadline);
+static int32_t z_thpool_lane_init(struct z_thpool_mng_struct *p_mng, struct z_thpool_config_struct *p_config);
+static void z_thpool_lane_free(struct z_thpool_mng_struct *p_mng);
+static uint32_t z_thpool_lane_pop(struct z_thpool_mng_struct *mng, uint32_t node, struct z_thpool_msg_struct *p_msgs, uint32_t nums);
+static int32_t z_thpool_lane_push(struct z_thpool_mng_struct *mng, uint32_t prio, struct z_thpool_msg_struct *p_msg);
+static uint32_t z_thpool_lane_space(struct z_thpool_mng_struct *mng, uint32_t prio);
+static uint32_t z_thpool_queued(struct z_thpool_mng_struct *mng);
+static uint32_t z_thpool_lane_depth(struct z_thpool_mng_struct *mng, struct z_thpool_lane_struct *p_lane);
+static int32_t z_thpool_place(struct z_thpool_mng_struct *p_mng, struct z_thpool_config_struct *p_config);
+static uint32_t z_thpool_local_node(struct z_thpool_mng_struct *p_mng);
+static int32_t z_thpool_msg_read(struct z_thpool_worker_struct *p_worker);
+static int32_t z_thpool_spawn(struct z_thpool_mng_struct *p_mng);
+static void z_thpool_grow(struct z_thpool_mng_struct *p_mng, uint32_t nums);
+static void z_thpool_ring_grow(struct z_thpool_mng_struct *p_mng, uint32_t nums);
+static void z_thpool_worker_exit(struct z_thpool_worker_struct *p_worker);
+static void z_thpool_join(struct z_thpool_mng_struct *p_mng);
+static int32_t z_thpool_idle_wait(struct z_thpool_worker_struct *p_worker, const struct timespec *p_deadline);
+static void z_thpool_event_wake(struct z_thpool_mng_struct *p_mng, uint32_t nums);
+static int32_t z_thpool_futex_wait(uint32_t *p_addr, uint32_t val, const struct timespec *p_deadline);
+static void z_thpool_futex_wake(uint32_t *p_addr, int32_t nums);
+static void z_thpool_deadline(struct timespec *p_ts, uint64_t timeout_ns);
+static void z_thpool_msg_exec(struct z_thpool_worker_struct *p_worker, struct z_thpool_msg_struct *p_msgs, uint32_t nums);
+static uint64_t z_thpool_now_ns(void);
+static struct z_thpool_pub_stat_struct *z_thpool_pub_stat(struct z_thpool_mng_struct *p_mng);
+static uint64_t z_thpool_msg_stamp(struct z_thpool_mng_struct *p_mng, struct z_thpool_msg_struct *p_msg);
+static void z_thpool_trace_pub(struct z_thpool_mng_struct *p_mng, const struct z_thpool_msg_struct *p_msg, uint64_t ts, uint32_t nums);
+
+static void z_thpool_pub_count(struct z_thpool_mng_struct *p_mng, int32_t nums, uint32_t full_nums);
+static struct z_thpool_msg_struct *z_thpool_msg_at(struct z_thpool_mng_struct *mng, struct z_thpool_msg_struct *p_msgs, uint32_t i);
+static int32_t z_thpool_is_idle(struct z_thpool_mng_struct *p_mng);
+static struct z_thpool_task_struct *z_thpool_task_alloc(struct z_thpool_mng_struct *p_mng);
+static void z_thpool_task_put(struct z_thpool_task_struct *p_task);
+static void z_thpool_task_run(void *p_arg);
+static void z_thpool_task_finish(struct z_thpool_task_struct *p_task, uint32_t bits);
+static void z_thpool_task_unhold(struct z_thpool_mng_struct *p_mng);
+static void z_thpool_pfor_put(struct z_thpool_pfor_struct *p_job);
 static void *z_thpool_proc(void *param);
+static void z_thpool_pfor_helper(void *p_arg);
+
+/**
+@brief Read the trace clock, the TSC where there is one
+@return Clock ticks, converted to nanoseconds when the trace is dumped
+*/
+static inline uint64_t z_thpool_trace_now(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return z_thpool_now_ns();
+#endif
+}
+
+/**
+@brief Record one event on a trace ring
+@param p_ring Trace ring of the calling worker or producer shard
+@param ts Trace clock reading of the event
+@param type Event kind, see enum z_thpool_trace_enum
+@param id Flow id of the (first) message
+@param cb Callback of the (first) message, may be NULL
+@param nums Messages covered by the event
+@return No return value
+*/
+static inline void z_thpool_trace_rec(struct z_thpool_trace_ring_struct *p_ring, uint64_t ts, uint32_t type, uint64_t id, void (*cb)(void *), uint32_t nums) {
+    // A worker ring has one writer, only producer shards pay for a locked instruction
+    uint64_t pos = p_ring->shared ? __atomic_fetch_add(&p_ring->head, 1, __ATOMIC_RELAXED) : p_ring->head;
+    struct z_thpool_trace_event_struct *p_event = &p_ring->p_events[pos & p_ring->mask];
+
+    p_event->ts = ts;
+    p_event->id = id;
+    p_event->cb = cb;
+    p_event->type = type;
+    p_event->nums = nums;
+    if (!p_ring->shared) {
+        __atomic_store_n(&p_ring->head, pos + 1, __ATOMIC_RELEASE);
+    }
+}
+
+// Records a trace event stamped now when the ring exists, a single predictable branch while tracing is off
+#define Z_THPOOL_TRACE_REC(p_ring, ...)                                      \
+    do {                                                                     \
+        if (Z_THPOOL_TRACE && (p_ring)) {                                    \
+            z_thpool_trace_rec((p_ring), z_thpool_trace_now(), __VA_ARGS__); \
+        }                                                                    \
+    } while (0)
 
 /**
 @brief Create a new thread pool instance
@@ -51,7 +354,9 @@ int32_t z_thpool_create(struct z_thpool_config_struct *p_config, z_thpool_handle
     Z_DEBUG_ENTER();
     int32_t ret = -1;
 
-    if (!p_config || !p_handle) {
+    if (!p_config || !p_handle || p_config->queue_type > E_Z_THPOOL_QUEUE_MPMC || p_config->min_thread_nums > p_config->max_thread_nums ||
+        p_config->prio_nums > Z_THPOOL_PRIO_MAX || p_config->prio_policy > E_Z_THPOOL_PRIO_WRR || p_config->cpu_policy > E_Z_THPOOL_CPU_CORE ||
+        p_config->msg_inline_max > Z_THPOOL_INLINE_MAX) {
         goto error0;
     }
 
@@ -60,18 +365,36 @@ int32_t z_thpool_create(struct z_thpool_config_struct *p_config, z_thpool_handle
         goto error0;
     }
 
-    // Initialize mutex and condition variable
+    // Initialize mutex and condition variables, idle workers park on the wake_seq futex instead
     if (pthread_mutex_init(&p_mng->mutex, NULL) != 0) {
         goto error1;
     }
-
-    if (pthread_cond_init(&p_mng->cond, NULL) != 0) {
+    if (pthread_mutex_init(&p_mng->hist_mutex, NULL) != 0) {
         goto error2;
     }
 
-    // Initialize FIFO queue
-    ret = z_kfifo_malloc(&p_mng->t_info, sizeof(struct z_thpool_msg_struct) * p_config->msg_node_max);
+    // Producers wait with relative timeouts, measure them on the monotonic clock
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    ret = pthread_cond_init(&p_mng->cond_space, &cond_attr);
     if (ret != 0) {
+        pthread_condattr_destroy(&cond_attr);
+        ret = -1;
+        goto error8;
+    }
+
+    ret = pthread_cond_init(&p_mng->cond_idle, &cond_attr);
+    if (ret != 0) {
+        pthread_condattr_destroy(&cond_attr);
+        ret = -1;
+        goto error7;
+    }
+
+    ret = pthread_cond_init(&p_mng->cond_exit, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+    if (ret != 0) {
+        ret = -1;
         goto error3;
     }
 
@@ -81,23 +404,116 @@ int32_t z_thpool_create(struct z_thpool_config_struct *p_config, z_thpool_handle
     p_mng->pool_name[sizeof(p_mng->pool_name) - 1] = '\0';
 
     p_mng->max_nums = p_config->max_thread_nums;
+    p_mng->min_nums = p_config->min_thread_nums;
+    p_mng->idle_timeout_ms = p_config->idle_timeout_ms;
     p_mng->msg_node_max = p_config->msg_node_max;
+    p_mng->batch_max = p_config->worker_batch_max ? p_config->worker_batch_max : 1;
+    p_mng->msg_size = sizeof(struct z_thpool_msg_struct) + Z_TOOL_ALIGN_SYS(p_config->msg_inline_max);
+    p_mng->spin_ns = (uint64_t)p_config->idle_spin_us * 1000; // Widened, idle_spin_us above 4294 would wrap in 32 bits
+    p_mng->yield_nums = p_config->idle_yield_nums;
+    p_mng->latency_flag = p_config->latency_flag ? 1 : 0;
     p_mng->th_run_flag = 1;
 
-    // Create worker threads
+    // Allocate per-worker state and dequeue buffers
+    p_mng->p_workers = (struct z_thpool_worker_struct *)calloc(p_config->max_thread_nums, sizeof(struct z_thpool_worker_struct));
+    p_mng->p_batch = (uint8_t *)calloc((size_t)p_config->max_thread_nums * p_mng->batch_max, p_mng->msg_size);
+    if (!p_mng->p_workers || !p_mng->p_batch) {
+        ret = -1;
+        goto error5;
+    }
+
+    // Latency histograms are private to each worker slot so that recording needs no lock, they are merged on read
+    // into one extra pair allocated here, polling the stats then never touches the heap
+    if (p_mng->latency_flag) {
+        p_mng->p_hists = (struct z_hist_struct *)calloc(((size_t)p_config->max_thread_nums + 1) * 2, sizeof(struct z_hist_struct));
+        if (!p_mng->p_hists) {
+            ret = -1;
+            goto error5;
+        }
+        p_mng->p_hist_sum = &p_mng->p_hists[(size_t)p_config->max_thread_nums * 2];
+    }
+
+    // Trace rings follow the same split, producers record on the ring of their stat shard
+    if (Z_THPOOL_TRACE && p_config->trace_nums) {
+        uint32_t trace_nums = p_config->trace_nums;
+        if (trace_nums & (trace_nums - 1)) {
+            trace_nums = Z_TOOL_roundup_pow_of_two(trace_nums);
+        }
+        uint32_t rings = p_config->max_thread_nums + Z_THPOOL_STAT_SHARDS;
+        p_mng->p_traces = (struct z_thpool_trace_ring_struct *)calloc(rings, sizeof(struct z_thpool_trace_ring_struct));
+        p_mng->p_trace_events = (struct z_thpool_trace_event_struct *)calloc((size_t)rings * trace_nums, sizeof(struct z_thpool_trace_event_struct));
+        if (!p_mng->p_traces || !p_mng->p_trace_events) {
+            ret = -1;
+            goto error5;
+        }
+        for (uint32_t i = 0; i < rings; i++) {
+            p_mng->p_traces[i].mask = trace_nums - 1;
+            p_mng->p_traces[i].shared = i >= p_config->max_thread_nums;
+            p_mng->p_traces[i].p_events = p_mng->p_trace_events + (size_t)i * trace_nums;
+        }
+        p_mng->trace_tick0 = z_thpool_trace_now();
+        p_mng->trace_ns0 = z_thpool_now_ns();
+    }
+
     for (uint32_t i = 0; i < p_config->max_thread_nums; i++) {
-        pthread_t tid;
-        ret = z_thpool_create_thread(&tid, z_thpool_proc, p_mng, p_config->thread_stack_size);
+        p_mng->p_workers[i].p_mng = p_mng;
+        p_mng->p_workers[i].p_msgs = (struct z_thpool_msg_struct *)(p_mng->p_batch + (size_t)i * p_mng->batch_max * p_mng->msg_size);
+        p_mng->p_workers[i].p_hist = p_mng->p_hists ? &p_mng->p_hists[i * 2] : NULL;
+        p_mng->p_workers[i].p_trace = p_mng->p_traces ? &p_mng->p_traces[i] : NULL;
+    }
+
+    // Place the workers on CPUs and NUMA nodes, this decides the number of queue groups
+    ret = z_thpool_place(p_mng, p_config);
+    if (ret != 0) {
+        goto error5;
+    }
+
+    // Reserve the worker stacks in one mapping before any thread starts
+    ret = z_thpool_stack_init(p_mng, p_config);
+    if (ret != 0) {
+        goto error5;
+    }
+
+    // Initialize FIFO queues, one per priority lane and node
+    p_mng->queue_type = p_config->queue_type;
+    ret = z_thpool_lane_init(p_mng, p_config);
+    if (ret != 0) {
+        goto error5;
+    }
+
+    // Task handles cover every queued message plus the ones being run, lanes are rounded up so count what they really hold
+    p_mng->task_nums = p_config->max_thread_nums;
+    for (uint32_t i = 0; i < p_mng->node_nums * p_mng->lane_nums; i++) {
+        struct z_thpool_lane_struct *p_lane = &p_mng->p_lanes[i];
+        p_mng->task_nums += p_mng->queue_type == E_Z_THPOOL_QUEUE_MPMC ? p_lane->t_ring.size : p_lane->t_info.size / p_mng->msg_size;
+    }
+    p_mng->p_tasks = (struct z_thpool_task_struct *)calloc(p_mng->task_nums, sizeof(struct z_thpool_task_struct));
+    if (!p_mng->p_tasks) {
+        ret = -1;
+        goto error5;
+    }
+
+    for (uint32_t i = 0; i < p_mng->task_nums; i++) {
+        p_mng->p_tasks[i].p_mng = p_mng;
+        p_mng->p_tasks[i].next = (i + 1 < p_mng->task_nums) ? i + 2 : 0;
+    }
+    p_mng->task_free = p_mng->task_nums ? 1 : 0;
+
+    // Create worker threads, in elastic mode only the kept-alive ones are started up front
+    uint32_t start_nums = p_mng->idle_timeout_ms ? p_mng->min_nums : p_mng->max_nums;
+    pthread_mutex_lock(&p_mng->mutex);
+    for (uint32_t i = 0; i < start_nums; i++) {
+        ret = z_thpool_spawn(p_mng);
         if (ret != 0) {
             p_mng->th_run_flag = 0;
-            pthread_cond_broadcast(&p_mng->cond);
-            while (p_mng->th_run_nums > 0) {
-                usleep(10000);
-            }
-            goto error4;
+            __atomic_add_fetch(&p_mng->wake_seq, 1, __ATOMIC_SEQ_CST);
+            z_thpool_futex_wake(&p_mng->wake_seq, INT_MAX);
+            pthread_mutex_unlock(&p_mng->mutex);
+            z_thpool_join(p_mng);
+            goto error5;
         }
-        p_mng->th_run_nums++;
     }
+    pthread_mutex_unlock(&p_mng->mutex);
 
     p_mng->start_flag = 1;
     *p_handle = p_mng;
@@ -105,10 +521,22 @@ int32_t z_thpool_create(struct z_thpool_config_struct *p_config, z_thpool_handle
     Z_DEBUG_EXIT(0);
     return ret;
 
-error4:
-    z_kfifo_free(&p_mng->t_info);
+error5:
+    free(p_mng->p_tasks);
+    free(p_mng->p_workers);
+    free(p_mng->p_batch);
+    free(p_mng->p_hists);
+    free(p_mng->p_traces);
+    free(p_mng->p_trace_events);
+    z_thpool_lane_free(p_mng);
+    z_thpool_stack_free(p_mng);
+    pthread_cond_destroy(&p_mng->cond_exit);
 error3:
-    pthread_cond_destroy(&p_mng->cond);
+    pthread_cond_destroy(&p_mng->cond_idle);
+error7:
+    pthread_cond_destroy(&p_mng->cond_space);
+error8:
+    pthread_mutex_destroy(&p_mng->hist_mutex);
 error2:
     pthread_mutex_destroy(&p_mng->mutex);
 error1:
@@ -119,43 +547,105 @@ error0:
 }
 
 /**
-@brief Destroy a thread pool instance
+@brief Destroy a thread pool instance, queued tasks are discarded
 @param handle Handle to the thread pool to destroy
 @return Status of thread pool destruction, success is 0
 */
 int32_t z_thpool_destroy(z_thpool_handle_t handle) {
+    return z_thpool_destroy_ex(handle, E_Z_THPOOL_DESTROY_DISCARD, 0, NULL, NULL);
+}
+
+/**
+@brief Destroy a thread pool instance, draining or discarding the queued tasks
+@param handle Handle to the thread pool to destroy
+@param mode Shutdown mode, see enum z_thpool_destroy_enum
+@param timeout_ns Maximum time to drain the queue in nanoseconds, Z_THPOOL_WAIT_FOREVER to wait without limit
+@param discard Callback receiving each queued task that did not run, may be NULL
+@param p_ctx Context passed to discard
+@return Status of thread pool destruction, success is 0, -ETIMEDOUT when the drain timed out and the rest was discarded
+*/
+int32_t z_thpool_destroy_ex(z_thpool_handle_t handle, uint32_t mode, uint64_t timeout_ns, void (*discard)(void (*cb)(void *), void *p_arg, void *p_ctx), void *p_ctx) {
     Z_DEBUG_ENTER();
-    int32_t ret = -1;
+    int32_t ret = -EINVAL;
 
-    if (!handle) {
+    if (!handle || mode > E_Z_THPOOL_DESTROY_DISCARD) {
         goto error0;
     }
 
     struct z_thpool_mng_struct *p_mng = (struct z_thpool_mng_struct *)handle;
-    
+
+    // Refuse new work first, blocked producers leave with -ESHUTDOWN while the workers keep running
     pthread_mutex_lock(&p_mng->mutex);
     if (!p_mng->start_flag) {
         pthread_mutex_unlock(&p_mng->mutex);
         goto error0;
     }
+    p_mng->start_flag = 0;
+    pthread_cond_broadcast(&p_mng->cond_space);
+    pthread_mutex_unlock(&p_mng->mutex);
+
+    ret = 0;
+    if (mode == E_Z_THPOOL_DESTROY_DRAIN) {
+        ret = z_thpool_wait_idle(handle, timeout_ns);
+        ret = ret == -ETIMEDOUT ? ret : 0;
+    }
 
+    pthread_mutex_lock(&p_mng->mutex);
     p_mng->th_run_flag = 0;
-    pthread_cond_broadcast(&p_mng->cond);
+    __atomic_add_fetch(&p_mng->wake_seq, 1, __ATOMIC_SEQ_CST);
+    z_thpool_futex_wake(&p_mng->wake_seq, INT_MAX);
+    pthread_cond_broadcast(&p_mng->cond_space);
+    pthread_cond_broadcast(&p_mng->cond_idle);
     pthread_mutex_unlock(&p_mng->mutex);
 
-    // Wait for all threads to exit
-    while (p_mng->th_run_nums > 0) {
-        usleep(10000);
+    // Workers finish their current batch and exit, joining them returns as soon as the last one is gone
+    z_thpool_join(p_mng);
+
+    // Hand back what is still queued, no worker is left so the first dequeue buffer is free
+    struct z_thpool_msg_struct *p_msgs = p_mng->p_workers[0].p_msgs;
+    uint32_t nums;
+    while ((nums = z_thpool_lane_pop(p_mng, 0, p_msgs, p_mng->batch_max)) > 0) {
+        for (uint32_t i = 0; i < nums; i++) {
+            struct z_thpool_msg_struct *p_msg = z_thpool_msg_at(p_mng, p_msgs, i);
+            if (p_msg->cb == z_thpool_pfor_helper) {
+                // The parallel_for caller no longer waits for queued helpers, only their reference is left to drop
+                z_thpool_pfor_put((struct z_thpool_pfor_struct *)p_msg->p_arg);
+            } else if (p_msg->cb == z_thpool_task_run) {
+                // Complete the handle as cancelled so that its waiters wake up
+                z_thpool_task_finish((struct z_thpool_task_struct *)p_msg->p_arg, Z_THPOOL_TASK_DONE | Z_THPOOL_TASK_CANCEL);
+            } else if (discard) {
+                discard(p_msg->cb, p_msg->p_arg ? p_msg->p_arg : (void *)((struct z_thpool_slot_struct *)p_msg)->data, p_ctx);
+            }
+            if (p_msg->p_wg) {
+                z_thpool_wg_done(p_msg->p_wg);
+            }
+        }
+    }
+
+    // Blocked callers and the holders of task handles signal cond_exit on their way out, both still use the pool
+    pthread_mutex_lock(&p_mng->mutex);
+    while (p_mng->pub_wait_nums > 0 || p_mng->idle_wait_nums > 0 || p_mng->task_hold_nums > 0) {
+        pthread_cond_wait(&p_mng->cond_exit, &p_mng->mutex);
     }
+    pthread_mutex_unlock(&p_mng->mutex);
 
     // Cleanup resources
-    z_kfifo_free(&p_mng->t_info);
+    free(p_mng->p_tasks);
+    free(p_mng->p_workers);
+    free(p_mng->p_batch);
+    free(p_mng->p_hists);
+    free(p_mng->p_traces);
+    free(p_mng->p_trace_events);
+    z_thpool_lane_free(p_mng);
+    z_thpool_stack_free(p_mng);
     pthread_mutex_destroy(&p_mng->mutex);
-    pthread_cond_destroy(&p_mng->cond);
+    pthread_mutex_destroy(&p_mng->hist_mutex);
+    pthread_cond_destroy(&p_mng->cond_space);
+    pthread_cond_destroy(&p_mng->cond_idle);
+    pthread_cond_destroy(&p_mng->cond_exit);
     free(p_mng);
 
-    ret = 0;
-    Z_DEBUG_EXIT(0);
+    Z_DEBUG_EXIT(ret);
     return ret;
 
 error0:
@@ -164,185 +654,3322 @@ error0:
 }
 
 /**
-@brief Create a thread, set its attributes, and start it
-@param p_pth Pointer to the thread ID
-@param func Function to be executed by the thread
-@param p_arg Argument passed to the function
-@param stack_size Stack size for the thread
-@return Status of thread creation, success is 0
+@brief Allocate the priority lanes and build the weighted round-robin schedule
+@param p_mng Pointer to the thread pool management structure
+@param p_config Configuration parameters for the thread pool
+@return Status, success is 0
 */
-static int32_t z_thpool_create_thread(pthread_t *p_pth, void *(*func)(void *), void *p_arg, uint32_t stack_size) {
-    int32_t ret;
-    pthread_attr_t attr;
+static int32_t z_thpool_lane_init(struct z_thpool_mng_struct *p_mng, struct z_thpool_config_struct *p_config) {
+    p_mng->lane_nums = p_config->prio_nums ? p_config->prio_nums : 1;
+    p_mng->prio_policy = p_config->prio_policy;
+    p_mng->p_lanes = (struct z_thpool_lane_struct *)calloc(p_mng->node_nums * p_mng->lane_nums, sizeof(struct z_thpool_lane_struct));
+    if (!p_mng->p_lanes) {
+        return -1;
+    }
 
-    pthread_attr_init(&attr);
+    p_mng->wrr_total = 0;
+    for (uint32_t i = 0; i < p_mng->node_nums * p_mng->lane_nums; i++) {
+        struct z_thpool_lane_struct *p_lane = &p_mng->p_lanes[i];
+        uint32_t prio = i % p_mng->lane_nums;
+        int32_t ret;
 
-    // Set the thread to be detached
-    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-    pthread_attr_setstacksize(&attr, stack_size);
+        if (p_mng->queue_type == E_Z_THPOOL_QUEUE_MPMC) {
+            ret = z_mpmc_malloc(&p_lane->t_ring, p_config->msg_node_max, p_mng->msg_size);
+        } else {
+            ret = z_kfifo_malloc(&p_lane->t_info, p_mng->msg_size * p_config->msg_node_max);
+        }
+        if (ret != 0) {
+            z_thpool_lane_free(p_mng);
+            return -1;
+        }
 
-#ifndef CFG_PLATFORM_X86
-    // Set explicit scheduling if not on X86 platform
-    ret = pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
-    if (ret) {
-        fprintf(stderr, "pthread_attr_setinheritsched:%d\n", ret);
-        goto error;
+        // Higher priority lanes get more tickets by default
+        p_lane->weight = p_config->prio_weight[prio] ? p_config->prio_weight[prio] : p_mng->lane_nums - prio;
+        p_lane->weight = Z_TOOL_MIN(p_lane->weight, Z_THPOOL_PRIO_WEIGHT_MAX);
+        if (i < p_mng->lane_nums) {
+            p_mng->wrr_total += p_lane->weight;
+        }
     }
-#endif
 
-    // Create the thread with specified attributes
-    ret = pthread_create(p_pth, &attr, func, p_arg);
-    if (ret) {
-        fprintf(stderr, "pthread_create:%d\n", ret);
-        goto error;
+    p_mng->p_wrr_table = (uint8_t *)malloc(p_mng->wrr_total);
+    if (!p_mng->p_wrr_table) {
+        z_thpool_lane_free(p_mng);
+        return -1;
     }
 
-error:
-    // Clean up thread attributes
-    pthread_attr_destroy(&attr);
-    return ret;
+    // Smooth weighted round-robin, spreads each lane's tickets evenly over the round
+    int32_t current[Z_THPOOL_PRIO_MAX] = {0};
+    for (uint32_t t = 0; t < p_mng->wrr_total; t++) {
+        uint32_t best = 0;
+        for (uint32_t i = 0; i < p_mng->lane_nums; i++) {
+            current[i] += p_mng->p_lanes[i].weight;
+            if (current[i] > current[best]) {
+                best = i;
+            }
+        }
+        current[best] -= p_mng->wrr_total;
+        p_mng->p_wrr_table[t] = best;
+    }
+    return 0;
 }
 
 /**
-@brief Read and process messages from the message queue
-@param param Pointer to the thread pool management structure
+@brief Free the priority lanes
+@param p_mng Pointer to the thread pool management structure
 @return No return value
 */
-static void z_thpool_msg_read(void *param) {
-    struct z_thpool_mng_struct *mng = (struct z_thpool_mng_struct *)param;
-    struct z_thpool_msg_struct msg;
-
-    pthread_mutex_lock(&mng->mutex);
-    while (mng->th_run_flag && z_kfifo_data_len(&mng->t_info) < sizeof(struct z_thpool_msg_struct)) {
-        pthread_cond_wait(&mng->cond, &mng->mutex);
+static void z_thpool_lane_free(struct z_thpool_mng_struct *p_mng) {
+    if (p_mng->p_lanes) {
+        for (uint32_t i = 0; i < p_mng->node_nums * p_mng->lane_nums; i++) {
+            z_kfifo_free(&p_mng->p_lanes[i].t_info);
+            z_mpmc_free(&p_mng->p_lanes[i].t_ring);
+        }
     }
+    free(p_mng->p_lanes);
+    free(p_mng->p_wrr_table);
+    p_mng->p_lanes = NULL;
+    p_mng->p_wrr_table = NULL;
+}
 
-    if (mng->th_run_flag == 0 || z_kfifo_data_len(&mng->t_info) < sizeof(struct z_thpool_msg_struct)) {
-        pthread_mutex_unlock(&mng->mutex);
-        return;
-    }
+/**
+@brief Take up to nums messages from the lanes according to the priority policy, in kfifo mode the caller must hold the mutex
+@param mng Pointer to the thread pool management structure
+@param node Node whose lanes are served first at each priority
+@param p_msgs Message buffer to fill
+@param nums Maximum number of messages to take
+@return Number of messages taken, all from the same lane
+*/
+static uint32_t z_thpool_lane_pop(struct z_thpool_mng_struct *mng, uint32_t node, struct z_thpool_msg_struct *p_msgs, uint32_t nums) {
+    uint32_t first = 0;
+    uint32_t got = 0;
 
-    // Retrieve message from the queue
-    uint32_t len = z_kfifo_out(&mng->t_info, &msg, sizeof(struct z_thpool_msg_struct));
-    mng->th_busy_nums++;
-    mng->sub_bytes += len;
-    pthread_mutex_unlock(&mng->mutex);
+    if (mng->prio_policy == E_Z_THPOOL_PRIO_WRR && mng->lane_nums > 1) {
+        first = mng->p_wrr_table[__atomic_fetch_add(&mng->wrr_ticket, 1, __ATOMIC_RELAXED) % mng->wrr_total];
+    }
 
-    // Execute the callback function for the message
-    msg.cb(msg.p_arg);
+    // Serve the scheduled lane first, then fall back to the others in priority order
+    for (uint32_t i = 0; i <= mng->lane_nums && got == 0; i++) {
+        uint32_t prio = i ? i - 1 : first;
+        if (i && prio == first) {
+            continue;
+        }
 
-    pthread_mutex_lock(&mng->mutex);
-    mng->th_busy_nums--;
-    pthread_mutex_unlock(&mng->mutex);
+        // Local node first, then the other nodes so that no queue is left unserved
+        for (uint32_t n = 0; n < mng->node_nums && got == 0; n++) {
+            struct z_thpool_lane_struct *p_lane = &mng->p_lanes[((node + n) % mng->node_nums) * mng->lane_nums + prio];
+            if (mng->queue_type == E_Z_THPOOL_QUEUE_MPMC) {
+                got = z_mpmc_out(&p_lane->t_ring, p_msgs, nums);
+            } else {
+                got = z_kfifo_out(&p_lane->t_info, p_msgs, nums * mng->msg_size) / mng->msg_size;
+            }
+            if (got) {
+                __atomic_add_fetch(&p_lane->deq_nums, got, __ATOMIC_RELAXED);
+            }
+        }
+    }
+    return got;
 }
 
 /**
-@brief Thread pool processing function
-@param param Pointer to the thread pool management structure
-@return No return value
+@brief Put one message into a lane of the given priority, the submitter's node first, in kfifo mode the caller must hold the mutex
+@param mng Pointer to the thread pool management structure
+@param prio Priority lane
+@param p_msg Message to enqueue, msg_size bytes
+@return 0 on success, -1 when the lanes of this priority are full on every node
 */
-static void *z_thpool_proc(void *param) {
-    prctl(PR_SET_NAME, "thp");
-    struct z_thpool_mng_struct *mng = (struct z_thpool_mng_struct *)param;
+static int32_t z_thpool_lane_push(struct z_thpool_mng_struct *mng, uint32_t prio, struct z_thpool_msg_struct *p_msg) {
+    uint32_t node = z_thpool_local_node(mng);
 
-    // Continue processing messages as long as the run flag is set
-    while (mng->th_run_flag) {
-        z_thpool_msg_read(mng);
+    for (uint32_t n = 0; n < mng->node_nums; n++) {
+        struct z_thpool_lane_struct *p_lane = &mng->p_lanes[((node + n) % mng->node_nums) * mng->lane_nums + prio];
+        if (mng->queue_type == E_Z_THPOOL_QUEUE_MPMC) {
+            if (z_mpmc_in(&p_lane->t_ring, p_msg, 1) == 1) {
+                return 0;
+            }
+        } else if (z_kfifo_space(&p_lane->t_info) >= mng->msg_size) {
+            z_kfifo_in(&p_lane->t_info, p_msg, mng->msg_size);
+            return 0;
+        }
     }
-
-    // Decrement the run number after processing is complete
-    pthread_mutex_lock(&mng->mutex);
-    mng->th_run_nums--;
-    pthread_mutex_unlock(&mng->mutex);
-    return NULL;
+    return -1;
 }
 
 /**
-@brief Add a work task to the thread pool
-@param handle Handle to the thread pool
-@param cb Callback function
-@param p_arg Argument for the callback function
-@return Status, success is 0
+@brief Count the free slots of one priority over all nodes, in kfifo mode the caller must hold the mutex
+@param mng Pointer to the thread pool management structure
+@param prio Priority lane
+@return Number of messages that still fit
 */
-int32_t z_thpool_add_work(z_thpool_handle_t handle, void (*cb)(void *), void *p_arg) {
-    if (!handle || !cb || !p_arg) {
-        return -EINVAL;
+static uint32_t z_thpool_lane_space(struct z_thpool_mng_struct *mng, uint32_t prio) {
+    uint32_t space = 0;
+
+    for (uint32_t n = 0; n < mng->node_nums; n++) {
+        struct z_thpool_lane_struct *p_lane = &mng->p_lanes[n * mng->lane_nums + prio];
+        if (mng->queue_type == E_Z_THPOOL_QUEUE_MPMC) {
+            space += z_mpmc_space(&p_lane->t_ring);
+        } else {
+            space += z_kfifo_space(&p_lane->t_info) / mng->msg_size;
+        }
     }
+    return space;
+}
 
-    struct z_thpool_mng_struct *p_mng = (struct z_thpool_mng_struct *)handle;
-    int32_t ret = -1;
+/**
+@brief Count the messages queued over all lanes, in kfifo mode the caller must hold the mutex
+@param mng Pointer to the thread pool management structure
+@return Number of queued messages
+*/
+static uint32_t z_thpool_queued(struct z_thpool_mng_struct *mng) {
+    uint32_t queued = 0;
 
-    pthread_mutex_lock(&p_mng->mutex);
-    if (!p_mng->start_flag) {
-        goto error;
+    for (uint32_t i = 0; i < mng->node_nums * mng->lane_nums; i++) {
+        if (mng->queue_type == E_Z_THPOOL_QUEUE_MPMC) {
+            queued += z_mpmc_data_len(&mng->p_lanes[i].t_ring);
+        } else {
+            queued += z_kfifo_data_len(&mng->p_lanes[i].t_info) / mng->msg_size;
+        }
     }
+    return queued;
+}
 
-    if (z_kfifo_space(&p_mng->t_info) < sizeof(struct z_thpool_msg_struct)) {
-        goto error;
-    }
+/**
+@brief Parse a kernel style CPU list such as "0-3,8,10-11"
+@param p_list CPU list string, may end with a newline
+@param p_set CPU set to fill
+@return Number of CPUs in the list, -1 on a syntax error
+*/
+static int32_t z_thpool_cpulist_parse(const char *p_list, cpu_set_t *p_set) {
+    const char *p = p_list;
 
-    struct z_thpool_msg_struct msg;
-    msg.cb = cb;
-    msg.p_arg = p_arg;
+    CPU_ZERO(p_set);
+    while (*p && *p != '\n') {
+        char *p_end;
+        unsigned long first = strtoul(p, &p_end, 10);
+        unsigned long last = first;
+        if (p_end == p) {
+            return -1;
+        }
 
-    uint32_t len = z_kfifo_in(&p_mng->t_info, &msg, sizeof(struct z_thpool_msg_struct));
-    if (len != sizeof(struct z_thpool_msg_struct)) {
-        goto error;
+        p = p_end;
+        if (*p == '-') {
+            last = strtoul(p + 1, &p_end, 10);
+            if (p_end == p + 1 || last < first) {
+                return -1;
+            }
+            p = p_end;
+        }
+
+        for (unsigned long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, p_set);
+        }
+        if (*p == ',') {
+            p++;
+        } else if (*p && *p != '\n') {
+            return -1;
+        }
     }
+    return CPU_COUNT(p_set);
+}
 
-    p_mng->pub_bytes += len;
-    pthread_cond_signal(&p_mng->cond);
-    ret = 0;
+/**
+@brief Read a CPU list file from sysfs
+@param p_path File path
+@param p_set CPU set to fill
+@return Number of CPUs in the list, -1 when the file cannot be read or parsed
+*/
+static int32_t z_thpool_cpulist_read(const char *p_path, cpu_set_t *p_set) {
+    char buf[1024];
+    FILE *fp = fopen(p_path, "r");
 
-error:
-    pthread_mutex_unlock(&p_mng->mutex);
-    return ret;
+    if (!fp) {
+        return -1;
+    }
+    if (!fgets(buf, sizeof(buf), fp)) {
+        buf[0] = '\0';
+    }
+    fclose(fp);
+    return z_thpool_cpulist_parse(buf, p_set);
 }
 
 /**
-@brief Display thread pool status
-@param handle Handle to the thread pool
-@return Status, success is 0
+@brief Discover the NUMA nodes and their CPUs from sysfs
+@param p_nodes CPU set of each node, in ascending node id order
+@param max Maximum number of nodes to report
+@return Number of nodes found, 0 when the topology is not available
 */
-int32_t z_thpool_cmd_shell_show(z_thpool_handle_t handle) {
-    if (!handle) {
-        return -EINVAL;
+static uint32_t z_thpool_numa_probe(cpu_set_t *p_nodes, uint32_t max) {
+    uint32_t ids[Z_THPOOL_NODE_MAX];
+    uint32_t nums = 0;
+    struct dirent *p_ent;
+    char path[128];
+
+    DIR *p_dir = opendir(Z_THPOOL_NODE_PATH);
+    if (!p_dir) {
+        return 0;
     }
 
-    struct z_thpool_mng_struct *p_mng = (struct z_thpool_mng_struct *)handle;
-    pthread_mutex_lock(&p_mng->mutex);
+    // Node ids may be sparse, keep them sorted so that the group order is stable
+    while ((p_ent = readdir(p_dir)) != NULL && nums < max) {
+        uint32_t id;
+        char tail;
+        if (sscanf(p_ent->d_name, "node%u%c", &id, &tail) != 1) {
+            continue;
+        }
 
-    z_table_print_title("z_thpool module");
-    z_table_print_row("%-18s %s\n", "Ver: ", Z_THPOOL_VERION);
-    z_table_print_row("%-18s %s\n", "Pool Name: ", p_mng->pool_name);
-    z_table_print_border();
-    z_table_print_row("%-18s %d\n", "max nums: ", p_mng->max_nums);
-    z_table_print_row("%-18s %d\n", "create nums: ", p_mng->th_run_nums);
-    z_table_print_row("%-18s %d\n", "busy nums:", p_mng->th_busy_nums);
-    z_table_print_row("%-18s %d\n", "max cache nums:", p_mng->msg_node_max);
-    z_table_print_row("%-18s %d\n", "use cache nums:", 
-        z_kfifo_data_len(&p_mng->t_info) / sizeof(struct z_thpool_msg_struct));
-    z_table_print_row("%-18s %d\n", "pub_bytes:", p_mng->pub_bytes);
-    z_table_print_row("%-18s %d\n", "sub_bytes:", p_mng->sub_bytes);
+        uint32_t pos = nums++;
+        while (pos > 0 && ids[pos - 1] > id) {
+            ids[pos] = ids[pos - 1];
+            pos--;
+        }
+        ids[pos] = id;
+    }
+    closedir(p_dir);
 
-    pthread_mutex_unlock(&p_mng->mutex);
-    return 0;
+    uint32_t found = 0;
+    for (uint32_t i = 0; i < nums; i++) {
+        snprintf(path, sizeof(path), Z_THPOOL_NODE_PATH "/node%u/cpulist", ids[i]);
+        if (z_thpool_cpulist_read(path, &p_nodes[found]) > 0) {
+            found++; // Memory-only nodes have no CPUs and get no queue
+        }
+    }
+    return found;
 }
 
 /**
-@brief Task callback function
-@param p_arg Parameter
+@brief Keep one hardware thread per physical core
+@param p_cpus Candidate CPUs
+@param p_cores CPU set to fill with the lowest candidate thread of each core
 @return No return value
 */
-static void z_thpool_test_task_cb(void *p_arg) {
-    int32_t num = *((int32_t *)p_arg);
-    printf("Task %d is being processed by thread %lu\n", num, pthread_self());
-    sleep(1); // Simulate task processing time
+static void z_thpool_core_leaders(const cpu_set_t *p_cpus, cpu_set_t *p_cores) {
+    char path[128];
+
+    CPU_ZERO(p_cores);
+    for (uint32_t cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        cpu_set_t siblings;
+        if (!CPU_ISSET(cpu, p_cpus)) {
+            continue;
+        }
+
+        // Without topology information every CPU counts as a core of its own
+        snprintf(path, sizeof(path), Z_THPOOL_CPU_PATH "/cpu%u/topology/thread_siblings_list", cpu);
+        if (z_thpool_cpulist_read(path, &siblings) > 0) {
+            uint32_t first = cpu;
+            CPU_AND(&siblings, &siblings, p_cpus);
+            for (uint32_t i = 0; i < cpu; i++) {
+                if (CPU_ISSET(i, &siblings)) {
+                    first = i;
+                    break;
+                }
+            }
+            if (first != cpu) {
+                continue;
+            }
+        }
+        CPU_SET(cpu, p_cores);
+    }
 }
 
 /**
-@brief Test the thread pool functionality
-@return Status, success is 0
+@brief Decide the queue groups and the CPUs of every worker slot from the configuration and the machine topology
+@param p_mng Pointer to the thread pool management structure
+@param p_config Configuration parameters for the thread pool
+@return Status, success is 0, -1 when the CPU list is invalid or empty
+*/
+static int32_t z_thpool_place(struct z_thpool_mng_struct *p_mng, struct z_thpool_config_struct *p_config) {
+    cpu_set_t nodes[Z_THPOOL_NODE_MAX];
+    cpu_set_t allowed;
+    cpu_set_t cores;
+    uint32_t node_nums = 0;
+
+    p_mng->cpu_policy = p_config->cpu_policy;
+    p_mng->node_nums = 1;
+    memset(p_mng->cpu_node, 0, sizeof(p_mng->cpu_node));
+    if (p_config->cpu_policy == E_Z_THPOOL_CPU_NONE && !p_config->numa_flag) {
+        return 0;
+    }
+
+    // Candidate CPUs are the configured list, or whatever the process is allowed to run on
+    if (p_config->cpu_list[0]) {
+        if (z_thpool_cpulist_parse(p_config->cpu_list, &allowed) <= 0) {
+            return -1;
+        }
+    } else if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return -1;
+    }
+
+    // One queue group per NUMA node holding candidate CPUs, all CPUs of the node route their submissions to it
+    if (p_config->numa_flag) {
+        uint32_t probe = z_thpool_numa_probe(nodes, Z_THPOOL_NODE_MAX);
+        for (uint32_t i = 0; i < probe; i++) {
+            cpu_set_t cpus;
+            CPU_AND(&cpus, &nodes[i], &allowed);
+            if (CPU_COUNT(&cpus) == 0) {
+                continue;
+            }
+
+            for (uint32_t cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                if (CPU_ISSET(cpu, &nodes[i])) {
+                    p_mng->cpu_node[cpu] = node_nums;
+                }
+            }
+            nodes[node_nums++] = cpus;
+        }
+    }
+    if (node_nums == 0) {
+        nodes[0] = allowed;
+        node_nums = 1;
+    }
+    p_mng->node_nums = node_nums;
+
+    if (p_config->cpu_policy == E_Z_THPOOL_CPU_CORE) {
+        z_thpool_core_leaders(&allowed, &cores);
+    }
+
+    // Workers are dealt round-robin over the nodes, and over the cores of their node in core mode
+    for (uint32_t i = 0; i < p_mng->max_nums; i++) {
+        struct z_thpool_worker_struct *p_worker = &p_mng->p_workers[i];
+        p_worker->node = i % node_nums;
+        p_worker->pin_flag = 1;
+        p_worker->cpus = nodes[p_worker->node];
+
+        if (p_config->cpu_policy == E_Z_THPOOL_CPU_CORE) {
+            cpu_set_t node_cores;
+            CPU_AND(&node_cores, &nodes[p_worker->node], &cores);
+            uint32_t pick = (i / node_nums) % CPU_COUNT(&node_cores);
+
+            CPU_ZERO(&p_worker->cpus);
+            for (uint32_t cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                if (CPU_ISSET(cpu, &node_cores) && pick-- == 0) {
+                    CPU_SET(cpu, &p_worker->cpus);
+                    break;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+@brief Find the queue group of the calling thread
+@param p_mng Pointer to the thread pool management structure
+@return Queue group of the CPU the caller runs on, 0 when NUMA routing is off
+*/
+static uint32_t z_thpool_local_node(struct z_thpool_mng_struct *p_mng) {
+    if (p_mng->node_nums == 1) {
+        return 0;
+    }
+
+    int32_t cpu = sched_getcpu();
+    return (cpu >= 0 && cpu < CPU_SETSIZE) ? p_mng->cpu_node[cpu] : 0;
+}
+
+/**
+@brief Create a thread, set its attributes, and start it
+@param p_pth Pointer to the thread ID
+@param func Function to be executed by the thread
+@param p_arg Argument passed to the function
+@param stack_size Stack size for the thread
+@param p_stack Lowest address of a stack_size bytes caller-owned stack, NULL lets pthread map one
+@param p_cpus CPUs the thread may run on, NULL leaves the affinity inherited
+@return Status of thread creation, success is 0
+*/
+static int32_t z_thpool_create_thread(pthread_t *p_pth, void *(*func)(void *), void *p_arg, uint32_t stack_size, void *p_stack, const cpu_set_t *p_cpus) {
+    int32_t ret;
+    pthread_attr_t attr;
+
+    pthread_attr_init(&attr);
+
+    // Keep the thread joinable, shutdown joins it instead of polling the run count
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+    if (p_stack) {
+        // The arena provides the guard page, pthread adds none to a caller-owned stack
+        ret = pthread_attr_setstack(&attr, p_stack, stack_size);
+        if (ret) {
+            fprintf(stderr, "pthread_attr_setstack:%d\n", ret);
+            goto error;
+        }
+    } else {
+        pthread_attr_setstacksize(&attr, stack_size);
+    }
+
+    // Pin before the thread starts, so it never runs or allocates on a foreign node
+    if (p_cpus) {
+        ret = pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), p_cpus);
+        if (ret) {
+            fprintf(stderr, "pthread_attr_setaffinity_np:%d\n", ret);
+            goto error;
+        }
+    }
+
+#ifndef CFG_PLATFORM_X86
+    // Set explicit scheduling if not on X86 platform
+    ret = pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    if (ret) {
+        fprintf(stderr, "pthread_attr_setinheritsched:%d\n", ret);
+        goto error;
+    }
+#endif
+
+    // Create the thread with specified attributes
+    ret = pthread_create(p_pth, &attr, func, p_arg);
+    if (ret) {
+        fprintf(stderr, "pthread_create:%d\n", ret);
+        goto error;
+    }
+
+error:
+    // Clean up thread attributes
+    pthread_attr_destroy(&attr);
+    return ret;
+}
+
+/**
+@brief Reserve one mapping holding the stacks of every worker slot, each stack sits right above an inaccessible guard
+@param p_mng Pointer to the thread pool management structure
+@param p_config Configuration of the pool, thread_stack_size and stack_flags are used
+@return Status, success is 0, nothing is mapped when stack_flags lacks E_Z_THPOOL_STACK_ARENA
+*/
+static int32_t z_thpool_stack_init(struct z_thpool_mng_struct *p_mng, struct z_thpool_config_struct *p_config) {
+    if (!(p_config->stack_flags & E_Z_THPOOL_STACK_ARENA)) {
+        return 0;
+    }
+
+    // With huge pages each stack covers whole 2MB pages and the guard is a 2MB hole, a smaller guard would split the page below it
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t unit = (p_config->stack_flags & E_Z_THPOOL_STACK_HUGE) ? Z_THPOOL_HUGE_SIZE : page;
+    size_t stack_size = Z_TOOL_MAX((size_t)p_config->thread_stack_size, (size_t)PTHREAD_STACK_MIN);
+    stack_size = (stack_size + unit - 1) & ~(unit - 1);
+    if (stack_size > UINT32_MAX) {
+        return -1;
+    }
+
+    // Stacks grow down, slot i is [guard][stack] at i * stride, one more unit of slack aligns the start
+    size_t stride = unit + stack_size;
+    p_mng->stack_map_size = stride * p_config->max_thread_nums + unit;
+    p_mng->p_stack_map = (uint8_t *)mmap(NULL, p_mng->stack_map_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p_mng->p_stack_map == MAP_FAILED) {
+        p_mng->p_stack_map = NULL;
+        return -1;
+    }
+    p_mng->stack_size = stack_size;
+
+    uint8_t *p_base = (uint8_t *)(((uintptr_t)p_mng->p_stack_map + unit - 1) & ~(uintptr_t)(unit - 1));
+    for (uint32_t i = 0; i < p_config->max_thread_nums; i++) {
+        uint8_t *p_stack = p_base + (size_t)i * stride + unit;
+        if (mprotect(p_stack, stack_size, PROT_READ | PROT_WRITE) != 0) {
+            z_thpool_stack_free(p_mng);
+            return -1;
+        }
+        p_mng->p_workers[i].p_stack = p_stack;
+    }
+
+    // Both are hints, a kernel without THP or a stack that is never touched keeps the pool working
+    if (p_config->stack_flags & E_Z_THPOOL_STACK_HUGE) {
+        madvise(p_base, stride * p_config->max_thread_nums, MADV_HUGEPAGE);
+    }
+    if (p_config->stack_flags & E_Z_THPOOL_STACK_PREFAULT) {
+        for (uint32_t i = 0; i < p_config->max_thread_nums; i++) {
+            volatile uint8_t *p_stack = (volatile uint8_t *)p_mng->p_workers[i].p_stack;
+            for (size_t off = 0; off < stack_size; off += page) {
+                p_stack[off] = 0;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+@brief Unmap the stack arena, every worker must have been joined
+@param p_mng Pointer to the thread pool management structure
+@return No return value
+*/
+static void z_thpool_stack_free(struct z_thpool_mng_struct *p_mng) {
+    if (p_mng->p_stack_map) {
+        munmap(p_mng->p_stack_map, p_mng->stack_map_size);
+        p_mng->p_stack_map = NULL;
+    }
+    for (uint32_t i = 0; p_mng->p_workers && i < p_mng->max_nums; i++) {
+        p_mng->p_workers[i].p_stack = NULL;
+    }
+}
+
+/**
+@brief Read and process messages from the message queue
+@param p_worker Pointer to the calling worker's state
+@return 0 to keep running, -1 when the worker has retired and released its slot
+*/
+static int32_t z_thpool_msg_read(struct z_thpool_worker_struct *p_worker) {
+    struct z_thpool_mng_struct *mng = p_worker->p_mng;
+    struct z_thpool_msg_struct *p_msgs = p_worker->p_msgs;
+    struct timespec deadline;
+    int32_t ret = 0;
+    uint32_t nums;
+
+    if (mng->queue_type == E_Z_THPOOL_QUEUE_MPMC) {
+        ret = z_thpool_ring_read(p_worker, p_msgs, z_thpool_batch_nums(mng, z_thpool_queued(mng)));
+        if (ret <= 0) {
+            return ret;
+        }
+        nums = ret;
+
+        // Let producers blocked on a full ring know that slots were freed, any of them may wait on this lane
+        z_thpool_ring_wake(mng, &mng->cond_space, &mng->pub_wait_nums, mng->node_nums * mng->lane_nums > 1 ? UINT32_MAX : nums);
+
+        z_thpool_msg_exec(p_worker, p_msgs, nums);
+        return 0;
+    }
+
+    pthread_mutex_lock(&mng->mutex);
+    if (mng->idle_timeout_ms) {
+        z_thpool_deadline(&deadline, (uint64_t)mng->idle_timeout_ms * 1000000ULL);
+    }
+
+    while (mng->th_run_flag && z_thpool_queued(mng) == 0) {
+        if (ret == ETIMEDOUT && mng->th_run_nums > mng->min_nums) {
+            // Keep-alive expired with nothing to do, retire this worker
+            mng->th_retire_nums++;
+            z_thpool_worker_exit(p_worker);
+            pthread_mutex_unlock(&mng->mutex);
+            return -1;
+        }
+
+        ret = z_thpool_idle_wait(p_worker, &deadline);
+    }
+
+    uint32_t queued = z_thpool_queued(mng);
+    if (mng->th_run_flag == 0 || queued == 0) {
+        pthread_mutex_unlock(&mng->mutex);
+        return 0;
+    }
+
+    // Retrieve a batch of messages from the queue
+    nums = z_thpool_lane_pop(mng, p_worker->node, p_msgs, z_thpool_batch_nums(mng, queued));
+    z_thpool_cond_wake(&mng->cond_space, mng->pub_wait_nums, mng->node_nums * mng->lane_nums > 1 ? UINT32_MAX : nums);
+    pthread_mutex_unlock(&mng->mutex);
+
+    // Execute the callback functions back-to-back
+    z_thpool_msg_exec(p_worker, p_msgs, nums);
+    return 0;
+}
+
+/**
+@brief Run dequeued messages back-to-back and publish their completion
+@param p_worker Pointer to the calling worker's state
+@param p_msgs Messages taken from the queue
+@param nums Number of messages
+@return No return value
+*/
+static void z_thpool_msg_exec(struct z_thpool_worker_struct *p_worker, struct z_thpool_msg_struct *p_msgs, uint32_t nums) {
+    struct z_thpool_mng_struct *mng = p_worker->p_mng;
+    struct z_thpool_work_stat_struct *p_stat = &p_worker->stat;
+    struct z_hist_struct *p_hist = p_worker->p_hist;
+    struct z_thpool_trace_ring_struct *p_trace = Z_THPOOL_TRACE ? p_worker->p_trace : NULL;
+    uint64_t begin = z_thpool_now_ns();
+    uint64_t start = begin;
+
+    Z_THPOOL_TRACE_REC(p_trace, E_Z_THPOOL_TRACE_DEQUEUE, p_msgs->enq_ns, p_msgs->cb, nums);
+
+    // Only this thread writes the slot counters, relaxed stores let readers sum them without the mutex
+    __atomic_store_n(&p_stat->busy, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&p_stat->idle_ns, p_stat->idle_ns + (begin - p_stat->idle_start), __ATOMIC_RELAXED);
+
+    for (uint32_t i = 0; i < nums; i++) {
+        struct z_thpool_msg_struct *p_msg = z_thpool_msg_at(mng, p_msgs, i);
+
+        // Inline payloads are handed over in place, they stay valid until the worker's next dequeue
+        Z_THPOOL_TRACE_REC(p_trace, E_Z_THPOOL_TRACE_START, p_msg->enq_ns, p_msg->cb, 1);
+        p_msg->cb(p_msg->p_arg ? p_msg->p_arg : (void *)((struct z_thpool_slot_struct *)p_msg)->data);
+        if (p_msg->p_wg) {
+            z_thpool_wg_done(p_msg->p_wg);
+        }
+        Z_THPOOL_TRACE_REC(p_trace, E_Z_THPOOL_TRACE_END, p_msg->enq_ns, NULL, 1);
+
+        // One clock read per message, the end of a callback is the start of the next one in the batch
+        if (p_hist) {
+            uint64_t end = z_thpool_now_ns();
+            z_hist_record(&p_hist[0], start > p_msg->enq_ns ? start - p_msg->enq_ns : 0);
+            z_hist_record(&p_hist[1], end - start);
+            start = end;
+        }
+    }
+
+    uint64_t end = p_hist ? start : z_thpool_now_ns();
+    p_stat->idle_start = end;
+    __atomic_store_n(&p_stat->busy_ns, p_stat->busy_ns + (end - begin), __ATOMIC_RELAXED);
+    __atomic_store_n(&p_stat->sub_bytes, p_stat->sub_bytes + (uint64_t)nums * mng->msg_size, __ATOMIC_RELAXED);
+    __atomic_store_n(&p_stat->exec_nums, p_stat->exec_nums + nums, __ATOMIC_RELEASE); // Pairs with the fence in z_thpool_stat_sum
+    __atomic_store_n(&p_stat->busy, 0, __ATOMIC_RELAXED);
+
+    // Full barrier orders the completion before the waiter check, pairs with z_thpool_wait_idle
+    __atomic_add_fetch(&mng->task_done_nums, nums, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&mng->idle_wait_nums, __ATOMIC_RELAXED) && z_thpool_is_idle(mng)) {
+        pthread_mutex_lock(&mng->mutex);
+        pthread_cond_broadcast(&mng->cond_idle);
+        pthread_mutex_unlock(&mng->mutex);
+    }
+}
+
+/**
+@brief Read the monotonic clock used for latency timestamps
+@return Current CLOCK_MONOTONIC time in nanoseconds
+*/
+static uint64_t z_thpool_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+@brief Stamp a message about to be queued, with the latency clock and the trace clock as enabled
+@param p_mng Pointer to the thread pool management structure
+@param p_msg Message to stamp
+@return Trace clock reading for the enqueue event, 0 when tracing is off
+*/
+static uint64_t z_thpool_msg_stamp(struct z_thpool_mng_struct *p_mng, struct z_thpool_msg_struct *p_msg) {
+    uint64_t ts = Z_THPOOL_TRACE && p_mng->p_traces ? z_thpool_trace_now() : 0;
+
+    // The stamp doubles as the flow id of the trace, either clock keeps it unique enough
+    if (p_mng->latency_flag) {
+        p_msg->enq_ns = z_thpool_now_ns();
+    } else if (ts) {
+        p_msg->enq_ns = ts;
+    }
+    return ts;
+}
+
+/**
+@brief Record queued messages on the trace ring of the calling thread's producer shard
+@param p_mng Pointer to the thread pool management structure
+@param p_msg First message queued
+@param ts Trace clock reading taken before the messages were queued
+@param nums Number of messages queued, their flow ids follow the first one
+@return No return value
+*/
+static void z_thpool_trace_pub(struct z_thpool_mng_struct *p_mng, const struct z_thpool_msg_struct *p_msg, uint64_t ts, uint32_t nums) {
+    if (!Z_THPOOL_TRACE || !p_mng->p_traces) {
+        return;
+    }
+
+    // The enqueue point is the stamp of the message, the same reading the flow starts from
+    struct z_thpool_trace_ring_struct *p_ring = &p_mng->p_traces[p_mng->max_nums + (z_thpool_pub_stat(p_mng) - p_mng->pub_stats)];
+    z_thpool_trace_rec(p_ring, ts, E_Z_THPOOL_TRACE_ENQUEUE, p_msg->enq_ns, p_msg->cb, nums);
+}
+
+/**
+@brief Find the submission counter shard of the calling thread
+@param p_mng Pointer to the thread pool management structure
+@return Shard of the calling thread, the same one for every pool
+*/
+static struct z_thpool_pub_stat_struct *z_thpool_pub_stat(struct z_thpool_mng_struct *p_mng) {
+    if (!gs_thpool_shard) {
+        gs_thpool_shard = __atomic_fetch_add(&gs_thpool_shard_nums, 1, __ATOMIC_RELAXED) % Z_THPOOL_STAT_SHARDS + 1;
+    }
+    return &p_mng->pub_stats[gs_thpool_shard - 1];
+}
+
+/**
+@brief Count accepted and refused submissions on the calling thread's shard
+@param p_mng Pointer to the thread pool management structure
+@param nums Number of tasks accepted, negative to hand back tasks counted before a push that did not fit
+@param full_nums Number of tasks refused because the queue was full
+@return No return value
+*/
+static void z_thpool_pub_count(struct z_thpool_mng_struct *p_mng, int32_t nums, uint32_t full_nums) {
+    struct z_thpool_pub_stat_struct *p_stat = z_thpool_pub_stat(p_mng);
+
+    // Shards are shared when there are more producers than shards, so the adds stay atomic, a negative count wraps back
+    if (nums) {
+        __atomic_add_fetch(&p_stat->pub_nums, (uint64_t)(int64_t)nums, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&p_stat->pub_bytes, (uint64_t)((int64_t)nums * p_mng->msg_size), __ATOMIC_RELAXED);
+    }
+    if (full_nums) {
+        __atomic_add_fetch(&p_stat->full_nums, full_nums, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+@brief Address of the i-th message in a buffer of msg_size strided messages
+@param mng Pointer to the thread pool management structure
+@param p_msgs Message buffer
+@param i Message index
+@return Pointer to the message header
+*/
+static struct z_thpool_msg_struct *z_thpool_msg_at(struct z_thpool_mng_struct *mng, struct z_thpool_msg_struct *p_msgs, uint32_t i) {
+    return (struct z_thpool_msg_struct *)((uint8_t *)p_msgs + (size_t)i * mng->msg_size);
+}
+
+/**
+@brief Check whether every accepted task has completed
+@param p_mng Pointer to the thread pool management structure
+@return Non-zero when the queue is drained and no callback is running
+*/
+static int32_t z_thpool_is_idle(struct z_thpool_mng_struct *p_mng) {
+    uint64_t pub_nums = __atomic_load_n(&p_mng->task_pub_nums, __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&p_mng->task_done_nums, __ATOMIC_SEQ_CST) >= pub_nums;
+}
+
+/**
+@brief Lock-free estimate of the queued messages, used by idle workers polling without the mutex
+@param mng Pointer to the thread pool management structure
+@return Number of queued messages, exact once the producers' stores are visible
+*/
+static uint32_t z_thpool_queued_hint(struct z_thpool_mng_struct *mng) {
+    uint32_t queued = 0;
+
+    if (mng->queue_type == E_Z_THPOOL_QUEUE_MPMC) {
+        return z_thpool_queued(mng);
+    }
+
+    for (uint32_t i = 0; i < mng->node_nums * mng->lane_nums; i++) {
+        queued += z_thpool_lane_depth(mng, &mng->p_lanes[i]);
+    }
+    return queued;
+}
+
+/**
+@brief Lock-free depth of one lane, used by readers that must not take the mutex
+@param mng Pointer to the thread pool management structure
+@param p_lane Lane to measure
+@return Number of messages queued in the lane
+*/
+static uint32_t z_thpool_lane_depth(struct z_thpool_mng_struct *mng, struct z_thpool_lane_struct *p_lane) {
+    if (mng->queue_type == E_Z_THPOOL_QUEUE_MPMC) {
+        return z_mpmc_data_len(&p_lane->t_ring);
+    }
+
+    // Sample out before in, both only grow, so the difference can overshoot but never go negative
+    struct z_kfifo_struct *p_fifo = &p_lane->t_info;
+    uint32_t out = __atomic_load_n(&p_fifo->out, __ATOMIC_ACQUIRE);
+    uint32_t in = __atomic_load_n(&p_fifo->in, __ATOMIC_ACQUIRE);
+    return Z_TOOL_MIN(in - out, p_fifo->size) / mng->msg_size;
+}
+
+/**
+@brief Busy-poll the queue for spin_ns, then yield up to yield_nums times
+@param mng Pointer to the thread pool management structure
+@return Non-zero when work showed up or the pool is stopping, 0 when the worker should park
+*/
+static int32_t z_thpool_idle_spin(struct z_thpool_mng_struct *mng) {
+    struct timespec now;
+    struct timespec end;
+
+    if (mng->spin_ns) {
+        z_thpool_deadline(&end, mng->spin_ns);
+        do {
+            for (uint32_t i = 0; i < Z_THPOOL_SPIN_CHECKS; i++) {
+                if (z_thpool_queued_hint(mng) || !__atomic_load_n(&mng->th_run_flag, __ATOMIC_RELAXED)) {
+                    __atomic_add_fetch(&mng->spin_hit_nums, 1, __ATOMIC_RELAXED);
+                    return 1;
+                }
+                Z_THPOOL_CPU_RELAX();
+            }
+            clock_gettime(CLOCK_MONOTONIC, &now);
+        } while (now.tv_sec < end.tv_sec || (now.tv_sec == end.tv_sec && now.tv_nsec < end.tv_nsec));
+    }
+
+    for (uint32_t i = 0; i < mng->yield_nums; i++) {
+        sched_yield();
+        if (z_thpool_queued_hint(mng) || !__atomic_load_n(&mng->th_run_flag, __ATOMIC_RELAXED)) {
+            __atomic_add_fetch(&mng->yield_hit_nums, 1, __ATOMIC_RELAXED);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+@brief Wait for work as an idle worker: spin, yield, then park on the wake_seq event count, the caller must hold the mutex
+@param p_worker Pointer to the calling worker's state
+@param p_deadline Keep-alive deadline, only used while the pool runs above min_nums in elastic mode
+@return 0 when woken up or work showed up, ETIMEDOUT when the keep-alive expired
+*/
+static int32_t z_thpool_idle_wait(struct z_thpool_worker_struct *p_worker, const struct timespec *p_deadline) {
+    struct z_thpool_mng_struct *mng = p_worker->p_mng;
+    int32_t timed = mng->idle_timeout_ms && mng->th_run_nums > mng->min_nums;
+    int32_t ret = 0;
+
+    pthread_mutex_unlock(&mng->mutex);
+
+    // Spinners are not counted as parked, producers never pay a syscall for them
+    if (mng->spin_ns || mng->yield_nums) {
+        __atomic_add_fetch(&mng->th_spin_nums, 1, __ATOMIC_RELAXED);
+        int32_t found = z_thpool_idle_spin(mng);
+        __atomic_sub_fetch(&mng->th_spin_nums, 1, __ATOMIC_RELAXED);
+        if (found) {
+            pthread_mutex_lock(&mng->mutex);
+            return 0;
+        }
+    }
+
+    // Take the event count before announcing the sleeper and re-checking, pairs with z_thpool_event_wake
+    uint32_t seq = __atomic_load_n(&mng->wake_seq, __ATOMIC_ACQUIRE);
+    __atomic_add_fetch(&mng->th_park, Z_THPOOL_PARK_ONE, __ATOMIC_SEQ_CST);
+    if (z_thpool_queued_hint(mng) == 0 && __atomic_load_n(&mng->th_run_flag, __ATOMIC_RELAXED)) {
+        __atomic_add_fetch(&mng->park_nums, 1, __ATOMIC_RELAXED);
+        Z_THPOOL_TRACE_REC(p_worker->p_trace, E_Z_THPOOL_TRACE_PARK, 0, NULL, 0);
+        if (z_thpool_futex_wait(&mng->wake_seq, seq, timed ? p_deadline : NULL) == -ETIMEDOUT) {
+            ret = ETIMEDOUT;
+        }
+        Z_THPOOL_TRACE_REC(p_worker->p_trace, E_Z_THPOOL_TRACE_UNPARK, 0, NULL, 0);
+    }
+
+    // Leave the sleepers and take one pending wake along, keeping the woken count within the sleepers
+    uint64_t old = __atomic_load_n(&mng->th_park, __ATOMIC_RELAXED);
+    uint64_t val;
+    do {
+        uint32_t sleep = Z_THPOOL_PARK_NUMS(old) - 1;
+        uint32_t woken = Z_THPOOL_PARK_WOKEN_NUMS(old);
+        woken = Z_TOOL_MIN(woken ? woken - 1 : 0, sleep);
+        val = ((uint64_t)woken << 32) | sleep;
+    } while (!__atomic_compare_exchange_n(&mng->th_park, &old, val, 1, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+    pthread_mutex_lock(&mng->mutex);
+    return ret;
+}
+
+/**
+@brief Wake up to nums parked workers after publishing work, skipping the syscall when nobody is parked
+@param p_mng Pointer to the thread pool management structure
+@param nums Number of messages just enqueued
+@return No return value
+*/
+static void z_thpool_event_wake(struct z_thpool_mng_struct *p_mng, uint32_t nums) {
+    // Order the queue update before reading the sleeper count, pairs with the announce in z_thpool_idle_wait
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    uint64_t old = __atomic_load_n(&p_mng->th_park, __ATOMIC_RELAXED);
+    uint32_t wake;
+    do {
+        // Workers woken by an earlier producer have not run yet, they will see this work too
+        wake = Z_TOOL_MIN(nums, Z_THPOOL_PARK_NUMS(old) - Z_THPOOL_PARK_WOKEN_NUMS(old));
+        if (wake == 0) {
+            __atomic_add_fetch(&p_mng->wake_skip_nums, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&p_mng->th_park, &old, old + wake * Z_THPOOL_PARK_WOKEN, 1, __ATOMIC_SEQ_CST,
+                                          __ATOMIC_RELAXED));
+
+    // The th_park reservation above already orders this wake, ring producers stay off the mutex
+    __atomic_add_fetch(&p_mng->wake_seq, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&p_mng->wake_nums, 1, __ATOMIC_RELAXED);
+    z_thpool_futex_wake(&p_mng->wake_seq, (int32_t)Z_TOOL_MIN(wake, (uint32_t)INT_MAX));
+}
+
+/**
+@brief Compute an absolute CLOCK_MONOTONIC deadline
+@param p_ts Deadline to fill
+@param timeout_ns Relative timeout in nanoseconds
+@return No return value
+*/
+static void z_thpool_deadline(struct timespec *p_ts, uint64_t timeout_ns) {
+    clock_gettime(CLOCK_MONOTONIC, p_ts);
+    p_ts->tv_sec += timeout_ns / 1000000000ULL;
+    p_ts->tv_nsec += timeout_ns % 1000000000ULL;
+    if (p_ts->tv_nsec >= 1000000000L) {
+        p_ts->tv_sec++;
+        p_ts->tv_nsec -= 1000000000L;
+    }
+}
+
+/**
+@brief Decide how many messages a worker takes in one dequeue
+@param mng Pointer to the thread pool management structure
+@param queued Number of messages currently queued
+@return Fair share of the backlog per running worker, clamped to [1, batch_max]
+*/
+static uint32_t z_thpool_batch_nums(struct z_thpool_mng_struct *mng, uint32_t queued) {
+    uint32_t workers = Z_TOOL_MAX(__atomic_load_n(&mng->th_run_nums, __ATOMIC_RELAXED), 1);
+    uint32_t share = (queued + workers - 1) / workers;
+    return Z_TOOL_MAX(Z_TOOL_MIN(share, mng->batch_max), 1);
+}
+
+/**
+@brief Take up to nums messages from the lock-free ring, idling in z_thpool_idle_wait while it is empty
+@param p_worker Pointer to the calling worker's state
+@param p_msg Message buffer to fill
+@param nums Maximum number of messages to take
+@return Number of messages read, 0 when the pool is stopping, -1 when the worker has retired
+*/
+static int32_t z_thpool_ring_read(struct z_thpool_worker_struct *p_worker, struct z_thpool_msg_struct *p_msg, uint32_t nums) {
+    struct z_thpool_mng_struct *mng = p_worker->p_mng;
+    struct timespec deadline;
+    int32_t ret = 0;
+    uint32_t max = nums;
+
+    nums = z_thpool_lane_pop(mng, p_worker->node, p_msg, max);
+    if (nums) {
+        return nums;
+    }
+
+    pthread_mutex_lock(&mng->mutex);
+    if (mng->idle_timeout_ms) {
+        z_thpool_deadline(&deadline, (uint64_t)mng->idle_timeout_ms * 1000000ULL);
+    }
+
+    while (mng->th_run_flag) {
+        ret = z_thpool_idle_wait(p_worker, &deadline);
+        nums = z_thpool_lane_pop(mng, p_worker->node, p_msg, max);
+        if (nums) {
+            break;
+        }
+
+        if (ret == ETIMEDOUT && mng->th_run_nums > mng->min_nums) {
+            // The keep-alive expired and the ring is still empty, retire this worker
+            mng->th_retire_nums++;
+            z_thpool_worker_exit(p_worker);
+            pthread_mutex_unlock(&mng->mutex);
+            return -1;
+        }
+    }
+    pthread_mutex_unlock(&mng->mutex);
+    return nums;
+}
+
+/**
+@brief Wake threads parked on a ring condition, skipping the mutex when nobody sleeps
+@param p_mng Pointer to the thread pool management structure
+@param p_cond Condition the sleepers are parked on
+@param p_waits Sleeper count matching p_cond
+@param nums Number of ring slots just filled or freed
+@return No return value
+*/
+static void z_thpool_ring_wake(struct z_thpool_mng_struct *p_mng, pthread_cond_t *p_cond, uint32_t *p_waits, uint32_t nums) {
+    // Order the ring update before reading the sleeper count, pairs with the announce on the sleeping side
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(p_waits, __ATOMIC_RELAXED) == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&p_mng->mutex);
+    z_thpool_cond_wake(p_cond, __atomic_load_n(p_waits, __ATOMIC_RELAXED), nums);
+    pthread_mutex_unlock(&p_mng->mutex);
+}
+
+/**
+@brief Wake min(nums, waits) threads parked on a condition, the caller must hold the mutex
+@param p_cond Condition to signal
+@param waits Number of threads parked on p_cond
+@param nums Number of queue slots just filled or freed
+@return No return value
+*/
+static void z_thpool_cond_wake(pthread_cond_t *p_cond, uint32_t waits, uint32_t nums) {
+    if (nums >= waits) {
+        if (waits) {
+            pthread_cond_broadcast(p_cond);
+        }
+        return;
+    }
+
+    while (nums--) {
+        pthread_cond_signal(p_cond);
+    }
+}
+
+/**
+@brief Start one more worker in a free slot, the caller must hold the mutex
+@param p_mng Pointer to the thread pool management structure
+@return 0 on success, -1 when every slot is taken or the thread could not be created
+*/
+static int32_t z_thpool_spawn(struct z_thpool_mng_struct *p_mng) {
+    for (uint32_t i = 0; i < p_mng->max_nums; i++) {
+        struct z_thpool_worker_struct *p_worker = &p_mng->p_workers[i];
+        if (p_worker->used) {
+            continue;
+        }
+
+        // A retired thread left the slot under the mutex and touches nothing shared afterwards, the join returns at once
+        if (p_worker->joinable) {
+            pthread_join(p_worker->tid, NULL);
+            p_worker->joinable = 0;
+        }
+
+        p_worker->used = 1;
+        p_worker->stat.idle_start = z_thpool_now_ns();
+        uint32_t stack_size = p_worker->p_stack ? (uint32_t)p_mng->stack_size : p_mng->t_config.thread_stack_size;
+        if (z_thpool_create_thread(&p_worker->tid, z_thpool_proc, p_worker, stack_size, p_worker->p_stack, p_worker->pin_flag ? &p_worker->cpus : NULL) != 0) {
+            p_worker->used = 0;
+            return -1;
+        }
+
+        p_worker->joinable = 1;
+
+        __atomic_add_fetch(&p_mng->th_run_nums, 1, __ATOMIC_RELAXED);
+        p_mng->th_spawn_nums++;
+        return 0;
+    }
+    return -1;
+}
+
+/**
+@brief Spawn workers when the backlog exceeds the parked workers able to take it, the caller must hold the mutex
+@param p_mng Pointer to the thread pool management structure
+@param nums Number of messages just enqueued, at most this many workers are spawned
+@return No return value
+*/
+static void z_thpool_grow(struct z_thpool_mng_struct *p_mng, uint32_t nums) {
+    if (!p_mng->idle_timeout_ms || !p_mng->th_run_flag || p_mng->th_run_nums >= p_mng->max_nums) {
+        return;
+    }
+
+    uint32_t queued = z_thpool_queued(p_mng);
+    uint32_t idle = Z_THPOOL_PARK_NUMS(__atomic_load_n(&p_mng->th_park, __ATOMIC_RELAXED)) +
+                    __atomic_load_n(&p_mng->th_spin_nums, __ATOMIC_RELAXED);
+    if (queued <= idle) {
+        return;
+    }
+
+    nums = Z_TOOL_MIN(nums, queued - idle);
+    nums = Z_TOOL_MIN(nums, p_mng->max_nums - p_mng->th_run_nums);
+    while (nums-- && z_thpool_spawn(p_mng) == 0) {
+    }
+}
+
+/**
+@brief Lock-free front end of z_thpool_grow, only takes the mutex when a spawn looks needed
+@param p_mng Pointer to the thread pool management structure
+@param nums Number of messages just enqueued
+@return No return value
+*/
+static void z_thpool_ring_grow(struct z_thpool_mng_struct *p_mng, uint32_t nums) {
+    if (!p_mng->idle_timeout_ms || __atomic_load_n(&p_mng->th_run_nums, __ATOMIC_RELAXED) >= p_mng->max_nums ||
+        z_thpool_queued(p_mng) <= Z_THPOOL_PARK_NUMS(__atomic_load_n(&p_mng->th_park, __ATOMIC_RELAXED)) +
+                                      __atomic_load_n(&p_mng->th_spin_nums, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    pthread_mutex_lock(&p_mng->mutex);
+    z_thpool_grow(p_mng, nums);
+    pthread_mutex_unlock(&p_mng->mutex);
+}
+
+/**
+@brief Release the accounting and slot of an exiting worker, the caller must hold the mutex
+@param p_worker Pointer to the exiting worker's state, must not be touched afterwards
+@return No return value
+*/
+static void z_thpool_worker_exit(struct z_thpool_worker_struct *p_worker) {
+    struct z_thpool_mng_struct *mng = p_worker->p_mng;
+
+    p_worker->used = 0;
+    __atomic_sub_fetch(&mng->th_run_nums, 1, __ATOMIC_RELEASE);
+}
+
+/**
+@brief Join every thread started on the pool, th_run_flag must already be cleared so that no slot is respawned
+@param p_mng Pointer to the thread pool management structure
+@return No return value
+*/
+static void z_thpool_join(struct z_thpool_mng_struct *p_mng) {
+    for (uint32_t i = 0; i < p_mng->max_nums; i++) {
+        struct z_thpool_worker_struct *p_worker = &p_mng->p_workers[i];
+        if (p_worker->joinable) {
+            pthread_join(p_worker->tid, NULL);
+            p_worker->joinable = 0;
+        }
+    }
+}
+
+/**
+@brief Thread pool processing function
+@param param Pointer to the worker state
+@return No return value
+*/
+static void *z_thpool_proc(void *param) {
+    prctl(PR_SET_NAME, "thp");
+    struct z_thpool_worker_struct *p_worker = (struct z_thpool_worker_struct *)param;
+    struct z_thpool_mng_struct *mng = p_worker->p_mng;
+
+    // Continue processing messages as long as the run flag is set
+    while (mng->th_run_flag) {
+        if (z_thpool_msg_read(p_worker) != 0) {
+            return NULL; // Retired, the slot has already been released
+        }
+    }
+
+    // Decrement the run number after processing is complete
+    pthread_mutex_lock(&mng->mutex);
+    z_thpool_worker_exit(p_worker);
+    pthread_mutex_unlock(&mng->mutex);
+    return NULL;
+}
+
+/**
+@brief Write one message into a priority lane of the submitter's node, optionally blocking while the lanes are full
+@param p_mng Pointer to the thread pool management structure
+@param prio Priority lane, 0 is the highest
+@param p_msg Message to enqueue
+@param p_data Inline payload copied behind the header, may be NULL when len is 0
+@param len Payload length, at most msg_inline_max
+@param block Non-zero to wait for a free slot instead of failing
+@param p_deadline Absolute CLOCK_MONOTONIC deadline for the wait, NULL waits forever
+@return 0 on success, -EAGAIN when full and not blocking, -ETIMEDOUT, or -ESHUTDOWN when the pool is stopped
+*/
+static int32_t z_thpool_msg_write(struct z_thpool_mng_struct *p_mng, uint32_t prio, struct z_thpool_msg_struct *p_msg, const void *p_data, uint32_t len, int32_t block,
+                                  const struct timespec *p_deadline) {
+    struct z_thpool_slot_struct slot;
+    int32_t ret = 0;
+
+    // Queue slots carry msg_size bytes when inline payloads are enabled, stage the header and payload together
+    if (p_mng->msg_size > sizeof(struct z_thpool_msg_struct)) {
+        slot.msg = *p_msg;
+        if (len) {
+            memcpy(slot.data, p_data, len);
+        }
+        p_msg = &slot.msg;
+    }
+
+    if (p_mng->queue_type == E_Z_THPOOL_QUEUE_MPMC) {
+        while (1) {
+            if (!p_mng->start_flag || !__atomic_load_n(&p_mng->th_run_flag, __ATOMIC_RELAXED)) {
+                return -ESHUTDOWN;
+            }
+
+            // Count the task before a worker can see it, otherwise it may finish first and the pool looks idle too early
+            // or the snapshot shows more executed than submitted
+            __atomic_add_fetch(&p_mng->task_pub_nums, 1, __ATOMIC_SEQ_CST);
+            z_thpool_pub_count(p_mng, 1, 0);
+
+            // Stamp at each attempt, time spent blocked on a full queue is not queue wait
+            uint64_t ts = z_thpool_msg_stamp(p_mng, p_msg);
+            if (z_thpool_lane_push(p_mng, prio, p_msg) == 0) {
+                z_thpool_trace_pub(p_mng, p_msg, ts, 1);
+                z_thpool_event_wake(p_mng, 1);
+                z_thpool_ring_grow(p_mng, 1);
+                return 0;
+            }
+            z_thpool_pub_count(p_mng, -1, 0);
+            __atomic_sub_fetch(&p_mng->task_pub_nums, 1, __ATOMIC_SEQ_CST);
+
+            if (!block || ret == ETIMEDOUT) {
+                z_thpool_pub_count(p_mng, 0, 1);
+                return block ? -ETIMEDOUT : -EAGAIN;
+            }
+
+            // Announce the blocked producer before re-checking, pairs with the worker side wake
+            pthread_mutex_lock(&p_mng->mutex);
+            __atomic_add_fetch(&p_mng->pub_wait_nums, 1, __ATOMIC_SEQ_CST);
+            if (z_thpool_lane_space(p_mng, prio) == 0 && p_mng->start_flag && p_mng->th_run_flag) {
+                ret = p_deadline ? pthread_cond_timedwait(&p_mng->cond_space, &p_mng->mutex, p_deadline) : pthread_cond_wait(&p_mng->cond_space, &p_mng->mutex);
+            }
+            __atomic_sub_fetch(&p_mng->pub_wait_nums, 1, __ATOMIC_SEQ_CST);
+            if (!p_mng->th_run_flag) {
+                pthread_cond_broadcast(&p_mng->cond_exit);
+            }
+            pthread_mutex_unlock(&p_mng->mutex);
+        }
+    }
+
+    pthread_mutex_lock(&p_mng->mutex);
+    while (1) {
+        if (!p_mng->start_flag || !p_mng->th_run_flag) {
+            ret = -ESHUTDOWN;
+            break;
+        }
+
+        uint64_t ts = z_thpool_msg_stamp(p_mng, p_msg);
+        if (z_thpool_lane_push(p_mng, prio, p_msg) == 0) {
+            z_thpool_trace_pub(p_mng, p_msg, ts, 1);
+            z_thpool_pub_count(p_mng, 1, 0);
+            __atomic_add_fetch(&p_mng->task_pub_nums, 1, __ATOMIC_RELAXED);
+            z_thpool_event_wake(p_mng, 1);
+            z_thpool_grow(p_mng, 1);
+            ret = 0;
+            break;
+        }
+
+        if (!block || ret == ETIMEDOUT) {
+            z_thpool_pub_count(p_mng, 0, 1);
+            ret = block ? -ETIMEDOUT : -EAGAIN;
+            break;
+        }
+
+        p_mng->pub_wait_nums++;
+        ret = p_deadline ? pthread_cond_timedwait(&p_mng->cond_space, &p_mng->mutex, p_deadline) : pthread_cond_wait(&p_mng->cond_space, &p_mng->mutex);
+        p_mng->pub_wait_nums--;
+    }
+    if (!p_mng->th_run_flag) {
+        pthread_cond_broadcast(&p_mng->cond_exit);
+    }
+    pthread_mutex_unlock(&p_mng->mutex);
+    return ret;
+}
+
+/**
+@brief Add a work task to the thread pool without blocking
+@param handle Handle to the thread pool
+@param cb Callback function
+@param p_arg Argument for the callback function
+@return Status, success is 0, -EAGAIN when the queue is full, -ESHUTDOWN when the pool is stopped
+*/
+int32_t z_thpool_add_work(z_thpool_handle_t handle, void (*cb)(void *), void *p_arg) {
+    if (!handle || !cb || !p_arg) {
+        return -EINVAL;
+    }
+
+    struct z_thpool_msg_struct msg = {cb, p_arg};
+    return z_thpool_msg_write((struct z_thpool_mng_struct *)handle, handle->lane_nums - 1, &msg, NULL, 0, 0, NULL);
+}
+
+/**
+@brief Add a work task to a priority lane without blocking
+@param handle Handle to the thread pool
+@param prio Priority lane, 0 is the highest and prio_nums - 1 the lowest
+@param cb Callback function
+@param p_arg Argument for the callback function
+@return Status, success is 0, -EAGAIN when the lane is full, -ESHUTDOWN when the pool is stopped
+*/
+int32_t z_thpool_add_work_prio(z_thpool_handle_t handle, uint32_t prio, void (*cb)(void *), void *p_arg) {
+    if (!handle || !cb || !p_arg || prio >= handle->lane_nums) {
+        return -EINVAL;
+    }
+
+    struct z_thpool_msg_struct msg = {cb, p_arg};
+    return z_thpool_msg_write((struct z_thpool_mng_struct *)handle, prio, &msg, NULL, 0, 0, NULL);
+}
+
+/**
+@brief Add a work task to the thread pool, blocking while the queue is full
+@param handle Handle to the thread pool
+@param cb Callback function
+@param p_arg Argument for the callback function
+@return Status, success is 0, -ESHUTDOWN when the pool is stopped
+*/
+int32_t z_thpool_add_work_wait(z_thpool_handle_t handle, void (*cb)(void *), void *p_arg) {
+    if (!handle || !cb || !p_arg) {
+        return -EINVAL;
+    }
+
+    struct z_thpool_msg_struct msg = {cb, p_arg};
+    return z_thpool_msg_write((struct z_thpool_mng_struct *)handle, handle->lane_nums - 1, &msg, NULL, 0, 1, NULL);
+}
+
+/**
+@brief Add a work task to the thread pool, blocking at most timeout_ns while the queue is full
+@param handle Handle to the thread pool
+@param cb Callback function
+@param p_arg Argument for the callback function
+@param timeout_ns Maximum time to wait for a free slot, in nanoseconds
+@return Status, success is 0, -ETIMEDOUT when no slot was freed in time, -ESHUTDOWN when the pool is stopped
+*/
+int32_t z_thpool_add_work_timed(z_thpool_handle_t handle, void (*cb)(void *), void *p_arg, uint64_t timeout_ns) {
+    if (!handle || !cb || !p_arg) {
+        return -EINVAL;
+    }
+
+    struct timespec deadline;
+    z_thpool_deadline(&deadline, timeout_ns);
+
+    struct z_thpool_msg_struct msg = {cb, p_arg};
+    return z_thpool_msg_write((struct z_thpool_mng_struct *)handle, handle->lane_nums - 1, &msg, NULL, 0, 1, &deadline);
+}
+
+/**
+@brief Add a work task whose completion is reported to a wait group
+@param handle Handle to the thread pool
+@param p_wg Wait group, incremented now and decremented once the callback returns
+@param cb Callback function
+@param p_arg Argument for the callback function
+@return Status, success is 0, -EAGAIN when the queue is full, -ESHUTDOWN when the pool is stopped
+*/
+int32_t z_thpool_add_work_wg(z_thpool_handle_t handle, struct z_thpool_wg_struct *p_wg, void (*cb)(void *), void *p_arg) {
+    if (!handle || !p_wg || !cb || !p_arg) {
+        return -EINVAL;
+    }
+
+    struct z_thpool_msg_struct msg = {cb, p_arg, p_wg};
+    z_thpool_wg_add(p_wg, 1);
+    int32_t ret = z_thpool_msg_write((struct z_thpool_mng_struct *)handle, handle->lane_nums - 1, &msg, NULL, 0, 0, NULL);
+    if (ret != 0) {
+        z_thpool_wg_done(p_wg);
+    }
+    return ret;
+}
+
+/**
+@brief Add a work task whose argument is copied into the queue, saving the caller an allocation per task
+@param handle Handle to the thread pool
+@param cb Callback function, receives a pointer to the copy that stays valid until the callback returns
+@param p_data Argument bytes to copy
+@param len Number of bytes, at most msg_inline_max of the pool configuration
+@return Status, success is 0, -EMSGSIZE when len exceeds msg_inline_max, -EAGAIN when the queue is full, -ESHUTDOWN when the pool is stopped
+*/
+int32_t z_thpool_add_work_copy(z_thpool_handle_t handle, void (*cb)(void *), const void *p_data, uint32_t len) {
+    if (!handle || !cb || !p_data || !len) {
+        return -EINVAL;
+    }
+    if (len > handle->t_config.msg_inline_max) {
+        return -EMSGSIZE;
+    }
+
+    struct z_thpool_msg_struct msg = {cb, NULL};
+    return z_thpool_msg_write((struct z_thpool_mng_struct *)handle, handle->lane_nums - 1, &msg, p_data, len, 0, NULL);
+}
+
+/**
+@brief Wait until the queue is drained and no callback is running
+@param handle Handle to the thread pool
+@param timeout_ns Maximum time to wait in nanoseconds, Z_THPOOL_WAIT_FOREVER to wait without limit
+@return Status, success is 0, -ETIMEDOUT on timeout, -ESHUTDOWN when the pool is being destroyed
+*/
+int32_t z_thpool_wait_idle(z_thpool_handle_t handle, uint64_t timeout_ns) {
+    if (!handle) {
+        return -EINVAL;
+    }
+
+    struct z_thpool_mng_struct *p_mng = (struct z_thpool_mng_struct *)handle;
+    struct timespec deadline;
+    int32_t ret = 0;
+
+    if (timeout_ns != Z_THPOOL_WAIT_FOREVER) {
+        z_thpool_deadline(&deadline, timeout_ns);
+    }
+
+    pthread_mutex_lock(&p_mng->mutex);
+    // Announce the waiter before checking, pairs with the barrier in z_thpool_msg_exec
+    __atomic_add_fetch(&p_mng->idle_wait_nums, 1, __ATOMIC_SEQ_CST);
+    while (!z_thpool_is_idle(p_mng)) {
+        if (!p_mng->th_run_flag) {
+            ret = -ESHUTDOWN;
+            break;
+        }
+        if (ret == ETIMEDOUT) {
+            ret = -ETIMEDOUT;
+            break;
+        }
+
+        if (timeout_ns == Z_THPOOL_WAIT_FOREVER) {
+            ret = pthread_cond_wait(&p_mng->cond_idle, &p_mng->mutex);
+        } else {
+            ret = pthread_cond_timedwait(&p_mng->cond_idle, &p_mng->mutex, &deadline);
+        }
+    }
+    if (ret > 0) {
+        ret = 0; // Became idle right as the wait timed out
+    }
+    __atomic_sub_fetch(&p_mng->idle_wait_nums, 1, __ATOMIC_SEQ_CST);
+    if (!p_mng->th_run_flag) {
+        pthread_cond_broadcast(&p_mng->cond_exit);
+    }
+    pthread_mutex_unlock(&p_mng->mutex);
+    return ret;
+}
+
+/**
+@brief Initialize a wait group
+@param p_wg Wait group to initialize
+@return Status, success is 0
+*/
+int32_t z_thpool_wg_init(struct z_thpool_wg_struct *p_wg) {
+    if (!p_wg) {
+        return -EINVAL;
+    }
+
+    pthread_condattr_t cond_attr;
+    p_wg->count = 0;
+    if (pthread_mutex_init(&p_wg->mutex, NULL) != 0) {
+        return -1;
+    }
+
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    int32_t ret = pthread_cond_init(&p_wg->cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+    if (ret != 0) {
+        pthread_mutex_destroy(&p_wg->mutex);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+@brief Release the resources of a wait group, no task may still reference it
+@param p_wg Wait group to destroy
+@return Status, success is 0
+*/
+int32_t z_thpool_wg_destroy(struct z_thpool_wg_struct *p_wg) {
+    if (!p_wg) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_destroy(&p_wg->mutex);
+    pthread_cond_destroy(&p_wg->cond);
+    return 0;
+}
+
+/**
+@brief Add outstanding tasks to a wait group
+@param p_wg Wait group
+@param nums Number of tasks to add
+@return Status, success is 0
+*/
+int32_t z_thpool_wg_add(struct z_thpool_wg_struct *p_wg, uint32_t nums) {
+    if (!p_wg) {
+        return -EINVAL;
+    }
+
+    __atomic_add_fetch(&p_wg->count, nums, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/**
+@brief Mark one task of a wait group as finished
+@param p_wg Wait group
+@return Status, success is 0
+*/
+int32_t z_thpool_wg_done(struct z_thpool_wg_struct *p_wg) {
+    if (!p_wg) {
+        return -EINVAL;
+    }
+
+    // Lock-free while other tasks are outstanding
+    uint32_t count = __atomic_load_n(&p_wg->count, __ATOMIC_RELAXED);
+    while (count > 1) {
+        if (__atomic_compare_exchange_n(&p_wg->count, &count, count - 1, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            return 0;
+        }
+    }
+
+    // The last decrement happens under the mutex so the waiter cannot free the group before the broadcast
+    pthread_mutex_lock(&p_wg->mutex);
+    if (__atomic_sub_fetch(&p_wg->count, 1, __ATOMIC_ACQ_REL) == 0) {
+        pthread_cond_broadcast(&p_wg->cond);
+    }
+    pthread_mutex_unlock(&p_wg->mutex);
+    return 0;
+}
+
+/**
+@brief Wait until every task added to the wait group has finished
+@param p_wg Wait group
+@param timeout_ns Maximum time to wait in nanoseconds, Z_THPOOL_WAIT_FOREVER to wait without limit
+@return Status, success is 0, -ETIMEDOUT on timeout
+*/
+int32_t z_thpool_wg_wait(struct z_thpool_wg_struct *p_wg, uint64_t timeout_ns) {
+    if (!p_wg) {
+        return -EINVAL;
+    }
+
+    struct timespec deadline;
+    int32_t ret = 0;
+
+    if (timeout_ns != Z_THPOOL_WAIT_FOREVER) {
+        z_thpool_deadline(&deadline, timeout_ns);
+    }
+
+    pthread_mutex_lock(&p_wg->mutex);
+    while (__atomic_load_n(&p_wg->count, __ATOMIC_ACQUIRE) > 0) {
+        if (ret == ETIMEDOUT) {
+            break;
+        }
+
+        if (timeout_ns == Z_THPOOL_WAIT_FOREVER) {
+            ret = pthread_cond_wait(&p_wg->cond, &p_wg->mutex);
+        } else {
+            ret = pthread_cond_timedwait(&p_wg->cond, &p_wg->mutex, &deadline);
+        }
+    }
+    ret = __atomic_load_n(&p_wg->count, __ATOMIC_ACQUIRE) > 0 ? -ETIMEDOUT : 0;
+    pthread_mutex_unlock(&p_wg->mutex);
+    return ret;
+}
+
+/**
+@brief Sleep on a futex word until it changes from val
+@param p_addr Futex word
+@param val Value expected in the word
+@param p_deadline Absolute CLOCK_MONOTONIC deadline, NULL waits forever
+@return 0 when woken or the value changed, -ETIMEDOUT on timeout
+*/
+static int32_t z_thpool_futex_wait(uint32_t *p_addr, uint32_t val, const struct timespec *p_deadline) {
+    if (syscall(SYS_futex, p_addr, FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG, val, p_deadline, NULL, FUTEX_BITSET_MATCH_ANY) != 0 && errno == ETIMEDOUT) {
+        return -ETIMEDOUT;
+    }
+    return 0;
+}
+
+/**
+@brief Wake threads sleeping on a futex word
+@param p_addr Futex word
+@param nums Maximum number of threads to wake
+@return No return value
+*/
+static void z_thpool_futex_wake(uint32_t *p_addr, int32_t nums) {
+    syscall(SYS_futex, p_addr, FUTEX_WAKE | FUTEX_PRIVATE_FLAG, nums, NULL, NULL, 0);
+}
+
+/**
+@brief Take a task handle from the lock-free free list
+@param p_mng Pointer to the thread pool management structure
+@return Task handle, NULL when every handle is in use
+*/
+static struct z_thpool_task_struct *z_thpool_task_alloc(struct z_thpool_mng_struct *p_mng) {
+    uint64_t head = __atomic_load_n(&p_mng->task_free, __ATOMIC_ACQUIRE);
+
+    while (1) {
+        uint32_t index = (uint32_t)head;
+        if (index == 0) {
+            return NULL;
+        }
+
+        // The tag in the upper half changes on every update so a recycled head cannot be mistaken (ABA)
+        uint32_t next = __atomic_load_n(&p_mng->p_tasks[index - 1].next, __ATOMIC_RELAXED);
+        uint64_t update = ((head >> 32) + 1) << 32 | next;
+        if (__atomic_compare_exchange_n(&p_mng->task_free, &head, update, 1, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+            return &p_mng->p_tasks[index - 1];
+        }
+    }
+}
+
+/**
+@brief Drop one reference to a task handle, returning it to the free list on the last one
+@param p_task Task handle
+@return No return value
+*/
+static void z_thpool_task_put(struct z_thpool_task_struct *p_task) {
+    if (__atomic_sub_fetch(&p_task->refs, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+
+    struct z_thpool_mng_struct *p_mng = p_task->p_mng;
+    uint32_t index = (uint32_t)(p_task - p_mng->p_tasks) + 1;
+    uint64_t head = __atomic_load_n(&p_mng->task_free, __ATOMIC_RELAXED);
+
+    while (1) {
+        __atomic_store_n(&p_task->next, (uint32_t)head, __ATOMIC_RELAXED);
+        uint64_t update = ((head >> 32) + 1) << 32 | index;
+        if (__atomic_compare_exchange_n(&p_mng->task_free, &head, update, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            return;
+        }
+    }
+}
+
+/**
+@brief Message callback running a submitted task and publishing its result
+@param p_arg Task handle
+@return No return value
+*/
+static void z_thpool_task_run(void *p_arg) {
+    struct z_thpool_task_struct *p_task = (struct z_thpool_task_struct *)p_arg;
+
+    p_task->p_ret = p_task->cb(p_task->p_arg);
+    z_thpool_task_finish(p_task, Z_THPOOL_TASK_DONE);
+}
+
+/**
+@brief Publish the completion of a task, run its completion callback, wake its waiters and drop the message's reference
+@param p_task Task handle, p_ret already set
+@param bits Z_THPOOL_TASK_DONE, plus Z_THPOOL_TASK_CANCEL when the task is discarded without running
+@return No return value
+*/
+static void z_thpool_task_finish(struct z_thpool_task_struct *p_task, uint32_t bits) {
+    uint32_t state = __atomic_fetch_or(&p_task->state, bits, __ATOMIC_ACQ_REL);
+
+    // A cancelled task still completes its callback, with a NULL result, so that its context can be released
+    if (state & Z_THPOOL_TASK_READY) {
+        p_task->then(p_task->p_ret, p_task->p_ctx);
+    }
+    if (state & Z_THPOOL_TASK_WAITERS) {
+        z_thpool_futex_wake(&p_task->state, INT_MAX);
+    }
+    z_thpool_task_put(p_task);
+}
+
+/**
+@brief Account for a task handle given back by its submitter, the last one during shutdown wakes z_thpool_destroy_ex
+@param p_mng Pointer to the thread pool management structure
+@return No return value
+*/
+static void z_thpool_task_unhold(struct z_thpool_mng_struct *p_mng) {
+    // Under the mutex, so that the destroying thread cannot free the pool between the decrement and the signal
+    pthread_mutex_lock(&p_mng->mutex);
+    if (--p_mng->task_hold_nums == 0 && !p_mng->start_flag) {
+        pthread_cond_broadcast(&p_mng->cond_exit);
+    }
+    pthread_mutex_unlock(&p_mng->mutex);
+}
+
+/**
+@brief Submit a task whose return value can be collected through a task handle
+@param handle Handle to the thread pool
+@param cb Task function, its return value is stored in the handle
+@param p_arg Argument for the task function, may be NULL
+@param p_task Pointer to store the task handle, release it with z_thpool_task_release
+@return Status, success is 0, -ENOMEM when no handle is free, -EAGAIN when the queue is full, -ESHUTDOWN when the pool is stopped
+*/
+int32_t z_thpool_submit(z_thpool_handle_t handle, void *(*cb)(void *), void *p_arg, z_thpool_task_t *p_task) {
+    if (!handle || !cb || !p_task) {
+        return -EINVAL;
+    }
+
+    struct z_thpool_mng_struct *p_mng = (struct z_thpool_mng_struct *)handle;
+    struct z_thpool_task_struct *p_new = z_thpool_task_alloc(p_mng);
+    if (!p_new) {
+        return -ENOMEM;
+    }
+
+    p_new->cb = cb;
+    p_new->p_arg = p_arg;
+    p_new->p_ret = NULL;
+    p_new->then = NULL;
+    p_new->p_ctx = NULL;
+    __atomic_store_n(&p_new->state, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&p_new->refs, 2, __ATOMIC_RELAXED); // One for the caller, one for the queued message
+    __atomic_add_fetch(&p_mng->task_hold_nums, 1, __ATOMIC_RELAXED);
+
+    struct z_thpool_msg_struct msg = {z_thpool_task_run, p_new};
+    int32_t ret = z_thpool_msg_write(p_mng, p_mng->lane_nums - 1, &msg, NULL, 0, 0, NULL);
+    if (ret != 0) {
+        __atomic_store_n(&p_new->refs, 1, __ATOMIC_RELAXED);
+        z_thpool_task_put(p_new);
+        z_thpool_task_unhold(p_mng);
+        return ret;
+    }
+
+    *p_task = p_new;
+    return 0;
+}
+
+/**
+@brief Check whether a task has completed without blocking
+@param task Task handle
+@param p_ret Pointer to store the task's return value, may be NULL
+@return 0 when completed, -EAGAIN while still pending, -ECANCELED when the pool was destroyed before the task ran
+*/
+int32_t z_thpool_task_poll(z_thpool_task_t task, void **p_ret) {
+    if (!task) {
+        return -EINVAL;
+    }
+
+    uint32_t state = __atomic_load_n(&task->state, __ATOMIC_ACQUIRE);
+    if (!(state & Z_THPOOL_TASK_DONE)) {
+        return -EAGAIN;
+    }
+    if (p_ret) {
+        *p_ret = task->p_ret;
+    }
+    return (state & Z_THPOOL_TASK_CANCEL) ? -ECANCELED : 0;
+}
+
+/**
+@brief Wait for a task to complete
+@param task Task handle
+@param timeout_ns Maximum time to wait in nanoseconds, Z_THPOOL_WAIT_FOREVER to wait without limit
+@param p_ret Pointer to store the task's return value, may be NULL
+@return 0 when completed, -ETIMEDOUT on timeout, -ECANCELED when the pool was destroyed before the task ran
+*/
+int32_t z_thpool_task_wait(z_thpool_task_t task, uint64_t timeout_ns, void **p_ret) {
+    if (!task) {
+        return -EINVAL;
+    }
+
+    struct timespec deadline;
+    if (timeout_ns != Z_THPOOL_WAIT_FOREVER) {
+        z_thpool_deadline(&deadline, timeout_ns);
+    }
+
+    uint32_t state = __atomic_load_n(&task->state, __ATOMIC_ACQUIRE);
+    while (!(state & Z_THPOOL_TASK_DONE)) {
+        // Flag the sleeper so that the worker only issues the wake syscall when needed
+        if (!(state & Z_THPOOL_TASK_WAITERS) &&
+            !__atomic_compare_exchange_n(&task->state, &state, state | Z_THPOOL_TASK_WAITERS, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+
+        if (z_thpool_futex_wait(&task->state, state | Z_THPOOL_TASK_WAITERS, timeout_ns == Z_THPOOL_WAIT_FOREVER ? NULL : &deadline) != 0) {
+            int32_t ret = z_thpool_task_poll(task, p_ret);
+            return ret == -EAGAIN ? -ETIMEDOUT : ret;
+        }
+        state = __atomic_load_n(&task->state, __ATOMIC_ACQUIRE);
+    }
+    return z_thpool_task_poll(task, p_ret);
+}
+
+/**
+@brief Attach a completion callback to a task, it runs on the worker or immediately if the task is already done
+@param task Task handle
+@param then Completion callback receiving the task's return value and p_ctx
+@param p_ctx Context for the completion callback
+@return Status, success is 0, -EBUSY when a callback is already attached
+*/
+int32_t z_thpool_task_then(z_thpool_task_t task, void (*then)(void *p_ret, void *p_ctx), void *p_ctx) {
+    if (!task || !then) {
+        return -EINVAL;
+    }
+
+    // Claim the callback slot first, a second caller must not overwrite the fields of the first
+    uint32_t state = __atomic_load_n(&task->state, __ATOMIC_ACQUIRE);
+    do {
+        if (state & Z_THPOOL_TASK_THEN) {
+            return -EBUSY;
+        }
+    } while (!__atomic_compare_exchange_n(&task->state, &state, state | Z_THPOOL_TASK_THEN, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+    if (state & Z_THPOOL_TASK_DONE) {
+        then(task->p_ret, p_ctx);
+        return 0;
+    }
+
+    // Publish the fields, if the task completed meanwhile the worker has not seen READY and the callback is ours to run
+    task->then = then;
+    task->p_ctx = p_ctx;
+    state = __atomic_fetch_or(&task->state, Z_THPOOL_TASK_READY, __ATOMIC_ACQ_REL);
+    if (state & Z_THPOOL_TASK_DONE) {
+        then(task->p_ret, p_ctx);
+    }
+    return 0;
+}
+
+/**
+@brief Release a task handle, it may be released before the task completes
+@param task Task handle, must not be used afterwards
+@return Status, success is 0
+*/
+int32_t z_thpool_task_release(z_thpool_task_t task) {
+    if (!task) {
+        return -EINVAL;
+    }
+
+    struct z_thpool_mng_struct *p_mng = task->p_mng;
+    z_thpool_task_put(task);
+    z_thpool_task_unhold(p_mng);
+    return 0;
+}
+
+/**
+@brief Add a batch of work tasks to the thread pool with a single lock round-trip
+@param handle Handle to the thread pool
+@param cb Array of callback functions
+@param p_arg Array of arguments, p_arg[i] is passed to cb[i]
+@param nums Number of entries in both arrays
+@return Number of tasks accepted (less than nums only when the lanes of every node are full), or a negative error code
+*/
+int32_t z_thpool_add_work_batch(z_thpool_handle_t handle, void (*cb[])(void *), void *p_arg[], uint32_t nums) {
+    if (!handle || !cb || !p_arg || nums > INT32_MAX) {
+        return -EINVAL;
+    }
+
+    for (uint32_t i = 0; i < nums; i++) {
+        if (!cb[i] || !p_arg[i]) {
+            return -EINVAL;
+        }
+    }
+
+    struct z_thpool_mng_struct *p_mng = (struct z_thpool_mng_struct *)handle;
+    uint32_t node = z_thpool_local_node(p_mng);
+    uint32_t node_idx = 0; // Nodes tried so far, the local one first like z_thpool_lane_push
+    struct z_thpool_msg_struct msgs[Z_THPOOL_BATCH_NUMS];
+    uint32_t stage = sizeof(msgs) / p_mng->msg_size; // Messages staged per round, fewer when slots carry inline payload room
+    uint64_t ts = Z_THPOOL_TRACE && p_mng->p_traces ? z_thpool_trace_now() : 0;
+    uint64_t now = p_mng->latency_flag ? z_thpool_now_ns() : ts; // One enqueue stamp for the whole batch
+    uint32_t done = 0;
+
+    if (p_mng->queue_type == E_Z_THPOOL_QUEUE_MPMC) {
+        if (!p_mng->start_flag || !__atomic_load_n(&p_mng->th_run_flag, __ATOMIC_RELAXED)) {
+            return -ESHUTDOWN;
+        }
+
+        while (done < nums && node_idx < p_mng->node_nums) {
+            struct z_thpool_lane_struct *p_lane = &p_mng->p_lanes[((node + node_idx) % p_mng->node_nums) * p_mng->lane_nums + p_mng->lane_nums - 1];
+            uint32_t n = Z_TOOL_MIN(nums - done, stage);
+            for (uint32_t i = 0; i < n; i++) {
+                struct z_thpool_msg_struct *p_msg = z_thpool_msg_at(p_mng, msgs, i);
+                p_msg->cb = cb[done + i];
+                p_msg->p_arg = p_arg[done + i];
+                p_msg->p_wg = NULL;
+                p_msg->enq_ns = now + (ts ? done + i : 0); // Traced messages need distinct flow ids
+            }
+
+            // Counted up front like single submissions, the part that did not fit is handed back
+            __atomic_add_fetch(&p_mng->task_pub_nums, n, __ATOMIC_SEQ_CST);
+            z_thpool_pub_count(p_mng, (int32_t)n, 0);
+            uint32_t in = z_mpmc_in(&p_lane->t_ring, msgs, n);
+            if (in < n) {
+                z_thpool_pub_count(p_mng, -(int32_t)(n - in), 0);
+                __atomic_sub_fetch(&p_mng->task_pub_nums, n - in, __ATOMIC_SEQ_CST);
+            }
+            if (in) {
+                z_thpool_trace_pub(p_mng, msgs, ts, in);
+            }
+            done += in;
+            if (in < n) {
+                node_idx++; // This node's lane is full, the rest goes to the next node
+            }
+        }
+
+        z_thpool_pub_count(p_mng, 0, nums - done);
+        if (done) {
+            z_thpool_event_wake(p_mng, done);
+            z_thpool_ring_grow(p_mng, done);
+        }
+        return done;
+    }
+
+    pthread_mutex_lock(&p_mng->mutex);
+    if (!p_mng->start_flag || !p_mng->th_run_flag) {
+        pthread_mutex_unlock(&p_mng->mutex);
+        return -ESHUTDOWN;
+    }
+
+    // Accept as many entries as fit on each node in turn, the rest is left to the caller
+    for (; done < nums && node_idx < p_mng->node_nums; node_idx++) {
+        struct z_thpool_lane_struct *p_lane = &p_mng->p_lanes[((node + node_idx) % p_mng->node_nums) * p_mng->lane_nums + p_mng->lane_nums - 1];
+        uint32_t fit = done + Z_TOOL_MIN(nums - done, z_kfifo_space(&p_lane->t_info) / p_mng->msg_size);
+        while (done < fit) {
+            uint32_t n = Z_TOOL_MIN(fit - done, stage);
+            for (uint32_t i = 0; i < n; i++) {
+                struct z_thpool_msg_struct *p_msg = z_thpool_msg_at(p_mng, msgs, i);
+                p_msg->cb = cb[done + i];
+                p_msg->p_arg = p_arg[done + i];
+                p_msg->p_wg = NULL;
+                p_msg->enq_ns = now + (ts ? done + i : 0); // Traced messages need distinct flow ids
+            }
+
+            z_kfifo_in(&p_lane->t_info, msgs, n * p_mng->msg_size);
+            z_thpool_trace_pub(p_mng, msgs, ts, n);
+            done += n;
+        }
+    }
+
+    z_thpool_pub_count(p_mng, (int32_t)done, nums - done);
+    __atomic_add_fetch(&p_mng->task_pub_nums, done, __ATOMIC_RELAXED);
+    z_thpool_event_wake(p_mng, done);
+    z_thpool_grow(p_mng, done);
+    pthread_mutex_unlock(&p_mng->mutex);
+    return done;
+}
+
+/**
+@brief Drop a reference to a parallel_for call
+@param p_job Shared state of the call
+@return No return value
+*/
+static void z_thpool_pfor_put(struct z_thpool_pfor_struct *p_job) {
+    if (__atomic_sub_fetch(&p_job->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(p_job);
+    }
+}
+
+/**
+@brief Run chunks of a parallel_for call until the range is exhausted
+@param p_job Shared state of the call
+@return No return value
+*/
+static void z_thpool_pfor_exec(struct z_thpool_pfor_struct *p_job) {
+    void *p_acc = NULL;
+
+    if (p_job->reduce) {
+        p_acc = p_job->p_accs + (size_t)__atomic_fetch_add(&p_job->slot_nums, 1, __ATOMIC_RELAXED) * p_job->acc_step;
+        memcpy(p_acc, p_job->p_init, p_job->acc_size);
+    }
+
+    uint64_t begin = __atomic_load_n(&p_job->next, __ATOMIC_RELAXED);
+    while (begin < p_job->end) {
+        // Guided chunking, large chunks first and grain-sized ones near the end to even out the finish
+        uint64_t left = p_job->end - begin;
+        uint64_t nums = Z_TOOL_MIN(left, Z_TOOL_MAX(p_job->grain, left / (2 * p_job->parts)));
+        if (!__atomic_compare_exchange_n(&p_job->next, &begin, begin + nums, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            continue;
+        }
+
+        if (p_job->reduce) {
+            p_job->reduce(begin, begin + nums, p_acc, p_job->p_ctx);
+        } else {
+            p_job->body(begin, begin + nums, p_job->p_ctx);
+        }
+        begin = __atomic_load_n(&p_job->next, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+@brief Pool task helping with a parallel_for call, leaves at once if the caller has already finished
+@param p_arg Shared state of the call
+@return No return value
+*/
+static void z_thpool_pfor_helper(void *p_arg) {
+    struct z_thpool_pfor_struct *p_job = (struct z_thpool_pfor_struct *)p_arg;
+    uint32_t active = __atomic_load_n(&p_job->active, __ATOMIC_RELAXED);
+
+    do {
+        if (active & Z_THPOOL_PFOR_CLOSED) {
+            z_thpool_pfor_put(p_job);
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&p_job->active, &active, active + 1, 1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+    z_thpool_pfor_exec(p_job);
+
+    if (__atomic_sub_fetch(&p_job->active, 1, __ATOMIC_RELEASE) == Z_THPOOL_PFOR_CLOSED) {
+        z_thpool_futex_wake(&p_job->active, INT_MAX);
+    }
+    z_thpool_pfor_put(p_job);
+}
+
+/**
+@brief Split a range over the pool's workers and the calling thread, common part of parallel_for and parallel_reduce
+@param p_mng Pointer to the thread pool management structure
+@param p_job Shared state of the call, its body and accumulator fields already set
+@param begin First index of the range
+@param end End of the range, exclusive
+@param grain Smallest chunk handed out, 0 picks one from the range and the pool size
+@return No return value
+*/
+static void z_thpool_pfor_run(struct z_thpool_mng_struct *p_mng, struct z_thpool_pfor_struct *p_job, uint64_t begin, uint64_t end, uint64_t grain) {
+    uint32_t helpers = p_mng->max_nums;
+
+    p_job->next = begin;
+    p_job->end = end;
+    p_job->parts = helpers + 1;
+    p_job->grain = grain ? grain : Z_TOOL_MAX(1, (end - begin) / ((uint64_t)p_job->parts * Z_THPOOL_PFOR_CHUNKS));
+    p_job->active = 0;
+    p_job->slot_nums = 0;
+
+    // No point in waking more helpers than there are chunks besides the caller's
+    helpers = Z_TOOL_MIN(helpers, (end - begin - 1) / p_job->grain);
+    p_job->refs = helpers + 1;
+    for (uint32_t i = 0; i < helpers; i++) {
+        if (z_thpool_add_work(p_mng, z_thpool_pfor_helper, p_job) != 0) {
+            // Queue full or pool stopping, the caller covers the rest of the range itself
+            __atomic_sub_fetch(&p_job->refs, helpers - i, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+
+    z_thpool_pfor_exec(p_job);
+
+    // Helpers still queued are no longer waited for, so a call made from a worker cannot deadlock
+    uint32_t active = __atomic_or_fetch(&p_job->active, Z_THPOOL_PFOR_CLOSED, __ATOMIC_ACQUIRE);
+    while (active != Z_THPOOL_PFOR_CLOSED) {
+        z_thpool_futex_wait(&p_job->active, active, NULL);
+        active = __atomic_load_n(&p_job->active, __ATOMIC_ACQUIRE);
+    }
+}
+
+/**
+@brief Run body over [begin, end) in chunks spread over the pool's workers, the calling thread takes part
+@param handle Handle to the thread pool
+@param begin First index of the range
+@param end End of the range, exclusive
+@param grain Smallest chunk passed to body, 0 picks one from the range and the pool size
+@param body Function called with disjoint sub-ranges [begin, end) covering the whole range
+@param p_ctx Context passed to body
+@return Status, success is 0 once every index has been processed
+*/
+int32_t z_thpool_parallel_for(z_thpool_handle_t handle, uint64_t begin, uint64_t end, uint64_t grain,
+                              void (*body)(uint64_t begin, uint64_t end, void *p_ctx), void *p_ctx) {
+    if (!handle || !body) {
+        return -EINVAL;
+    }
+    if (begin >= end) {
+        return 0;
+    }
+
+    struct z_thpool_pfor_struct *p_job = (struct z_thpool_pfor_struct *)calloc(1, sizeof(struct z_thpool_pfor_struct));
+    if (!p_job) {
+        return -ENOMEM;
+    }
+
+    p_job->body = body;
+    p_job->p_ctx = p_ctx;
+    z_thpool_pfor_run(handle, p_job, begin, end, grain);
+    z_thpool_pfor_put(p_job);
+    return 0;
+}
+
+/**
+@brief Reduce [begin, end) in parallel, each participant folds its chunks into a private accumulator that is joined at the end
+@param handle Handle to the thread pool
+@param begin First index of the range
+@param end End of the range, exclusive
+@param grain Smallest chunk passed to body, 0 picks one from the range and the pool size
+@param body Function folding the sub-range [begin, end) into p_acc
+@param join Function folding p_other into p_acc
+@param p_result In: identity value of the reduction, out: the result
+@param result_size Size of the value behind p_result
+@param p_ctx Context passed to body and join
+@return Status, success is 0
+*/
+int32_t z_thpool_parallel_reduce(z_thpool_handle_t handle, uint64_t begin, uint64_t end, uint64_t grain,
+                                 void (*body)(uint64_t begin, uint64_t end, void *p_acc, void *p_ctx),
+                                 void (*join)(void *p_acc, const void *p_other, void *p_ctx), void *p_result, uint32_t result_size, void *p_ctx) {
+    if (!handle || !body || !join || !p_result || !result_size) {
+        return -EINVAL;
+    }
+    if (begin >= end) {
+        return 0;
+    }
+
+    // Accumulators sit on separate cache lines so that participants do not share them
+    uint32_t step = (result_size + 63) & ~63U;
+    struct z_thpool_pfor_struct *p_job = (struct z_thpool_pfor_struct *)calloc(1, sizeof(struct z_thpool_pfor_struct) + (size_t)(handle->max_nums + 1) * step);
+    if (!p_job) {
+        return -ENOMEM;
+    }
+
+    p_job->reduce = body;
+    p_job->p_ctx = p_ctx;
+    p_job->p_init = p_result;
+    p_job->acc_size = result_size;
+    p_job->acc_step = step;
+    z_thpool_pfor_run(handle, p_job, begin, end, grain);
+
+    // Every participant has left, the identity in p_result is no longer read
+    for (uint32_t i = 0; i < p_job->slot_nums; i++) {
+        join(p_result, p_job->p_accs + (size_t)i * step, p_ctx);
+    }
+    z_thpool_pfor_put(p_job);
+    return 0;
+}
+
+/**
+@brief Sum the submission shards and worker slot counters, workers and producers keep counting meanwhile
+@param p_mng Pointer to the thread pool management structure
+@param p_pub Filled with the submission totals
+@param p_work Filled with the worker totals, busy holds the number of workers running callbacks
+@return No return value
+*/
+static void z_thpool_stat_sum(struct z_thpool_mng_struct *p_mng, struct z_thpool_pub_stat_struct *p_pub, struct z_thpool_work_stat_struct *p_work) {
+    memset(p_pub, 0, sizeof(*p_pub));
+    memset(p_work, 0, sizeof(*p_work));
+
+    // Completions are summed first, each slot publishes them with release and producers count a task before pushing it,
+    // so every completion read here has its submission visible after the fence
+    for (uint32_t i = 0; i < p_mng->max_nums; i++) {
+        struct z_thpool_work_stat_struct *p_stat = &p_mng->p_workers[i].stat;
+        p_work->exec_nums += __atomic_load_n(&p_stat->exec_nums, __ATOMIC_RELAXED);
+        p_work->sub_bytes += __atomic_load_n(&p_stat->sub_bytes, __ATOMIC_RELAXED);
+        p_work->busy_ns += __atomic_load_n(&p_stat->busy_ns, __ATOMIC_RELAXED);
+        p_work->idle_ns += __atomic_load_n(&p_stat->idle_ns, __ATOMIC_RELAXED);
+        p_work->busy += __atomic_load_n(&p_stat->busy, __ATOMIC_RELAXED);
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    for (uint32_t i = 0; i < Z_THPOOL_STAT_SHARDS; i++) {
+        p_pub->pub_nums += __atomic_load_n(&p_mng->pub_stats[i].pub_nums, __ATOMIC_RELAXED);
+        p_pub->pub_bytes += __atomic_load_n(&p_mng->pub_stats[i].pub_bytes, __ATOMIC_RELAXED);
+        p_pub->full_nums += __atomic_load_n(&p_mng->pub_stats[i].full_nums, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+@brief Fill latency percentiles from a merged histogram
+@param p_hist Histogram merged over the worker slots
+@param p_lat Percentiles to fill
+@return No return value
+*/
+static void z_thpool_latency_fill(const struct z_hist_struct *p_hist, struct z_thpool_latency_struct *p_lat) {
+    p_lat->count = p_hist->total;
+    p_lat->mean = p_hist->total ? p_hist->sum / p_hist->total : 0;
+    p_lat->sum = p_hist->sum;
+    p_lat->p50 = z_hist_percentile(p_hist, 50.0);
+    p_lat->p90 = z_hist_percentile(p_hist, 90.0);
+    p_lat->p99 = z_hist_percentile(p_hist, 99.0);
+    p_lat->p999 = z_hist_percentile(p_hist, 99.9);
+    p_lat->max = p_hist->max;
+}
+
+/**
+@brief Read the latency percentiles merged over all worker slots, workers keep recording meanwhile
+@param handle Handle to the thread pool
+@param p_wait Percentiles of the time from enqueue until the callback starts, may be NULL
+@param p_run Percentiles of the callback run time, may be NULL
+@return Status, success is 0, -ENOTSUP when the pool was created without latency_flag
+*/
+int32_t z_thpool_latency_get(z_thpool_handle_t handle, struct z_thpool_latency_struct *p_wait, struct z_thpool_latency_struct *p_run) {
+    if (!handle) {
+        return -EINVAL;
+    }
+
+    struct z_thpool_mng_struct *p_mng = (struct z_thpool_mng_struct *)handle;
+    if (!p_mng->latency_flag) {
+        return -ENOTSUP;
+    }
+
+    struct z_hist_struct *p_sum = p_mng->p_hist_sum;
+    pthread_mutex_lock(&p_mng->hist_mutex);
+    z_hist_reset(&p_sum[0]);
+    z_hist_reset(&p_sum[1]);
+    for (uint32_t i = 0; i < p_mng->max_nums; i++) {
+        z_hist_merge(&p_sum[0], &p_mng->p_hists[i * 2]);
+        z_hist_merge(&p_sum[1], &p_mng->p_hists[i * 2 + 1]);
+    }
+
+    if (p_wait) {
+        z_thpool_latency_fill(&p_sum[0], p_wait);
+    }
+    if (p_run) {
+        z_thpool_latency_fill(&p_sum[1], p_run);
+    }
+    pthread_mutex_unlock(&p_mng->hist_mutex);
+    return 0;
+}
+
+/**
+@brief Take a snapshot of the pool counters without the pool mutex
+@param handle Handle to the thread pool
+@param p_stats Snapshot to fill
+@return Status, success is 0
+*/
+int32_t z_thpool_get_stats(z_thpool_handle_t handle, struct z_thpool_stats_struct *p_stats) {
+    if (!handle || !p_stats) {
+        return -EINVAL;
+    }
+
+    struct z_thpool_mng_struct *p_mng = (struct z_thpool_mng_struct *)handle;
+    struct z_thpool_pub_stat_struct pub;
+    struct z_thpool_work_stat_struct work;
+
+    memset(p_stats, 0, sizeof(*p_stats));
+    z_thpool_stat_sum(p_mng, &pub, &work);
+
+    memcpy(p_stats->pool_name, p_mng->pool_name, sizeof(p_stats->pool_name));
+    p_stats->queue_type = p_mng->queue_type;
+    p_stats->max_thread_nums = p_mng->max_nums;
+    p_stats->run_thread_nums = __atomic_load_n(&p_mng->th_run_nums, __ATOMIC_RELAXED);
+    p_stats->busy_thread_nums = Z_TOOL_MIN(work.busy, p_stats->run_thread_nums);
+    p_stats->spawn_nums = __atomic_load_n(&p_mng->th_spawn_nums, __ATOMIC_RELAXED);
+    p_stats->retire_nums = __atomic_load_n(&p_mng->th_retire_nums, __ATOMIC_RELAXED);
+    p_stats->prio_nums = p_mng->lane_nums;
+    for (uint32_t i = 0; i < p_mng->node_nums * p_mng->lane_nums; i++) {
+        struct z_thpool_lane_struct *p_lane = &p_mng->p_lanes[i];
+        uint32_t depth = z_thpool_lane_depth(p_mng, p_lane);
+        p_stats->lane_depth[i % p_mng->lane_nums] += depth;
+        p_stats->lane_deq_nums[i % p_mng->lane_nums] += __atomic_load_n(&p_lane->deq_nums, __ATOMIC_RELAXED);
+        p_stats->queue_depth += depth;
+        p_stats->queue_capacity += p_mng->queue_type == E_Z_THPOOL_QUEUE_MPMC ? p_lane->t_ring.size : p_lane->t_info.size / p_mng->msg_size;
+    }
+
+    // Shards count a task before a worker can take it and the slots were summed first, so executed <= submitted
+    p_stats->executed = work.exec_nums;
+    p_stats->submitted = pub.pub_nums;
+    p_stats->rejected_full = pub.full_nums;
+    p_stats->pub_bytes = pub.pub_bytes;
+    p_stats->sub_bytes = work.sub_bytes;
+    p_stats->busy_ns = work.busy_ns;
+    p_stats->idle_ns = work.idle_ns;
+    p_stats->park_nums = __atomic_load_n(&p_mng->park_nums, __ATOMIC_RELAXED);
+    p_stats->wake_nums = __atomic_load_n(&p_mng->wake_nums, __ATOMIC_RELAXED);
+    p_stats->wake_skip_nums = __atomic_load_n(&p_mng->wake_skip_nums, __ATOMIC_RELAXED);
+    p_stats->spin_hit_nums = __atomic_load_n(&p_mng->spin_hit_nums, __ATOMIC_RELAXED);
+    p_stats->yield_hit_nums = __atomic_load_n(&p_mng->yield_hit_nums, __ATOMIC_RELAXED);
+
+    if (p_mng->latency_flag && z_thpool_latency_get(handle, &p_stats->wait, &p_stats->run) == 0) {
+        p_stats->latency_flag = 1;
+    }
+    return 0;
+}
+
+// Output cursor of the stats serializers, len keeps counting past the end of the buffer
+struct z_thpool_text_struct {
+    char *p_buf;   // Output buffer
+    uint32_t size; // Size of the output buffer
+    uint32_t len;  // Length of the full text so far
+};
+
+// Scalar counters shared by the JSON and Prometheus serializers
+static const struct z_thpool_metric_struct {
+    const char *p_key;  // JSON key
+    const char *p_name; // Prometheus metric name, without the z_thpool_ prefix
+    const char *p_type; // Prometheus metric type
+    const char *p_help; // Prometheus help text
+    uint32_t offset;    // Offset of the value in struct z_thpool_stats_struct
+    uint32_t wide;      // Non-zero for a uint64_t value, uint32_t otherwise
+    double scale;       // Factor from the stored unit to the Prometheus unit
+} gs_thpool_metrics[] = {
+    {"max_thread_nums", "threads_max", "gauge", "Maximum number of worker threads", offsetof(struct z_thpool_stats_struct, max_thread_nums), 0, 1},
+    {"run_thread_nums", "threads", "gauge", "Worker threads alive", offsetof(struct z_thpool_stats_struct, run_thread_nums), 0, 1},
+    {"busy_thread_nums", "threads_busy", "gauge", "Worker threads running callbacks", offsetof(struct z_thpool_stats_struct, busy_thread_nums), 0, 1},
+    {"spawn_nums", "threads_spawned_total", "counter", "Worker threads started", offsetof(struct z_thpool_stats_struct, spawn_nums), 0, 1},
+    {"retire_nums", "threads_retired_total", "counter", "Worker threads retired after the keep-alive", offsetof(struct z_thpool_stats_struct, retire_nums), 0, 1},
+    {"queue_depth", "queue_depth", "gauge", "Messages waiting in the queue", offsetof(struct z_thpool_stats_struct, queue_depth), 0, 1},
+    {"queue_capacity", "queue_capacity", "gauge", "Messages the queue can hold", offsetof(struct z_thpool_stats_struct, queue_capacity), 0, 1},
+    {"submitted", "tasks_submitted_total", "counter", "Tasks accepted into the queue", offsetof(struct z_thpool_stats_struct, submitted), 1, 1},
+    {"executed", "tasks_executed_total", "counter", "Task callbacks that have returned", offsetof(struct z_thpool_stats_struct, executed), 1, 1},
+    {"rejected_full", "tasks_rejected_total", "counter", "Tasks refused because the queue was full", offsetof(struct z_thpool_stats_struct, rejected_full), 1, 1},
+    {"pub_bytes", "queued_bytes_total", "counter", "Bytes queued", offsetof(struct z_thpool_stats_struct, pub_bytes), 1, 1},
+    {"sub_bytes", "dequeued_bytes_total", "counter", "Bytes dequeued", offsetof(struct z_thpool_stats_struct, sub_bytes), 1, 1},
+    {"busy_ns", "busy_seconds_total", "counter", "Worker time spent running callbacks", offsetof(struct z_thpool_stats_struct, busy_ns), 1, 1e-9},
+    {"idle_ns", "idle_seconds_total", "counter", "Worker time spent waiting for work", offsetof(struct z_thpool_stats_struct, idle_ns), 1, 1e-9},
+    {"park_nums", "parks_total", "counter", "Times a worker slept on the futex", offsetof(struct z_thpool_stats_struct, park_nums), 1, 1},
+    {"wake_nums", "wakes_total", "counter", "Futex wakes issued by producers", offsetof(struct z_thpool_stats_struct, wake_nums), 1, 1},
+    {"wake_skip_nums", "wakes_skipped_total", "counter", "Wakes skipped because no worker slept", offsetof(struct z_thpool_stats_struct, wake_skip_nums), 1, 1},
+    {"spin_hit_nums", "spin_hits_total", "counter", "Times spinning found work", offsetof(struct z_thpool_stats_struct, spin_hit_nums), 1, 1},
+    {"yield_hit_nums", "yield_hits_total", "counter", "Times yielding found work", offsetof(struct z_thpool_stats_struct, yield_hit_nums), 1, 1},
+};
+
+/**
+@brief Append formatted text to a serializer cursor
+@param p_text Output cursor
+@param p_fmt printf style format
+@return No return value
+*/
+static void z_thpool_text_add(struct z_thpool_text_struct *p_text, const char *p_fmt, ...) {
+    va_list args;
+    uint32_t room = p_text->len < p_text->size ? p_text->size - p_text->len : 0;
+
+    va_start(args, p_fmt);
+    int32_t n = vsnprintf(room ? p_text->p_buf + p_text->len : NULL, room, p_fmt, args);
+    va_end(args);
+    if (n > 0) {
+        p_text->len += n;
+    }
+}
+
+/**
+@brief Append a string escaped for a JSON string or a Prometheus label value
+@param p_text Output cursor
+@param p_str String to append
+@param json Non-zero for JSON, control characters are then written as \u escapes
+@return No return value
+*/
+static void z_thpool_text_str(struct z_thpool_text_struct *p_text, const char *p_str, int32_t json) {
+    for (; *p_str; p_str++) {
+        uint8_t c = (uint8_t)*p_str;
+        if (c == '"' || c == '\\') {
+            z_thpool_text_add(p_text, "\\%c", c);
+        } else if (c == '\n') {
+            z_thpool_text_add(p_text, "\\n");
+        } else if (c < 0x20 && json) {
+            z_thpool_text_add(p_text, "\\u%04x", c);
+        } else {
+            z_thpool_text_add(p_text, "%c", c);
+        }
+    }
+}
+
+/**
+@brief Terminate a serializer cursor and report the result
+@param p_text Output cursor
+@return Length of the text, or -ENOSPC when it was truncated
+*/
+static int32_t z_thpool_text_end(struct z_thpool_text_struct *p_text) {
+    if (p_text->len >= p_text->size) {
+        p_text->p_buf[p_text->size - 1] = '\0';
+        return -ENOSPC;
+    }
+    return p_text->len;
+}
+
+/**
+@brief Read one scalar counter of a snapshot
+@param p_stats Snapshot
+@param p_metric Counter description
+@return Counter value in its stored unit
+*/
+static uint64_t z_thpool_metric_value(const struct z_thpool_stats_struct *p_stats, const struct z_thpool_metric_struct *p_metric) {
+    const uint8_t *p_field = (const uint8_t *)p_stats + p_metric->offset;
+    return p_metric->wide ? *(const uint64_t *)p_field : *(const uint32_t *)p_field;
+}
+
+/**
+@brief Format a snapshot as one JSON object, times are in nanoseconds
+@param p_stats Snapshot taken with z_thpool_get_stats
+@param p_buf Output buffer
+@param size Size of the output buffer
+@return Length of the text, -ENOSPC when it does not fit
+*/
+int32_t z_thpool_stats_to_json(const struct z_thpool_stats_struct *p_stats, char *p_buf, uint32_t size) {
+    if (!p_stats || !p_buf || !size) {
+        return -EINVAL;
+    }
+
+    struct z_thpool_text_struct text = {p_buf, size, 0};
+    z_thpool_text_add(&text, "{\"pool\":\"");
+    z_thpool_text_str(&text, p_stats->pool_name, 1);
+    z_thpool_text_add(&text, "\",\"queue_type\":\"%s\"", p_stats->queue_type == E_Z_THPOOL_QUEUE_MPMC ? "mpmc" : "kfifo");
+    for (uint32_t i = 0; i < sizeof(gs_thpool_metrics) / sizeof(gs_thpool_metrics[0]); i++) {
+        z_thpool_text_add(&text, ",\"%s\":%" PRIu64, gs_thpool_metrics[i].p_key, z_thpool_metric_value(p_stats, &gs_thpool_metrics[i]));
+    }
+
+    z_thpool_text_add(&text, ",\"lanes\":[");
+    for (uint32_t i = 0; i < p_stats->prio_nums && i < Z_THPOOL_PRIO_MAX; i++) {
+        z_thpool_text_add(&text, "%s{\"depth\":%u,\"dequeued\":%" PRIu64 "}", i ? "," : "", p_stats->lane_depth[i], p_stats->lane_deq_nums[i]);
+    }
+    z_thpool_text_add(&text, "]");
+
+    if (p_stats->latency_flag) {
+        for (uint32_t i = 0; i < 2; i++) {
+            const struct z_thpool_latency_struct *p_lat = i ? &p_stats->run : &p_stats->wait;
+            z_thpool_text_add(&text, ",\"%s\":{\"count\":%" PRIu64 ",\"mean\":%" PRIu64 ",\"sum\":%" PRIu64 ",\"p50\":%" PRIu64 ",\"p90\":%" PRIu64 ",\"p99\":%" PRIu64
+                              ",\"p999\":%" PRIu64 ",\"max\":%" PRIu64 "}",
+                              i ? "run_ns" : "wait_ns", p_lat->count, p_lat->mean, p_lat->sum, p_lat->p50, p_lat->p90, p_lat->p99, p_lat->p999, p_lat->max);
+        }
+    }
+    z_thpool_text_add(&text, "}\n");
+    return z_thpool_text_end(&text);
+}
+
+/**
+@brief Format snapshots in the Prometheus text exposition format, grouped by metric family
+@param p_stats Snapshots taken with z_thpool_get_stats
+@param nums Number of snapshots
+@param p_buf Output buffer
+@param size Size of the output buffer
+@return Length of the text, -ENOSPC when it does not fit
+*/
+int32_t z_thpool_stats_to_prom(const struct z_thpool_stats_struct *p_stats, uint32_t nums, char *p_buf, uint32_t size) {
+    if (!p_stats || !p_buf || !size) {
+        return -EINVAL;
+    }
+
+    struct z_thpool_text_struct text = {p_buf, size, 0};
+    p_buf[0] = '\0';
+
+    // A family may only be declared once per exposition, so every pool is listed under each declaration
+    for (uint32_t m = 0; m < sizeof(gs_thpool_metrics) / sizeof(gs_thpool_metrics[0]); m++) {
+        const struct z_thpool_metric_struct *p_metric = &gs_thpool_metrics[m];
+        z_thpool_text_add(&text, "# HELP z_thpool_%s %s\n# TYPE z_thpool_%s %s\n", p_metric->p_name, p_metric->p_help, p_metric->p_name, p_metric->p_type);
+        for (uint32_t i = 0; i < nums; i++) {
+            z_thpool_text_add(&text, "z_thpool_%s{pool=\"", p_metric->p_name);
+            z_thpool_text_str(&text, p_stats[i].pool_name, 0);
+            if (p_metric->scale != 1) {
+                z_thpool_text_add(&text, "\"} %.9g\n", z_thpool_metric_value(&p_stats[i], p_metric) * p_metric->scale);
+            } else {
+                z_thpool_text_add(&text, "\"} %" PRIu64 "\n", z_thpool_metric_value(&p_stats[i], p_metric));
+            }
+        }
+    }
+
+    for (uint32_t m = 0; m < 2; m++) {
+        z_thpool_text_add(&text, "# HELP z_thpool_lane_%s %s\n# TYPE z_thpool_lane_%s %s\n", m ? "dequeued_total" : "depth",
+                          m ? "Messages dequeued per priority lane" : "Messages waiting per priority lane", m ? "dequeued_total" : "depth", m ? "counter" : "gauge");
+        for (uint32_t i = 0; i < nums; i++) {
+            for (uint32_t l = 0; l < p_stats[i].prio_nums && l < Z_THPOOL_PRIO_MAX; l++) {
+                z_thpool_text_add(&text, "z_thpool_lane_%s{pool=\"", m ? "dequeued_total" : "depth");
+                z_thpool_text_str(&text, p_stats[i].pool_name, 0);
+                z_thpool_text_add(&text, "\",prio=\"%u\"} %" PRIu64 "\n", l, m ? p_stats[i].lane_deq_nums[l] : (uint64_t)p_stats[i].lane_depth[l]);
+            }
+        }
+    }
+
+    // Latency histograms are exported as summaries, quantile 1 carries the maximum
+    for (uint32_t m = 0; m < 2; m++) {
+        const char *p_name = m ? "run_seconds" : "queue_wait_seconds";
+        z_thpool_text_add(&text, "# HELP z_thpool_%s %s\n# TYPE z_thpool_%s summary\n", p_name, m ? "Task callback run time" : "Time from enqueue until the callback starts",
+                          p_name);
+        for (uint32_t i = 0; i < nums; i++) {
+            if (!p_stats[i].latency_flag) {
+                continue;
+            }
+
+            const struct z_thpool_latency_struct *p_lat = m ? &p_stats[i].run : &p_stats[i].wait;
+            const uint64_t values[] = {p_lat->p50, p_lat->p90, p_lat->p99, p_lat->p999, p_lat->max};
+            const char *quantiles[] = {"0.5", "0.9", "0.99", "0.999", "1"};
+            for (uint32_t q = 0; q < sizeof(values) / sizeof(values[0]); q++) {
+                z_thpool_text_add(&text, "z_thpool_%s{pool=\"", p_name);
+                z_thpool_text_str(&text, p_stats[i].pool_name, 0);
+                z_thpool_text_add(&text, "\",quantile=\"%s\"} %.9g\n", quantiles[q], values[q] / 1e9);
+            }
+            z_thpool_text_add(&text, "z_thpool_%s_sum{pool=\"", p_name);
+            z_thpool_text_str(&text, p_stats[i].pool_name, 0);
+            z_thpool_text_add(&text, "\"} %.9g\nz_thpool_%s_count{pool=\"", p_lat->sum / 1e9, p_name);
+            z_thpool_text_str(&text, p_stats[i].pool_name, 0);
+            z_thpool_text_add(&text, "\"} %" PRIu64 "\n", p_lat->count);
+        }
+    }
+    return z_thpool_text_end(&text);
+}
+
+/**
+@brief Write the events of one trace ring as Chrome trace events
+@param p_file Output stream
+@param p_mng Pointer to the thread pool management structure
+@param p_ring Trace ring to write
+@param p_events Scratch buffer of trace_nums events
+@param tid Thread id shown for the ring
+@param scale Nanoseconds per trace clock tick
+@return No return value
+*/
+static void z_thpool_trace_ring_dump(FILE *p_file, struct z_thpool_mng_struct *p_mng, struct z_thpool_trace_ring_struct *p_ring, struct z_thpool_trace_event_struct *p_events,
+                                     uint32_t tid, double scale) {
+    uint64_t size = (uint64_t)p_ring->mask + 1;
+
+    // Copy the ring, then keep only the events that were not overwritten while copying
+    uint64_t head = __atomic_load_n(&p_ring->head, __ATOMIC_ACQUIRE);
+    memcpy(p_events, p_ring->p_events, size * sizeof(struct z_thpool_trace_event_struct));
+    uint64_t last = __atomic_load_n(&p_ring->head, __ATOMIC_ACQUIRE);
+    uint64_t first = Z_TOOL_MAX(head > size ? head - size : 0, last > size ? last - size : 0);
+
+    // Slices that began before the oldest kept event have lost their begin, their ends are skipped
+    uint32_t depth = 0;
+    for (uint64_t pos = first; pos < head; pos++) {
+        const struct z_thpool_trace_event_struct *p_event = &p_events[pos & p_ring->mask];
+        double ts = (double)(int64_t)(p_event->ts - p_mng->trace_tick0) * scale / 1000.0;
+
+        switch (p_event->type) {
+            case E_Z_THPOOL_TRACE_ENQUEUE:
+                fprintf(p_file, ",\n{\"name\":\"enqueue\",\"cat\":\"queue\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"cb\":\"%p\",\"nums\":%u}}", ts,
+                        tid, (void *)p_event->cb, p_event->nums);
+                for (uint32_t i = 0; i < p_event->nums; i++) {
+                    fprintf(p_file, ",\n{\"name\":\"task\",\"cat\":\"flow\",\"ph\":\"s\",\"id\":\"0x%" PRIx64 "\",\"ts\":%.3f,\"pid\":1,\"tid\":%u}", p_event->id + i, ts, tid);
+                }
+                break;
+            case E_Z_THPOOL_TRACE_DEQUEUE:
+                fprintf(p_file, ",\n{\"name\":\"dequeue\",\"cat\":\"queue\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"nums\":%u}}", ts, tid,
+                        p_event->nums);
+                break;
+            case E_Z_THPOOL_TRACE_START:
+                depth++;
+                fprintf(p_file, ",\n{\"name\":\"%p\",\"cat\":\"task\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":1,\"tid\":%u}", (void *)p_event->cb, ts, tid);
+                fprintf(p_file, ",\n{\"name\":\"task\",\"cat\":\"flow\",\"ph\":\"f\",\"bp\":\"e\",\"id\":\"0x%" PRIx64 "\",\"ts\":%.3f,\"pid\":1,\"tid\":%u}", p_event->id, ts, tid);
+                break;
+            case E_Z_THPOOL_TRACE_PARK:
+                depth++;
+                fprintf(p_file, ",\n{\"name\":\"park\",\"cat\":\"idle\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":1,\"tid\":%u}", ts, tid);
+                break;
+            case E_Z_THPOOL_TRACE_END:
+            case E_Z_THPOOL_TRACE_UNPARK:
+                if (depth) {
+                    depth--;
+                    fprintf(p_file, ",\n{\"ph\":\"E\",\"ts\":%.3f,\"pid\":1,\"tid\":%u}", ts, tid);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+/**
+@brief Write the trace rings as Chrome trace-event JSON
+@param handle Handle to the thread pool
+@param fd File descriptor to write to, the caller keeps ownership of it
+@return Status, success is 0, -ENOTSUP when the pool was created without trace_nums
+*/
+int32_t z_thpool_trace_dump(z_thpool_handle_t handle, int32_t fd) {
+    if (!handle || fd < 0) {
+        return -EINVAL;
+    }
+
+    struct z_thpool_mng_struct *p_mng = (struct z_thpool_mng_struct *)handle;
+    if (!p_mng->p_traces) {
+        return -ENOTSUP;
+    }
+
+    // Calibrate the trace clock against CLOCK_MONOTONIC over the pool lifetime, at least 10 ms of it
+    uint64_t ns = z_thpool_now_ns();
+    if (ns - p_mng->trace_ns0 < 10000000ULL) {
+        usleep((10000000ULL - (ns - p_mng->trace_ns0)) / 1000 + 1);
+    }
+    uint64_t tick = z_thpool_trace_now();
+    ns = z_thpool_now_ns();
+    double scale = tick > p_mng->trace_tick0 ? (double)(ns - p_mng->trace_ns0) / (double)(tick - p_mng->trace_tick0) : 1.0;
+
+    struct z_thpool_trace_event_struct *p_events = (struct z_thpool_trace_event_struct *)malloc(((size_t)p_mng->p_traces[0].mask + 1) * sizeof(struct z_thpool_trace_event_struct));
+    if (!p_events) {
+        return -ENOMEM;
+    }
+
+    // Write through a duplicate so that closing the stream leaves the caller's descriptor open
+    int32_t dup_fd = dup(fd);
+    FILE *p_file = dup_fd >= 0 ? fdopen(dup_fd, "w") : NULL;
+    if (!p_file) {
+        int32_t ret = -errno;
+        if (dup_fd >= 0) {
+            close(dup_fd);
+        }
+        free(p_events);
+        return ret;
+    }
+
+    char name[sizeof(p_mng->pool_name) * 6 + 1];
+    struct z_thpool_text_struct text = {name, sizeof(name), 0};
+    z_thpool_text_str(&text, p_mng->pool_name, 1);
+    fprintf(p_file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"%s\"}}", name);
+
+    // Workers show as threads named by slot, producer shards after them
+    uint32_t rings = p_mng->max_nums + Z_THPOOL_STAT_SHARDS;
+    for (uint32_t i = 0; i < rings; i++) {
+        struct z_thpool_trace_ring_struct *p_ring = &p_mng->p_traces[i];
+        if (__atomic_load_n(&p_ring->head, __ATOMIC_ACQUIRE) == 0) {
+            continue;
+        }
+
+        uint32_t worker = i < p_mng->max_nums;
+        uint32_t tid = worker ? i : Z_THPOOL_TRACE_TID_PUB + i - p_mng->max_nums;
+        fprintf(p_file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s %u\"}}", tid, worker ? "worker" : "producers",
+                worker ? i : i - p_mng->max_nums);
+        z_thpool_trace_ring_dump(p_file, p_mng, p_ring, p_events, tid, scale);
+    }
+    fprintf(p_file, "\n]}\n");
+
+    int32_t ret = ferror(p_file) ? -EIO : 0;
+    if (fclose(p_file) != 0 && ret == 0) {
+        ret = -errno;
+    }
+    free(p_events);
+    return ret;
+}
+
+/**
+@brief Display thread pool status
+@param handle Handle to the thread pool
+@return Status, success is 0
+*/
+int32_t z_thpool_cmd_shell_show(z_thpool_handle_t handle) {
+    if (!handle) {
+        return -EINVAL;
+    }
+
+    // Print from a lock-free snapshot, workers and producers keep running while the table is formatted
+    struct z_thpool_mng_struct *p_mng = (struct z_thpool_mng_struct *)handle;
+    struct z_thpool_stats_struct stats;
+    z_thpool_get_stats(handle, &stats);
+
+    z_table_print_title("z_thpool module");
+    z_table_print_row("%-18s %s\n", "Ver: ", Z_THPOOL_VERION);
+    z_table_print_row("%-18s %s\n", "Pool Name: ", stats.pool_name);
+    z_table_print_border();
+    z_table_print_row("%-18s %u\n", "max nums: ", stats.max_thread_nums);
+    z_table_print_row("%-18s %u\n", "create nums: ", stats.run_thread_nums);
+    z_table_print_row("%-18s %u\n", "busy nums:", stats.busy_thread_nums);
+    if (p_mng->idle_timeout_ms) {
+        z_table_print_row("%-18s %u\n", "min nums:", p_mng->min_nums);
+        z_table_print_row("%-18s %u\n", "spawn nums:", stats.spawn_nums);
+        z_table_print_row("%-18s %u\n", "retire nums:", stats.retire_nums);
+    }
+    z_table_print_row("%-18s %u\n", "max cache nums:", p_mng->msg_node_max);
+    if (p_mng->msg_size > sizeof(struct z_thpool_msg_struct)) {
+        z_table_print_row("%-18s %u\n", "inline bytes:", p_mng->t_config.msg_inline_max);
+    }
+    z_table_print_row("%-18s %s\n", "queue type:", stats.queue_type == E_Z_THPOOL_QUEUE_MPMC ? "mpmc" : "kfifo");
+    z_table_print_row("%-18s %u\n", "use cache nums:", stats.queue_depth);
+    z_table_print_row("%-18s %u\n", "numa nodes:", p_mng->node_nums);
+    z_table_print_row("%-18s %s\n", "cpu policy:", p_mng->cpu_policy == E_Z_THPOOL_CPU_CORE ? "core" : p_mng->cpu_policy == E_Z_THPOOL_CPU_LIST ? "list" : "none");
+    if (p_mng->lane_nums > 1 || p_mng->node_nums > 1) {
+        z_table_print_row("%-18s %s\n", "prio policy:", p_mng->prio_policy == E_Z_THPOOL_PRIO_WRR ? "wrr" : "strict");
+        for (uint32_t i = 0; i < p_mng->node_nums * p_mng->lane_nums; i++) {
+            struct z_thpool_lane_struct *p_lane = &p_mng->p_lanes[i];
+            z_table_print_row("node %-2u lane %-5u depth %-10u weight %-6u dequeued %" PRIu64 "\n", i / p_mng->lane_nums, i % p_mng->lane_nums,
+                              z_thpool_lane_depth(p_mng, p_lane), p_lane->weight, __atomic_load_n(&p_lane->deq_nums, __ATOMIC_RELAXED));
+        }
+    }
+    if (p_mng->spin_ns || p_mng->yield_nums) {
+        z_table_print_row("%-18s %" PRIu64 " us / %u yields\n", "idle spin:", p_mng->spin_ns / 1000, p_mng->yield_nums);
+        z_table_print_row("%-18s %" PRIu64 "\n", "spin hits:", stats.spin_hit_nums);
+        z_table_print_row("%-18s %" PRIu64 "\n", "yield hits:", stats.yield_hit_nums);
+    }
+    z_table_print_row("%-18s %" PRIu64 "\n", "parks:", stats.park_nums);
+    z_table_print_row("%-18s %" PRIu64 "\n", "wakes:", stats.wake_nums);
+    z_table_print_row("%-18s %" PRIu64 "\n", "wakes skipped:", stats.wake_skip_nums);
+    z_table_print_row("%-18s %" PRIu64 "\n", "submitted:", stats.submitted);
+    z_table_print_row("%-18s %" PRIu64 "\n", "executed:", stats.executed);
+    z_table_print_row("%-18s %" PRIu64 "\n", "rejected full:", stats.rejected_full);
+    z_table_print_row("%-18s %" PRIu64 "\n", "pub_bytes:", stats.pub_bytes);
+    z_table_print_row("%-18s %" PRIu64 "\n", "sub_bytes:", stats.sub_bytes);
+    z_table_print_row("%-18s %.1f ms / %.1f ms\n", "busy / idle:", stats.busy_ns / 1e6, stats.idle_ns / 1e6);
+    for (uint32_t i = 0; i < p_mng->max_nums; i++) {
+        struct z_thpool_worker_struct *p_worker = &p_mng->p_workers[i];
+        uint64_t exec_nums = __atomic_load_n(&p_worker->stat.exec_nums, __ATOMIC_RELAXED);
+        uint32_t used = __atomic_load_n(&p_worker->used, __ATOMIC_RELAXED);
+        if (used || exec_nums) {
+            z_table_print_row("worker %-4u %-6s exec %-10" PRIu64 " busy %-10.1f idle %.1f ms\n", i, used ? "" : "(off)", exec_nums,
+                              __atomic_load_n(&p_worker->stat.busy_ns, __ATOMIC_RELAXED) / 1e6, __atomic_load_n(&p_worker->stat.idle_ns, __ATOMIC_RELAXED) / 1e6);
+        }
+    }
+
+    if (stats.latency_flag) {
+        for (uint32_t i = 0; i < 2; i++) {
+            struct z_thpool_latency_struct *p_lat = i ? &stats.run : &stats.wait;
+            z_table_print_row("%-18s n %-9" PRIu64 " p50 %-8.1f p90 %-8.1f p99 %-8.1f p99.9 %-8.1f max %.1f\n", i ? "run time (us):" : "queue wait (us):",
+                              p_lat->count, p_lat->p50 / 1e3, p_lat->p90 / 1e3, p_lat->p99 / 1e3, p_lat->p999 / 1e3, p_lat->max / 1e3);
+        }
+    }
+    return 0;
+}
+
+// Shared state of the self-checks below
+struct z_thpool_check_struct {
+    z_thpool_handle_t handle; // Pool under test
+    uint32_t run_flag;        // Background producer keeps submitting and the gate holds its worker while set
+    uint64_t done_nums;       // Callbacks of z_thpool_check_count run
+    uint64_t slow_nums;       // Callbacks of z_thpool_check_slow run
+    uint64_t then_nums;       // Completion callbacks run
+    uint64_t discard_nums;    // Tasks handed to the discard callback
+    uint32_t gate_nums;       // Callbacks of z_thpool_check_gate entered
+    z_thpool_task_t task;     // Task handle waited for by z_thpool_check_waiter
+    int32_t wait_ret;         // Result of that wait
+    uint32_t order[32];       // Lanes in the order z_thpool_check_lane ran, recorded by a single worker
+    uint32_t order_nums;      // Entries used in order
+};
+
+// Argument of z_thpool_check_lane, one per priority lane
+struct z_thpool_check_lane_struct {
+    struct z_thpool_check_struct *p_check; // Shared check state
+    uint32_t prio;                         // Lane the task was added to
+};
+
+/**
+@brief Self-check callback counting its runs
+@param p_arg Shared check state
+@return No return value
+*/
+static void z_thpool_check_count(void *p_arg) {
+    __atomic_add_fetch(&((struct z_thpool_check_struct *)p_arg)->done_nums, 1, __ATOMIC_RELAXED);
+}
+
+/**
+@brief Self-check callback standing in for a long-running task
+@param p_arg Shared check state
+@return No return value
+*/
+static void z_thpool_check_slow(void *p_arg) {
+    usleep(2000);
+    __atomic_add_fetch(&((struct z_thpool_check_struct *)p_arg)->slow_nums, 1, __ATOMIC_RELAXED);
+}
+
+/**
+@brief Self-check callback recording the lane it was added to
+@param p_arg Lane argument
+@return No return value
+*/
+static void z_thpool_check_lane(void *p_arg) {
+    struct z_thpool_check_lane_struct *p_lane = (struct z_thpool_check_lane_struct *)p_arg;
+    struct z_thpool_check_struct *p_check = p_lane->p_check;
+
+    if (p_check->order_nums < sizeof(p_check->order) / sizeof(p_check->order[0])) {
+        p_check->order[p_check->order_nums++] = p_lane->prio;
+    }
+}
+
+/**
+@brief Self-check callback holding its worker until run_flag is cleared
+@param p_arg Shared check state
+@return No return value
+*/
+static void z_thpool_check_gate(void *p_arg) {
+    struct z_thpool_check_struct *p_check = (struct z_thpool_check_struct *)p_arg;
+
+    __atomic_add_fetch(&p_check->gate_nums, 1, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&p_check->run_flag, __ATOMIC_ACQUIRE)) {
+        usleep(100);
+    }
+}
+
+/**
+@brief Self-check thread clearing run_flag after a short delay, so a caller can block before the gate opens
+@param p_arg Shared check state
+@return NULL
+*/
+static void *z_thpool_check_open(void *p_arg) {
+    usleep(5000);
+    __atomic_store_n(&((struct z_thpool_check_struct *)p_arg)->run_flag, 0, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/**
+@brief Self-check callback counting the runs whose stack lies in a slot of the stack arena, then holding its worker like the gate
+@param p_arg Shared check state
+@return No return value
+*/
+static void z_thpool_check_stack(void *p_arg) {
+    struct z_thpool_check_struct *p_check = (struct z_thpool_check_struct *)p_arg;
+    struct z_thpool_mng_struct *p_mng = (struct z_thpool_mng_struct *)p_check->handle;
+    uint8_t probe = 0;
+
+    for (uint32_t i = 0; i < p_mng->max_nums; i++) {
+        uint8_t *p_stack = (uint8_t *)p_mng->p_workers[i].p_stack;
+        if (p_stack && &probe >= p_stack && &probe < p_stack + p_mng->stack_size) {
+            __atomic_add_fetch(&p_check->done_nums, 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    z_thpool_check_gate(p_arg);
+}
+
+/**
+@brief Background producer of the self-checks, submits short tasks until run_flag is cleared
+@param p_arg Shared check state
+@return NULL
+*/
+static void *z_thpool_check_pub(void *p_arg) {
+    struct z_thpool_check_struct *p_check = (struct z_thpool_check_struct *)p_arg;
+
+    while (__atomic_load_n(&p_check->run_flag, __ATOMIC_RELAXED)) {
+        if (z_thpool_add_work(p_check->handle, z_thpool_check_count, p_check) != 0) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+/**
+@brief Self-check task function counting its runs
+@param p_arg Shared check state
+@return p_arg
+*/
+static void *z_thpool_check_task(void *p_arg) {
+    z_thpool_check_count(p_arg);
+    return p_arg;
+}
+
+/**
+@brief Self-check completion callback counting its runs
+@param p_ret Result of the task
+@param p_ctx Shared check state
+@return No return value
+*/
+static void z_thpool_check_then(void *p_ret, void *p_ctx) {
+    __atomic_add_fetch(&((struct z_thpool_check_struct *)p_ctx)->then_nums, p_ret ? 1 : 1000, __ATOMIC_RELAXED);
+}
+
+/**
+@brief Self-check discard callback counting the tasks handed back
+@param cb Callback of the discarded task
+@param p_arg Argument of the discarded task
+@param p_ctx Shared check state
+@return No return value
+*/
+static void z_thpool_check_discard(void (*cb)(void *), void *p_arg, void *p_ctx) {
+    if (cb == z_thpool_check_count && p_arg == p_ctx) {
+        __atomic_add_fetch(&((struct z_thpool_check_struct *)p_ctx)->discard_nums, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+@brief Self-check thread waiting on a task handle, then releasing it
+@param p_arg Shared check state
+@return NULL
+*/
+static void *z_thpool_check_waiter(void *p_arg) {
+    struct z_thpool_check_struct *p_check = (struct z_thpool_check_struct *)p_arg;
+
+    p_check->wait_ret = z_thpool_task_wait(p_check->task, Z_THPOOL_WAIT_FOREVER, NULL);
+    z_thpool_task_release(p_check->task);
+    return NULL;
+}
+
+/**
+@brief Self-check thread attaching a second completion callback to a task handle
+@param p_arg Shared check state
+@return NULL
+*/
+static void *z_thpool_check_attach(void *p_arg) {
+    struct z_thpool_check_struct *p_check = (struct z_thpool_check_struct *)p_arg;
+
+    p_check->wait_ret = z_thpool_task_then(p_check->task, z_thpool_check_then, p_check);
+    return NULL;
+}
+
+/**
+@brief Check that a completion callback runs exactly once however z_thpool_task_then races, and that handles cover the queue
+@return Status, success is 0
+*/
+static int32_t z_thpool_check_task_then(void) {
+    struct z_thpool_config_struct t_config = {
+        .max_thread_nums = 1,
+        .msg_node_max = 10,
+        .thread_stack_size = 64 * 1024
+    };
+    struct z_thpool_check_struct check = {0};
+    z_thpool_task_t tasks[64];
+    uint32_t nums = 0;
+    uint32_t rounds = 100;
+    int32_t ret = -1;
+    pthread_t tid;
+
+    if (z_thpool_create(&t_config, &check.handle) != 0) {
+        return -1;
+    }
+
+    // Two callers race each other and the worker, exactly one wins and its callback runs once
+    for (uint32_t i = 0; i < rounds; i++) {
+        if (z_thpool_submit(check.handle, z_thpool_check_task, &check, &check.task) != 0) {
+            goto exit;
+        }
+        if (pthread_create(&tid, NULL, z_thpool_check_attach, &check) != 0) {
+            z_thpool_task_release(check.task);
+            goto exit;
+        }
+        int32_t first = z_thpool_task_then(check.task, z_thpool_check_then, &check);
+        pthread_join(tid, NULL);
+        z_thpool_task_wait(check.task, Z_THPOOL_WAIT_FOREVER, NULL);
+        if (!((first == 0 && check.wait_ret == -EBUSY) || (first == -EBUSY && check.wait_ret == 0))) {
+            fprintf(stderr, "task_then returned %d and %d at round %u\n", first, check.wait_ret, i);
+            z_thpool_task_release(check.task);
+            goto exit;
+        }
+
+        // On a finished task the callback runs at once, a second one is still refused
+        if (i == 0) {
+            if (z_thpool_task_then(check.task, z_thpool_check_then, &check) != -EBUSY) {
+                fprintf(stderr, "task_then attached twice to a finished task\n");
+                z_thpool_task_release(check.task);
+                goto exit;
+            }
+        }
+        z_thpool_task_release(check.task);
+    }
+
+    // Keep the worker busy, handles must outlast the queue so a full queue reports -EAGAIN rather than -ENOMEM
+    z_thpool_add_work(check.handle, z_thpool_check_slow, &check);
+    while (nums < sizeof(tasks) / sizeof(tasks[0]) && (ret = z_thpool_submit(check.handle, z_thpool_check_task, &check, &tasks[nums])) == 0) {
+        nums++;
+    }
+    for (uint32_t i = 0; i < nums; i++) {
+        z_thpool_task_release(tasks[i]);
+    }
+    if (ret != -EAGAIN) {
+        fprintf(stderr, "Submit stopped with %d after %u tasks\n", ret, nums);
+        ret = -1;
+        goto exit;
+    }
+    ret = 0;
+
+exit:
+    z_thpool_destroy(check.handle);
+    if (ret == 0 && check.then_nums != rounds) {
+        fprintf(stderr, "Completion callbacks ran %" PRIu64 " times for %u tasks\n", check.then_nums, rounds);
+        ret = -1;
+    }
+    return ret;
+}
+
+/**
+@brief Check that DRAIN runs every queued task and DISCARD hands them back, cancelling waited-for task handles
+@return Status, success is 0
+*/
+static int32_t z_thpool_check_destroy(void) {
+    struct z_thpool_config_struct t_config = {
+        .max_thread_nums = 1,
+        .msg_node_max = 64,
+        .thread_stack_size = 64 * 1024
+    };
+    struct z_thpool_check_struct check = {0};
+    pthread_t tid;
+
+    // DRAIN: the single worker is busy while the rest queues up, all of it runs before destroy returns
+    if (z_thpool_create(&t_config, &check.handle) != 0) {
+        return -1;
+    }
+    z_thpool_add_work(check.handle, z_thpool_check_slow, &check);
+    for (uint32_t i = 0; i < 16; i++) {
+        z_thpool_add_work(check.handle, z_thpool_check_count, &check);
+    }
+    if (z_thpool_destroy_ex(check.handle, E_Z_THPOOL_DESTROY_DRAIN, Z_THPOOL_WAIT_FOREVER, z_thpool_check_discard, &check) != 0 ||
+        check.done_nums != 16 || check.slow_nums != 1 || check.discard_nums != 0) {
+        fprintf(stderr, "DRAIN ran %" PRIu64 " of 16 tasks, discarded %" PRIu64 "\n", check.done_nums, check.discard_nums);
+        return -1;
+    }
+
+    // DISCARD: queued tasks go to the callback, a task handle completes as cancelled and wakes its waiter
+    memset(&check, 0, sizeof(check));
+    if (z_thpool_create(&t_config, &check.handle) != 0) {
+        return -1;
+    }
+    z_thpool_add_work(check.handle, z_thpool_check_slow, &check);
+    for (uint32_t i = 0; i < 16; i++) {
+        z_thpool_add_work(check.handle, z_thpool_check_count, &check);
+    }
+    if (z_thpool_submit(check.handle, z_thpool_check_task, &check, &check.task) != 0) {
+        z_thpool_destroy(check.handle);
+        return -1;
+    }
+    z_thpool_task_then(check.task, z_thpool_check_then, &check);
+    if (pthread_create(&tid, NULL, z_thpool_check_waiter, &check) != 0) {
+        z_thpool_task_release(check.task);
+        z_thpool_destroy(check.handle);
+        return -1;
+    }
+    int32_t ret = z_thpool_destroy_ex(check.handle, E_Z_THPOOL_DESTROY_DISCARD, 0, z_thpool_check_discard, &check);
+    pthread_join(tid, NULL);
+    if (ret != 0 || check.done_nums + check.discard_nums != 16 || check.wait_ret != -ECANCELED || check.then_nums != 1000) {
+        fprintf(stderr, "DISCARD ran %" PRIu64 " and discarded %" PRIu64 " of 16 tasks, wait %d, then %" PRIu64 "\n", check.done_nums,
+                check.discard_nums, check.wait_ret, check.then_nums);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+@brief Check that wait_idle and wait groups never return while an accepted task is pending
+@return Status, success is 0
+*/
+static int32_t z_thpool_check_idle(void) {
+    struct z_thpool_config_struct t_config = {
+        .max_thread_nums = 2,
+        .msg_node_max = 64,
+        .thread_stack_size = 64 * 1024,
+        .queue_type = E_Z_THPOOL_QUEUE_MPMC
+    };
+    struct z_thpool_check_struct check = {0};
+    struct z_thpool_wg_struct wg;
+    pthread_t tid;
+    int32_t ret = -1;
+
+    if (z_thpool_create(&t_config, &check.handle) != 0) {
+        return -1;
+    }
+
+    // A concurrent producer keeps completions racing with submissions, a long task must still be waited for
+    check.run_flag = 1;
+    if (pthread_create(&tid, NULL, z_thpool_check_pub, &check) != 0) {
+        z_thpool_destroy(check.handle);
+        return -1;
+    }
+    for (uint32_t i = 0; i < 200; i++) {
+        uint64_t slow_nums = __atomic_load_n(&check.slow_nums, __ATOMIC_RELAXED);
+        while (z_thpool_add_work(check.handle, z_thpool_check_slow, &check) != 0) {
+            sched_yield();
+        }
+        while (z_thpool_wait_idle(check.handle, 100000000ULL) == -ETIMEDOUT) {
+        }
+        if (__atomic_load_n(&check.slow_nums, __ATOMIC_RELAXED) != slow_nums + 1) {
+            fprintf(stderr, "wait_idle returned with a task pending at round %u\n", i);
+            goto exit;
+        }
+    }
+    __atomic_store_n(&check.run_flag, 0, __ATOMIC_RELAXED);
+    pthread_join(tid, NULL);
+
+    // A wait group only covers its own tasks
+    z_thpool_wg_init(&wg);
+    check.slow_nums = 0;
+    for (uint32_t i = 0; i < 32; i++) {
+        if (z_thpool_add_work_wg(check.handle, &wg, z_thpool_check_slow, &check) != 0) {
+            fprintf(stderr, "Failed to add wait group task %u\n", i);
+            z_thpool_wg_wait(&wg, Z_THPOOL_WAIT_FOREVER);
+            z_thpool_wg_destroy(&wg);
+            goto exit;
+        }
+    }
+    ret = z_thpool_wg_wait(&wg, Z_THPOOL_WAIT_FOREVER);
+    z_thpool_wg_destroy(&wg);
+    if (ret != 0 || __atomic_load_n(&check.slow_nums, __ATOMIC_RELAXED) != 32) {
+        fprintf(stderr, "Wait group returned after %" PRIu64 " of 32 tasks\n", check.slow_nums);
+        ret = -1;
+    }
+
+exit:
+    if (__atomic_exchange_n(&check.run_flag, 0, __ATOMIC_RELAXED)) {
+        pthread_join(tid, NULL);
+    }
+    z_thpool_destroy(check.handle);
+    return ret;
+}
+
+/**
+@brief Check that a full queue refuses add_work, times out add_work_timed and blocks add_work_wait until space frees
+@return Status, success is 0
+*/
+static int32_t z_thpool_check_block(void) {
+    struct z_thpool_config_struct t_config = {
+        .max_thread_nums = 1,
+        .msg_node_max = 8,
+        .thread_stack_size = 64 * 1024
+    };
+    struct z_thpool_check_struct check = {0};
+    uint32_t nums = 0;
+    int32_t ret = -1;
+    pthread_t tid;
+
+    if (z_thpool_create(&t_config, &check.handle) != 0) {
+        return -1;
+    }
+
+    // The gate holds the only worker, so the queue fills up behind it
+    check.run_flag = 1;
+    if (z_thpool_add_work(check.handle, z_thpool_check_gate, &check) != 0) {
+        goto exit;
+    }
+    while (!__atomic_load_n(&check.gate_nums, __ATOMIC_ACQUIRE)) {
+        usleep(100);
+    }
+    while (nums < 1024 && z_thpool_add_work(check.handle, z_thpool_check_count, &check) == 0) {
+        nums++;
+    }
+    if (nums == 0 || nums == 1024 || z_thpool_add_work(check.handle, z_thpool_check_count, &check) != -EAGAIN) {
+        fprintf(stderr, "Queue accepted %u tasks without reporting full\n", nums);
+        goto exit;
+    }
+    if (z_thpool_add_work_timed(check.handle, z_thpool_check_count, &check, 2000000ULL) != -ETIMEDOUT) {
+        fprintf(stderr, "Timed add did not time out on a full queue\n");
+        goto exit;
+    }
+
+    // The gate opens while add_work_wait blocks, the waiting task is accepted once the worker drains the queue
+    if (pthread_create(&tid, NULL, z_thpool_check_open, &check) != 0) {
+        goto exit;
+    }
+    ret = z_thpool_add_work_wait(check.handle, z_thpool_check_count, &check);
+    pthread_join(tid, NULL);
+    if (ret != 0 || z_thpool_wait_idle(check.handle, Z_THPOOL_WAIT_FOREVER) != 0 || check.done_nums != nums + 1) {
+        fprintf(stderr, "Blocking add returned %d, %" PRIu64 " of %u tasks ran\n", ret, check.done_nums, nums + 1);
+        ret = -1;
+    }
+
+exit:
+    __atomic_store_n(&check.run_flag, 0, __ATOMIC_RELEASE);
+    z_thpool_destroy(check.handle);
+    return ret;
+}
+
+/**
+@brief Check that an elastic pool spawns a worker per blocked task up to the maximum and retires them after the keep-alive
+@return Status, success is 0
+*/
+static int32_t z_thpool_check_elastic(void) {
+    struct z_thpool_config_struct t_config = {
+        .max_thread_nums = 4,
+        .msg_node_max = 16,
+        .thread_stack_size = 64 * 1024,
+        .min_thread_nums = 1,
+        .idle_timeout_ms = 10
+    };
+    struct z_thpool_stats_struct stats;
+
+    for (uint32_t type = E_Z_THPOOL_QUEUE_KFIFO; type <= E_Z_THPOOL_QUEUE_MPMC; type++) {
+        struct z_thpool_check_struct check = {0};
+        uint32_t ms = 0;
+
+        t_config.queue_type = type;
+        if (z_thpool_create(&t_config, &check.handle) != 0) {
+            return -1;
+        }
+
+        // Every gate holds a worker, so each submission finds no idle thread and spawns one
+        check.run_flag = 1;
+        for (uint32_t i = 0; i < t_config.max_thread_nums; i++) {
+            z_thpool_add_work(check.handle, z_thpool_check_gate, &check);
+        }
+        while (__atomic_load_n(&check.gate_nums, __ATOMIC_ACQUIRE) < t_config.max_thread_nums && ms++ < 2000) {
+            usleep(1000);
+        }
+        z_thpool_get_stats(check.handle, &stats);
+        __atomic_store_n(&check.run_flag, 0, __ATOMIC_RELEASE);
+        if (check.gate_nums != t_config.max_thread_nums || stats.spawn_nums != t_config.max_thread_nums || stats.run_thread_nums != t_config.max_thread_nums) {
+            fprintf(stderr, "Queue %u ran %u gates on %u threads after %u spawns\n", type, check.gate_nums, stats.run_thread_nums, stats.spawn_nums);
+            z_thpool_destroy(check.handle);
+            return -1;
+        }
+
+        // Once idle, the threads above the minimum retire after the keep-alive
+        z_thpool_wait_idle(check.handle, Z_THPOOL_WAIT_FOREVER);
+        for (ms = 0; ms < 2000; ms++) {
+            z_thpool_get_stats(check.handle, &stats);
+            if (stats.run_thread_nums == t_config.min_thread_nums) {
+                break;
+            }
+            usleep(1000);
+        }
+        z_thpool_destroy(check.handle);
+        if (stats.run_thread_nums != t_config.min_thread_nums || stats.retire_nums != t_config.max_thread_nums - t_config.min_thread_nums) {
+            fprintf(stderr, "Queue %u kept %u threads after %u retirements\n", type, stats.run_thread_nums, stats.retire_nums);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+@brief Check that strict priority serves a lane only once every higher lane is empty
+@return Status, success is 0
+*/
+static int32_t z_thpool_check_prio(void) {
+    struct z_thpool_config_struct t_config = {
+        .max_thread_nums = 1,
+        .msg_node_max = 8,
+        .thread_stack_size = 64 * 1024,
+        .prio_nums = 3,
+        .prio_policy = E_Z_THPOOL_PRIO_STRICT
+    };
+    struct z_thpool_check_lane_struct lanes[3];
+    const uint32_t per_lane = 4;
+
+    for (uint32_t type = E_Z_THPOOL_QUEUE_KFIFO; type <= E_Z_THPOOL_QUEUE_MPMC; type++) {
+        struct z_thpool_check_struct check = {0};
+        int32_t ret = 0;
+
+        t_config.queue_type = type;
+        if (z_thpool_create(&t_config, &check.handle) != 0) {
+            return -1;
+        }
+
+        // The gate holds the only worker while the lanes are filled lowest priority first
+        check.run_flag = 1;
+        z_thpool_add_work(check.handle, z_thpool_check_gate, &check);
+        while (!__atomic_load_n(&check.gate_nums, __ATOMIC_ACQUIRE)) {
+            usleep(100);
+        }
+        for (uint32_t i = 0; i < per_lane * 3; i++) {
+            struct z_thpool_check_lane_struct *p_lane = &lanes[2 - i % 3];
+            p_lane->p_check = &check;
+            p_lane->prio = 2 - i % 3;
+            ret |= z_thpool_add_work_prio(check.handle, p_lane->prio, z_thpool_check_lane, p_lane);
+        }
+        if (ret != 0 || z_thpool_add_work_prio(check.handle, 3, z_thpool_check_lane, &lanes[0]) != -EINVAL) {
+            fprintf(stderr, "Queue %u refused a lane task or accepted lane 3\n", type);
+            ret = -1;
+        }
+        __atomic_store_n(&check.run_flag, 0, __ATOMIC_RELEASE);
+        z_thpool_wait_idle(check.handle, Z_THPOOL_WAIT_FOREVER);
+        z_thpool_destroy(check.handle);
+
+        for (uint32_t i = 0; ret == 0 && i < per_lane * 3; i++) {
+            if (check.order_nums != per_lane * 3 || check.order[i] != i / per_lane) {
+                fprintf(stderr, "Queue %u ran %u lane tasks, task %u came from lane %u\n", type, check.order_nums, i, check.order[i]);
+                ret = -1;
+            }
+        }
+        if (ret != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+@brief Check that the per-worker and per-shard counters add up to the tasks run once several producers have stopped
+@return Status, success is 0
+*/
+static int32_t z_thpool_check_stats(void) {
+    struct z_thpool_config_struct t_config = {
+        .max_thread_nums = 4,
+        .msg_node_max = 64,
+        .thread_stack_size = 64 * 1024,
+        .worker_batch_max = 4,
+        .prio_nums = 2
+    };
+    struct z_thpool_stats_struct stats;
+    struct z_thpool_pub_stat_struct pub;
+    struct z_thpool_work_stat_struct work;
+    pthread_t tids[3];
+
+    for (uint32_t type = E_Z_THPOOL_QUEUE_KFIFO; type <= E_Z_THPOOL_QUEUE_MPMC; type++) {
+        struct z_thpool_check_struct check = {0};
+        uint32_t nums = 0;
+
+        t_config.queue_type = type;
+        if (z_thpool_create(&t_config, &check.handle) != 0) {
+            return -1;
+        }
+
+        // Producers land on different shards and tasks spread over the workers
+        check.run_flag = 1;
+        while (nums < sizeof(tids) / sizeof(tids[0]) && pthread_create(&tids[nums], NULL, z_thpool_check_pub, &check) == 0) {
+            nums++;
+        }
+        usleep(20000);
+        __atomic_store_n(&check.run_flag, 0, __ATOMIC_RELAXED);
+        for (uint32_t i = 0; i < nums; i++) {
+            pthread_join(tids[i], NULL);
+        }
+        for (uint32_t i = 0; i < 8; i++) {
+            z_thpool_add_work_prio(check.handle, 0, z_thpool_check_count, &check);
+        }
+        z_thpool_wait_idle(check.handle, Z_THPOOL_WAIT_FOREVER);
+
+        z_thpool_stat_sum(check.handle, &pub, &work);
+        z_thpool_get_stats(check.handle, &stats);
+        z_thpool_destroy(check.handle);
+        uint64_t done_nums = __atomic_load_n(&check.done_nums, __ATOMIC_RELAXED);
+        if (work.exec_nums != done_nums || pub.pub_nums != done_nums || stats.submitted != done_nums || stats.executed != done_nums ||
+            stats.lane_deq_nums[0] + stats.lane_deq_nums[1] != done_nums || stats.lane_deq_nums[0] < 8 || stats.rejected_full != pub.full_nums ||
+            stats.pub_bytes != stats.sub_bytes || stats.busy_thread_nums != 0 || stats.queue_depth != 0) {
+            fprintf(stderr, "Queue %u ran %" PRIu64 " tasks, workers counted %" PRIu64 ", shards %" PRIu64 ", lanes %" PRIu64 " + %" PRIu64 ", busy %u\n", type,
+                    done_nums, work.exec_nums, pub.pub_nums, stats.lane_deq_nums[0], stats.lane_deq_nums[1], stats.busy_thread_nums);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+@brief Check that workers run on guarded arena stacks, also after an elastic pool retired and respawned them
+@return Status, success is 0
+*/
+static int32_t z_thpool_check_arena(void) {
+    struct z_thpool_config_struct t_config = {
+        .max_thread_nums = 2,
+        .msg_node_max = 16,
+        .thread_stack_size = 64 * 1024,
+        .min_thread_nums = 1,
+        .idle_timeout_ms = 10
+    };
+    static const uint32_t flags[] = {
+        E_Z_THPOOL_STACK_ARENA,
+        E_Z_THPOOL_STACK_ARENA | E_Z_THPOOL_STACK_PREFAULT,
+        E_Z_THPOOL_STACK_ARENA | E_Z_THPOOL_STACK_HUGE | E_Z_THPOOL_STACK_PREFAULT,
+    };
+    const uint32_t rounds = 2;
+    struct z_thpool_stats_struct stats;
+    int32_t fds[2];
+
+    // The kernel reports EFAULT instead of raising a signal when write() reads a guard page
+    if (pipe(fds) != 0) {
+        return -1;
+    }
+
+    int32_t ret = 0;
+    for (uint32_t f = 0; ret == 0 && f < sizeof(flags) / sizeof(flags[0]); f++) {
+        struct z_thpool_check_struct check = {0};
+        uint8_t byte;
+
+        t_config.stack_flags = flags[f];
+        if (z_thpool_create(&t_config, &check.handle) != 0) {
+            ret = -1;
+            break;
+        }
+
+        struct z_thpool_mng_struct *p_mng = (struct z_thpool_mng_struct *)check.handle;
+        size_t unit = (flags[f] & E_Z_THPOOL_STACK_HUGE) ? Z_THPOOL_HUGE_SIZE : (size_t)sysconf(_SC_PAGESIZE);
+        for (uint32_t i = 0; i < p_mng->max_nums; i++) {
+            uint8_t *p_stack = (uint8_t *)p_mng->p_workers[i].p_stack;
+            if (!p_stack || ((uintptr_t)p_stack & (unit - 1)) || write(fds[1], p_stack, 1) != 1 || read(fds[0], &byte, 1) != 1 ||
+                write(fds[1], p_stack - 1, 1) != -1 || errno != EFAULT) {
+                fprintf(stderr, "Stack flags %u: slot %u stack %p is not a guarded arena stack\n", flags[f], i, (void *)p_stack);
+                ret = -1;
+                break;
+            }
+        }
+
+        // Every round spawns the second worker on its arena slot and lets it retire again
+        for (uint32_t r = 0; ret == 0 && r < rounds; r++) {
+            uint32_t ms = 0;
+
+            check.gate_nums = 0;
+            check.run_flag = 1;
+            for (uint32_t i = 0; i < t_config.max_thread_nums; i++) {
+                z_thpool_add_work(check.handle, z_thpool_check_stack, &check);
+            }
+            while (__atomic_load_n(&check.gate_nums, __ATOMIC_ACQUIRE) < t_config.max_thread_nums && ms++ < 2000) {
+                usleep(1000);
+            }
+            __atomic_store_n(&check.run_flag, 0, __ATOMIC_RELEASE);
+            z_thpool_wait_idle(check.handle, Z_THPOOL_WAIT_FOREVER);
+            for (ms = 0; ms < 2000; ms++) {
+                z_thpool_get_stats(check.handle, &stats);
+                if (stats.run_thread_nums == t_config.min_thread_nums) {
+                    break;
+                }
+                usleep(1000);
+            }
+        }
+        z_thpool_destroy(check.handle);
+        if (ret == 0 && (check.done_nums != rounds * t_config.max_thread_nums || stats.retire_nums != rounds)) {
+            fprintf(stderr, "Stack flags %u: %" PRIu64 " of %u tasks ran on the arena, %u retirements\n", flags[f], check.done_nums,
+                    rounds * t_config.max_thread_nums, stats.retire_nums);
+            ret = -1;
+        }
+    }
+    close(fds[0]);
+    close(fds[1]);
+    return ret;
+}
+
+/**
+@brief Task callback function
+@param p_arg Parameter
+@return No return value
+*/
+static void z_thpool_test_task_cb(void *p_arg) {
+    int32_t num = *((int32_t *)p_arg);
+    printf("Task %d is being processed by thread %lu\n", num, pthread_self());
+    sleep(1); // Simulate task processing time
+}
+
+/**
+@brief Test the thread pool functionality
+@return Status, success is 0
 */
 int32_t z_thpool_test(void) {
     // Configuration for the thread pool extreme test
@@ -354,6 +3981,25 @@ int32_t z_thpool_test(void) {
     strncpy(t_config.pool_name, "test_pool", sizeof(t_config.pool_name) - 1);
     t_config.pool_name[sizeof(t_config.pool_name) - 1] = '\0';
 
+    // Focused self-checks first, the extreme test below only prints
+    static int32_t (*const checks[])(void) = {
+        z_thpool_check_idle,
+        z_thpool_check_destroy,
+        z_thpool_check_task_then,
+        z_thpool_check_block,
+        z_thpool_check_elastic,
+        z_thpool_check_prio,
+        z_thpool_check_stats,
+        z_thpool_check_arena,
+    };
+    for (uint32_t i = 0; i < sizeof(checks) / sizeof(checks[0]); i++) {
+        if (checks[i]() != 0) {
+            printf("Thread pool self-check %u failed\n", i);
+            return -1;
+        }
+    }
+    printf("Thread pool self-checks passed\n");
+
     printf("Starting thread pool extreme test...\n");
     
     // Create thread pool
@@ -379,10 +4025,8 @@ int32_t z_thpool_test(void) {
     }
 
     // Wait for tasks to be processed
-    for (int32_t i = 0; i < 5; i++) {
-        printf("Waiting...\n");
-        sleep(1);
-    }
+    printf("Waiting...\n");
+    z_thpool_wait_idle(handle, Z_THPOOL_WAIT_FOREVER);
 
     // Verify data integrity
     for (int32_t i = 0; i < 100; i++) {
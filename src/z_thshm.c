@@ -0,0 +1,662 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // memfd_create
+#endif
+
+#include "z_tool.h"
+#include "z_debug.h"
+#include "z_thpool.h"
+#include "z_thshm.h"
+#include "z_table_print.h"
+
+#include <inttypes.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#define Z_THSHM_MAGIC 0x5a54484d // "ZTHM", marks a channel segment
+#define Z_THSHM_CACHE_LINE 64    // Keeps producer, consumer and wakeup words apart
+#define Z_THSHM_SLOT_HEAD 16     // Bytes in front of each payload: seq, id, len and padding
+#define Z_THSHM_SPIN_NS 50000    // Time the consumer polls an empty ring before it sleeps
+#define Z_THSHM_SPIN_CHECKS 64   // Ring polls between two clock reads while spinning
+#define Z_THSHM_FULL_SLEEP_US 50 // Pause of the consumer while the pool queue is full
+#define Z_THSHM_ID_NONE UINT32_MAX // Id of a slot given back by a sender that found the channel closed after claiming it
+
+// Hint to the CPU that this is a busy-wait loop
+#if defined(__x86_64__) || defined(__i386__)
+#define Z_THSHM_CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__aarch64__) || defined(__arm__)
+#define Z_THSHM_CPU_RELAX() __asm__ __volatile__("yield" ::: "memory")
+#else
+#define Z_THSHM_CPU_RELAX() __asm__ __volatile__("" ::: "memory")
+#endif
+
+// Header of the shared segment, followed by the slots; every process maps it at its own address
+struct z_thshm_ring_struct {
+    uint32_t magic;     // Z_THSHM_MAGIC once the creator has initialized the segment
+    uint32_t slot_nums; // Number of slots (power of two)
+    uint32_t slot_size; // Stride between two slots, header included
+    uint32_t data_max;  // Largest payload of a message
+    uint32_t closed;    // Set by the creator on destroy, senders get -ESHUTDOWN
+    uint8_t pad0[Z_THSHM_CACHE_LINE];
+    uint32_t in; // Next position to claim, only touched by producers
+    uint8_t pad1[Z_THSHM_CACHE_LINE];
+    uint32_t out;      // Next position to consume, only written by the consumer
+    uint32_t sleeping; // Consumer parked on wake_seq, the producer clearing it issues the wake
+    uint32_t wake_seq; // Futex word the consumer sleeps on
+    uint8_t pad2[Z_THSHM_CACHE_LINE];
+    uint32_t space_seq;   // Futex word producers blocked on a full ring sleep on
+    uint32_t space_waits; // Number of blocked producers
+    uint8_t pad3[Z_THSHM_CACHE_LINE];
+    uint64_t send_nums; // Messages accepted from every process
+    uint64_t full_nums; // Sends refused because the ring was full
+    uint64_t recv_nums; // Messages handed to the pool
+    uint64_t drop_nums; // Messages with an unregistered id or refused by the pool
+    uint64_t wake_nums; // Wake system calls issued by producers
+    uint64_t park_nums; // Times the consumer went to sleep
+    uint8_t p_slots[];  // slot_nums slots of slot_size bytes
+};
+
+// Structure holding one process's view of a channel
+struct z_thshm_struct {
+    struct z_thshm_ring_struct *p_ring;            // Shared segment mapped into this process
+    size_t map_size;                               // Bytes mapped
+    int32_t fd;                                    // Segment memfd, owned by the creator only
+    uint32_t owner;                                // Whether this process created the channel
+    void (*p_table[Z_THSHM_DISPATCH_MAX])(void *); // Dispatch table of the creator, indexed by message id
+    z_thpool_handle_t pool;                        // Pool the consumer submits to
+    pthread_t tid;                                 // Consumer thread
+    uint32_t run_flag;                             // Consumer keeps running while set
+    uint32_t serve_flag;                           // Whether the consumer thread was started
+    uint32_t slot_nums;                            // Private copies of the ring geometry, any attached process can rewrite the shared header
+    uint32_t slot_size;
+    uint32_t data_max;
+};
+
+static void *z_thshm_proc(void *p_arg);
+
+/**
+@brief Sleep on a futex word shared between processes until it changes from val
+@param p_addr Futex word inside the shared segment
+@param val Value expected in the word
+@param p_deadline Absolute CLOCK_MONOTONIC deadline, NULL waits forever
+@return 0 when woken or the value changed, -ETIMEDOUT on timeout
+*/
+static int32_t z_thshm_futex_wait(uint32_t *p_addr, uint32_t val, const struct timespec *p_deadline) {
+    // No FUTEX_PRIVATE_FLAG, the waker lives in another process
+    if (syscall(SYS_futex, p_addr, FUTEX_WAIT_BITSET, val, p_deadline, NULL, FUTEX_BITSET_MATCH_ANY) != 0 && errno == ETIMEDOUT) {
+        return -ETIMEDOUT;
+    }
+    return 0;
+}
+
+/**
+@brief Wake sleepers of a futex word shared between processes
+@param p_addr Futex word inside the shared segment
+@param nums Maximum number of sleepers to wake
+@return No return value
+*/
+static void z_thshm_futex_wake(uint32_t *p_addr, int32_t nums) {
+    syscall(SYS_futex, p_addr, FUTEX_WAKE, nums, NULL, NULL, 0);
+}
+
+/**
+@brief Address of the slot holding the given position
+@param p_chan Channel handle of the calling process
+@param pos Ring position
+@return Pointer to the slot, its first word is the sequence number
+*/
+static inline uint8_t *z_thshm_slot(struct z_thshm_struct *p_chan, uint32_t pos) {
+    return p_chan->p_ring->p_slots + (size_t)(pos & (p_chan->slot_nums - 1)) * p_chan->slot_size;
+}
+
+/**
+@brief Map a channel segment and wrap it in a handle
+@param fd Segment memfd
+@param p_head Validated ring geometry, kept in the handle
+@param p_chan Pointer to store the handle
+@return Status, success is 0
+*/
+static int32_t z_thshm_map(int32_t fd, const struct z_thshm_ring_struct *p_head, struct z_thshm_struct **p_chan) {
+    size_t map_size = sizeof(struct z_thshm_ring_struct) + (size_t)p_head->slot_nums * p_head->slot_size;
+    struct z_thshm_struct *p = (struct z_thshm_struct *)calloc(1, sizeof(struct z_thshm_struct));
+    if (!p) {
+        return -ENOMEM;
+    }
+
+    p->p_ring = (struct z_thshm_ring_struct *)mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p->p_ring == MAP_FAILED) {
+        int32_t ret = -errno;
+        free(p);
+        return ret;
+    }
+
+    p->map_size = map_size;
+    p->slot_nums = p_head->slot_nums;
+    p->slot_size = p_head->slot_size;
+    p->data_max = p_head->data_max;
+    p->fd = -1;
+    *p_chan = p;
+    return 0;
+}
+
+/**
+@brief Create a channel in a new memfd segment
+@param slot_nums Number of messages the ring holds, rounded up to a power of two
+@param data_max Largest payload of a message
+@param p_chan Pointer to store the created channel handle
+@return Status, success is 0
+*/
+int32_t z_thshm_create(uint32_t slot_nums, uint32_t data_max, z_thshm_handle_t *p_chan) {
+    if (!p_chan || !slot_nums || slot_nums > (1u << 24) || !data_max || data_max > Z_THPOOL_INLINE_MAX) {
+        return -EINVAL;
+    }
+
+    // Round up the slot count to the nearest power of two, a single slot cannot tell published from free
+    if (slot_nums & (slot_nums - 1)) {
+        slot_nums = Z_TOOL_roundup_pow_of_two(slot_nums);
+    }
+    slot_nums = Z_TOOL_MAX(slot_nums, 2);
+
+    uint32_t slot_size = Z_THSHM_SLOT_HEAD + Z_TOOL_ALIGN_SYS(data_max);
+    size_t map_size = sizeof(struct z_thshm_ring_struct) + (size_t)slot_nums * slot_size;
+
+    int32_t fd = memfd_create("z_thshm", MFD_CLOEXEC);
+    if (fd < 0) {
+        return -errno;
+    }
+    if (ftruncate(fd, map_size) != 0) {
+        int32_t ret = -errno;
+        close(fd);
+        return ret;
+    }
+
+    struct z_thshm_ring_struct t_head = {.slot_nums = slot_nums, .slot_size = slot_size, .data_max = data_max};
+    struct z_thshm_struct *p;
+    int32_t ret = z_thshm_map(fd, &t_head, &p);
+    if (ret != 0) {
+        close(fd);
+        return ret;
+    }
+
+    // The memfd starts zeroed, stamp every slot as writable for the first lap
+    struct z_thshm_ring_struct *p_ring = p->p_ring;
+    p_ring->slot_nums = slot_nums;
+    p_ring->slot_size = slot_size;
+    p_ring->data_max = data_max;
+    for (uint32_t i = 0; i < slot_nums; i++) {
+        *(uint32_t *)z_thshm_slot(p, i) = i;
+    }
+    __atomic_store_n(&p_ring->magic, Z_THSHM_MAGIC, __ATOMIC_RELEASE);
+
+    p->fd = fd;
+    p->owner = 1;
+    *p_chan = p;
+    return 0;
+}
+
+/**
+@brief Get the memfd of a channel
+@param chan Handle to the channel
+@return File descriptor, or -EINVAL
+*/
+int32_t z_thshm_fd(z_thshm_handle_t chan) {
+    if (!chan || !chan->owner) {
+        return -EINVAL;
+    }
+    return chan->fd;
+}
+
+/**
+@brief Attach to a channel from a helper process
+@param fd File descriptor of the channel segment
+@param p_chan Pointer to store the attached channel handle
+@return Status, success is 0, -EINVAL if fd is not a channel segment
+*/
+int32_t z_thshm_attach(int32_t fd, z_thshm_handle_t *p_chan) {
+    struct z_thshm_ring_struct t_head;
+    struct stat st;
+
+    if (fd < 0 || !p_chan) {
+        return -EINVAL;
+    }
+
+    // Validate the header against the segment size before trusting the slot geometry
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(t_head) || pread(fd, &t_head, sizeof(t_head), 0) != sizeof(t_head) ||
+        t_head.magic != Z_THSHM_MAGIC || !t_head.slot_nums || (t_head.slot_nums & (t_head.slot_nums - 1)) ||
+        t_head.slot_size != Z_THSHM_SLOT_HEAD + Z_TOOL_ALIGN_SYS(t_head.data_max) ||
+        (size_t)st.st_size < sizeof(t_head) + (size_t)t_head.slot_nums * t_head.slot_size) {
+        return -EINVAL;
+    }
+
+    return z_thshm_map(fd, &t_head, p_chan);
+}
+
+/**
+@brief Bind a message id to a callback
+@param chan Handle to the channel created by this process
+@param id Message id, below Z_THSHM_DISPATCH_MAX
+@param cb Callback run on the pool with a pointer to a copy of the payload
+@return Status, success is 0
+*/
+int32_t z_thshm_register(z_thshm_handle_t chan, uint32_t id, void (*cb)(void *)) {
+    if (!chan || !chan->owner || id >= Z_THSHM_DISPATCH_MAX) {
+        return -EINVAL;
+    }
+
+    // The consumer thread may read the table concurrently
+    __atomic_store_n(&chan->p_table[id], cb, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/**
+@brief Start the consumer thread of a channel
+@param chan Handle to the channel created by this process
+@param pool Handle to the thread pool running the callbacks
+@return Status, success is 0, -EBUSY if already serving
+*/
+int32_t z_thshm_serve(z_thshm_handle_t chan, z_thpool_handle_t pool) {
+    if (!chan || !chan->owner || !pool) {
+        return -EINVAL;
+    }
+    if (chan->serve_flag) {
+        return -EBUSY;
+    }
+
+    chan->pool = pool;
+    chan->run_flag = 1;
+    if (pthread_create(&chan->tid, NULL, z_thshm_proc, chan) != 0) {
+        chan->run_flag = 0;
+        return -EAGAIN;
+    }
+    chan->serve_flag = 1;
+    return 0;
+}
+
+/**
+@brief Claim a slot, copy the message in and publish it, waking the consumer only when it sleeps
+@param p_chan Channel handle of the calling process
+@param id Message id
+@param p_data Payload bytes
+@param len Payload length, at most data_max
+@return Status, success is 0, -EAGAIN when the ring is full, -ESHUTDOWN when the channel closed before the claim
+*/
+static int32_t z_thshm_push(struct z_thshm_struct *p_chan, uint32_t id, const void *p_data, uint32_t len) {
+    struct z_thshm_ring_struct *p_ring = p_chan->p_ring;
+    uint32_t pos = __atomic_load_n(&p_ring->in, __ATOMIC_RELAXED);
+    uint8_t *p_slot;
+
+    while (1) {
+        p_slot = z_thshm_slot(p_chan, pos);
+        int32_t dif = (int32_t)(__atomic_load_n((uint32_t *)p_slot, __ATOMIC_ACQUIRE) - pos);
+        if (dif == 0) {
+            // Slot is free for this lap, try to claim the position, ordered against the read of in by z_thshm_proc on close
+            if (__atomic_compare_exchange_n(&p_ring->in, &pos, pos + 1, 1, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (dif < 0) {
+            return -EAGAIN; // Slot still holds a message from the previous lap
+        } else {
+            pos = __atomic_load_n(&p_ring->in, __ATOMIC_RELAXED); // Another producer won, reload
+        }
+    }
+
+    // A claim made after the closing consumer read in is not drained, give the slot back empty and report the close
+    if (__atomic_load_n(&p_ring->closed, __ATOMIC_SEQ_CST)) {
+        ((uint32_t *)p_slot)[1] = Z_THSHM_ID_NONE;
+        ((uint32_t *)p_slot)[2] = 0;
+        __atomic_store_n((uint32_t *)p_slot, pos + 1, __ATOMIC_RELEASE);
+        return -ESHUTDOWN;
+    }
+
+    ((uint32_t *)p_slot)[1] = id;
+    ((uint32_t *)p_slot)[2] = len;
+    memcpy(p_slot + Z_THSHM_SLOT_HEAD, p_data, len);
+    __atomic_store_n((uint32_t *)p_slot, pos + 1, __ATOMIC_RELEASE); // Publish to the consumer
+    __atomic_add_fetch(&p_ring->send_nums, 1, __ATOMIC_RELAXED);
+
+    // Order the publish before reading the sleep flag, pairs with the announce in z_thshm_idle
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    uint32_t sleeping = 1;
+    if (__atomic_load_n(&p_ring->sleeping, __ATOMIC_RELAXED) &&
+        __atomic_compare_exchange_n(&p_ring->sleeping, &sleeping, 0, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        __atomic_add_fetch(&p_ring->wake_seq, 1, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&p_ring->wake_nums, 1, __ATOMIC_RELAXED);
+        z_thshm_futex_wake(&p_ring->wake_seq, 1);
+    }
+    return 0;
+}
+
+/**
+@brief Send one message without blocking
+@param chan Handle to the channel
+@param id Message id registered by the serving process
+@param data Payload bytes
+@param len Payload length, 1 to data_max
+@return Status, success is 0, -EAGAIN when full, -EMSGSIZE when too long, -ESHUTDOWN when closed
+*/
+int32_t z_thshm_send(z_thshm_handle_t chan, uint32_t id, const void *data, uint32_t len) {
+    if (!chan || id >= Z_THSHM_DISPATCH_MAX || !data || !len) {
+        return -EINVAL;
+    }
+
+    struct z_thshm_ring_struct *p_ring = chan->p_ring;
+    if (len > chan->data_max) {
+        return -EMSGSIZE;
+    }
+    if (__atomic_load_n(&p_ring->closed, __ATOMIC_RELAXED)) {
+        return -ESHUTDOWN;
+    }
+
+    int32_t ret = z_thshm_push(chan, id, data, len);
+    if (ret == -EAGAIN) {
+        __atomic_add_fetch(&p_ring->full_nums, 1, __ATOMIC_RELAXED);
+    }
+    return ret;
+}
+
+/**
+@brief Send one message, blocking at most timeout_ns while the ring is full
+@param chan Handle to the channel
+@param id Message id registered by the serving process
+@param data Payload bytes
+@param len Payload length, 1 to data_max
+@param timeout_ns Maximum time to wait in nanoseconds, Z_THPOOL_WAIT_FOREVER to wait without limit
+@return Status, success is 0, -ETIMEDOUT on timeout, or the errors of z_thshm_send
+*/
+int32_t z_thshm_send_wait(z_thshm_handle_t chan, uint32_t id, const void *data, uint32_t len, uint64_t timeout_ns) {
+    struct timespec deadline;
+    int32_t ret;
+
+    if (timeout_ns != Z_THPOOL_WAIT_FOREVER) {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeout_ns / 1000000000ULL;
+        deadline.tv_nsec += timeout_ns % 1000000000ULL;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    while ((ret = z_thshm_send(chan, id, data, len)) == -EAGAIN) {
+        struct z_thshm_ring_struct *p_ring = chan->p_ring;
+
+        // Announce the blocked producer before re-checking the slot, pairs with the fence in the consumer
+        uint32_t seq = __atomic_load_n(&p_ring->space_seq, __ATOMIC_ACQUIRE);
+        __atomic_add_fetch(&p_ring->space_waits, 1, __ATOMIC_SEQ_CST);
+        uint32_t pos = __atomic_load_n(&p_ring->in, __ATOMIC_RELAXED);
+        int32_t full = (int32_t)(__atomic_load_n((uint32_t *)z_thshm_slot(chan, pos), __ATOMIC_ACQUIRE) - pos) < 0;
+        if (full && !__atomic_load_n(&p_ring->closed, __ATOMIC_RELAXED)) {
+            ret = z_thshm_futex_wait(&p_ring->space_seq, seq, timeout_ns == Z_THPOOL_WAIT_FOREVER ? NULL : &deadline);
+        }
+        __atomic_sub_fetch(&p_ring->space_waits, 1, __ATOMIC_SEQ_CST);
+        if (ret == -ETIMEDOUT) {
+            return -ETIMEDOUT;
+        }
+    }
+    return ret;
+}
+
+/**
+@brief Wait for the next message: spin for Z_THSHM_SPIN_NS, then sleep on wake_seq
+@param p_chan Channel served by the calling consumer
+@param p_slot Slot of the next position
+@param pos Next position
+@return No return value
+*/
+static void z_thshm_idle(struct z_thshm_struct *p_chan, uint8_t *p_slot, uint32_t pos) {
+    struct z_thshm_ring_struct *p_ring = p_chan->p_ring;
+    struct timespec now;
+    struct timespec end;
+
+    // Busy-poll first so that back-to-back sends never reach the kernel
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    end.tv_nsec += Z_THSHM_SPIN_NS;
+    if (end.tv_nsec >= 1000000000L) {
+        end.tv_sec++;
+        end.tv_nsec -= 1000000000L;
+    }
+    do {
+        for (uint32_t i = 0; i < Z_THSHM_SPIN_CHECKS; i++) {
+            if (__atomic_load_n((uint32_t *)p_slot, __ATOMIC_ACQUIRE) == pos + 1 || !__atomic_load_n(&p_chan->run_flag, __ATOMIC_RELAXED)) {
+                return;
+            }
+            Z_THSHM_CPU_RELAX();
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while (now.tv_sec < end.tv_sec || (now.tv_sec == end.tv_sec && now.tv_nsec < end.tv_nsec));
+
+    // Take the event count before announcing the sleep and re-checking, pairs with z_thshm_push
+    uint32_t seq = __atomic_load_n(&p_ring->wake_seq, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&p_ring->sleeping, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n((uint32_t *)p_slot, __ATOMIC_ACQUIRE) != pos + 1 && __atomic_load_n(&p_chan->run_flag, __ATOMIC_RELAXED)) {
+        __atomic_add_fetch(&p_ring->park_nums, 1, __ATOMIC_RELAXED);
+        z_thshm_futex_wait(&p_ring->wake_seq, seq, NULL);
+    }
+    __atomic_store_n(&p_ring->sleeping, 0, __ATOMIC_SEQ_CST);
+}
+
+/**
+@brief Consumer thread, turns channel messages into pool work through the dispatch table
+@param p_arg Channel served by this thread
+@return No return value
+*/
+static void *z_thshm_proc(void *p_arg) {
+    prctl(PR_SET_NAME, "thshm");
+    struct z_thshm_struct *p_chan = (struct z_thshm_struct *)p_arg;
+    struct z_thshm_ring_struct *p_ring = p_chan->p_ring;
+    uint32_t pos = __atomic_load_n(&p_ring->out, __ATOMIC_RELAXED);
+
+    while (1) {
+        uint8_t *p_slot = z_thshm_slot(p_chan, pos);
+        if (__atomic_load_n((uint32_t *)p_slot, __ATOMIC_ACQUIRE) != pos + 1) {
+            if (!__atomic_load_n(&p_chan->run_flag, __ATOMIC_ACQUIRE)) {
+                // closed was set before run_flag was cleared, a sender claiming after this read of in sees it and backs out,
+                // the earlier claims are drained so that every send that returned 0 is handed over
+                if ((int32_t)(pos - __atomic_load_n(&p_ring->in, __ATOMIC_SEQ_CST)) >= 0) {
+                    break;
+                }
+                sched_yield();
+                continue;
+            }
+            z_thshm_idle(p_chan, p_slot, pos);
+            continue;
+        }
+
+        uint32_t id = ((uint32_t *)p_slot)[1];
+        uint32_t len = ((uint32_t *)p_slot)[2];
+        void (*cb)(void *) = id < Z_THSHM_DISPATCH_MAX ? __atomic_load_n(&p_chan->p_table[id], __ATOMIC_ACQUIRE) : NULL;
+        int32_t ret = -EINVAL;
+
+        // Keep the message in its slot while the pool is full, the ring then pushes back on the senders
+        while (cb && len <= p_chan->data_max) {
+            ret = z_thpool_add_work_copy(p_chan->pool, cb, p_slot + Z_THSHM_SLOT_HEAD, len);
+            if (ret != -EAGAIN) {
+                break;
+            }
+            usleep(Z_THSHM_FULL_SLEEP_US);
+        }
+        if (id != Z_THSHM_ID_NONE) {
+            __atomic_add_fetch(ret == 0 ? &p_ring->recv_nums : &p_ring->drop_nums, 1, __ATOMIC_RELAXED);
+        }
+
+        // Hand the slot back to the producers for the next lap
+        __atomic_store_n((uint32_t *)p_slot, pos + p_chan->slot_nums, __ATOMIC_RELEASE);
+        __atomic_store_n(&p_ring->out, ++pos, __ATOMIC_RELAXED);
+
+        // Order the release before reading the waiter count, pairs with the announce in z_thshm_send_wait
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&p_ring->space_waits, __ATOMIC_RELAXED)) {
+            __atomic_add_fetch(&p_ring->space_seq, 1, __ATOMIC_SEQ_CST);
+            z_thshm_futex_wake(&p_ring->space_seq, INT_MAX);
+        }
+    }
+    return NULL;
+}
+
+/**
+@brief Close a channel; the creator drains accepted messages, stops its consumer and frees the segment
+@param chan Handle to the channel
+@return Status, success is 0
+*/
+int32_t z_thshm_destroy(z_thshm_handle_t chan) {
+    if (!chan) {
+        return -EINVAL;
+    }
+
+    struct z_thshm_ring_struct *p_ring = chan->p_ring;
+    if (chan->owner) {
+        // Refuse new sends and release blocked senders, then stop the consumer
+        __atomic_store_n(&p_ring->closed, 1, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&p_ring->space_seq, 1, __ATOMIC_SEQ_CST);
+        z_thshm_futex_wake(&p_ring->space_seq, INT_MAX);
+        if (chan->serve_flag) {
+            __atomic_store_n(&chan->run_flag, 0, __ATOMIC_SEQ_CST);
+            __atomic_add_fetch(&p_ring->wake_seq, 1, __ATOMIC_SEQ_CST);
+            z_thshm_futex_wake(&p_ring->wake_seq, 1);
+            pthread_join(chan->tid, NULL);
+        }
+        close(chan->fd);
+    }
+
+    munmap(p_ring, chan->map_size);
+    free(chan);
+    return 0;
+}
+
+/**
+@brief Print the channel statistics
+@param chan Handle to the channel
+@return Status, success is 0
+*/
+int32_t z_thshm_show(z_thshm_handle_t chan) {
+    if (!chan) {
+        return -EINVAL;
+    }
+
+    struct z_thshm_ring_struct *p_ring = chan->p_ring;
+    z_table_print_title("z_thshm channel");
+    z_table_print_row("%-18s %u\n", "slot nums:", chan->slot_nums);
+    z_table_print_row("%-18s %u\n", "data max:", chan->data_max);
+    z_table_print_row("%-18s %u\n", "queued:", __atomic_load_n(&p_ring->in, __ATOMIC_RELAXED) - __atomic_load_n(&p_ring->out, __ATOMIC_RELAXED));
+    z_table_print_row("%-18s %" PRIu64 "\n", "sent:", p_ring->send_nums);
+    z_table_print_row("%-18s %" PRIu64 "\n", "full:", p_ring->full_nums);
+    z_table_print_row("%-18s %" PRIu64 "\n", "received:", p_ring->recv_nums);
+    z_table_print_row("%-18s %" PRIu64 "\n", "dropped:", p_ring->drop_nums);
+    z_table_print_row("%-18s %" PRIu64 "\n", "parks:", p_ring->park_nums);
+    z_table_print_row("%-18s %" PRIu64 "\n", "wakes:", p_ring->wake_nums);
+    return 0;
+}
+
+// Counter bumped by the test callback
+static uint64_t gs_thshm_test_sum;
+
+// Test callback, adds the payload to the counter
+static void z_thshm_test_cb(void *p_arg) {
+    __atomic_add_fetch(&gs_thshm_test_sum, *(uint64_t *)p_arg, __ATOMIC_RELAXED);
+}
+
+/**
+@brief Test the channel with a forked sender process
+@return Status, success is 0
+*/
+int32_t z_thshm_test(void) {
+    struct z_thpool_config_struct t_config = {
+        .max_thread_nums = 2,
+        .msg_node_max = 64,
+        .thread_stack_size = 64 * 1024,
+        .msg_inline_max = sizeof(uint64_t)
+    };
+    const uint64_t nums = 100000;
+    z_thpool_handle_t pool;
+    z_thshm_handle_t chan;
+    int32_t ret = -1;
+
+    gs_thshm_test_sum = 0;
+    if (z_thpool_create(&t_config, &pool) != 0) {
+        Z_RAW("Failed to create thread pool\n");
+        return -1;
+    }
+    if (z_thshm_create(32, sizeof(uint64_t), &chan) != 0) {
+        Z_RAW("Failed to create channel\n");
+        z_thpool_destroy(pool);
+        return -1;
+    }
+    z_thshm_register(chan, 1, z_thshm_test_cb);
+    z_thshm_serve(chan, pool);
+
+    // The child attaches through the inherited descriptor, as a helper process would
+    pid_t pid = fork();
+    if (pid == 0) {
+        z_thshm_handle_t peer;
+        int32_t err = z_thshm_attach(z_thshm_fd(chan), &peer);
+        for (uint64_t i = 1; err == 0 && i <= nums; i++) {
+            err = z_thshm_send_wait(peer, 1, &i, sizeof(i), Z_THPOOL_WAIT_FOREVER);
+        }
+        _exit(err == 0 ? 0 : 1);
+    }
+
+    int status = -1;
+    if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        Z_RAW("Sender process failed\n");
+        goto exit;
+    }
+
+    // Every accepted message is handed to the pool before destroy returns
+    z_thshm_destroy(chan);
+    chan = NULL;
+    z_thpool_wait_idle(pool, Z_THPOOL_WAIT_FOREVER);
+    if (gs_thshm_test_sum != nums * (nums + 1) / 2) {
+        Z_RAW("Sum mismatch: %" PRIu64 "\n", gs_thshm_test_sum);
+        goto exit;
+    }
+
+    // Close while a sender is still going, every send that returned 0 must reach the pool
+    int32_t fds[2];
+    if (pipe(fds) != 0 || z_thshm_create(32, sizeof(uint64_t), &chan) != 0) {
+        Z_RAW("Failed to create channel\n");
+        goto exit;
+    }
+    gs_thshm_test_sum = 0;
+    z_thshm_register(chan, 1, z_thshm_test_cb);
+    z_thshm_serve(chan, pool);
+    pid = fork();
+    if (pid == 0) {
+        z_thshm_handle_t peer;
+        uint64_t sum = 0;
+        if (z_thshm_attach(z_thshm_fd(chan), &peer) == 0) {
+            for (uint64_t i = 1; z_thshm_send_wait(peer, 1, &i, sizeof(i), Z_THPOOL_WAIT_FOREVER) == 0; i++) {
+                sum += i;
+            }
+        }
+        _exit(write(fds[1], &sum, sizeof(sum)) == sizeof(sum) ? 0 : 1);
+    }
+    close(fds[1]);
+    usleep(20000);
+    z_thshm_destroy(chan);
+    chan = NULL;
+
+    uint64_t sent = 0;
+    int32_t got = read(fds[0], &sent, sizeof(sent));
+    close(fds[0]);
+    if (pid < 0 || waitpid(pid, &status, 0) != pid || got != sizeof(sent)) {
+        Z_RAW("Sender process failed\n");
+        goto exit;
+    }
+    z_thpool_wait_idle(pool, Z_THPOOL_WAIT_FOREVER);
+    if (sent == 0 || gs_thshm_test_sum != sent) {
+        Z_RAW("Close lost messages: sent %" PRIu64 ", received %" PRIu64 "\n", sent, gs_thshm_test_sum);
+        goto exit;
+    }
+
+    Z_RAW("All tests passed successfully\n");
+    ret = 0;
+exit:
+    if (chan) {
+        z_thshm_destroy(chan);
+    }
+    z_thpool_destroy(pool);
+    return ret;
+}